@@ -10,6 +10,7 @@
 //------------------------------------------------------------------------------
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <curses.h>     // curses is only used for non-blocking keyboard input
 #include <unistd.h>
@@ -33,8 +34,9 @@
 
 static struct {
     c64_t c64;
-    uint32_t pixels[256*1024];  // RGBA8 buffer for emulator's video output
-    char chrs[256*1024];        // the video output converted to Sixel ASCII characters
+    uint32_t* pixels;           // RGBA8 buffer for emulator's video output
+    int pixels_size;
+    char* chrs;                 // the video output converted to Sixel ASCII characters
 } state;
 
 #define FRAME_USEC (33333)
@@ -77,7 +79,7 @@ static void term_sixel_pixels(void) {
     for (int y = 0; y < h; y += 3) {
         for (int x = 0; x < w; x++) {
             char chr = 0;
-            for (int i = 0; i < 3; i++) {
+            for (int i = 0; (i < 3) && ((y+i) < h); i++) {
                 uint32_t p = state.pixels[(y+i)*w + x];
                 // FIXME: convert pixel color back to terminal color
                 if (p == _m6569_colors[6]) {
@@ -110,10 +112,19 @@ int main() {
     // sokol time for rendering frames at correct speed
     stm_setup();
 
+    // allocate the video buffers, the pixel buffer for the C64's max display
+    // size (checked by c64_init()), the sixel buffer for the std display size,
+    // each group of 3 pixel rows becomes 2 chars per pixel plus a '$-' line break
+    const int w = c64_std_display_width();
+    const int h = c64_std_display_height();
+    state.pixels_size = c64_max_display_size();
+    state.pixels = (uint32_t*) calloc(1, (size_t)state.pixels_size);
+    state.chrs = (char*) malloc((size_t)(((h + 2) / 3) * (2 * w + 2) + 1));
+
     // setup the C64 emulator
     c64_init(&state.c64, &(c64_desc_t){
         .pixel_buffer = state.pixels,
-        .pixel_buffer_size = sizeof(state.pixels),
+        .pixel_buffer_size = state.pixels_size,
         .rom_char = dump_c64_char_bin,
         .rom_char_size = sizeof(dump_c64_char_bin),
         .rom_basic = dump_c64_basic_bin,
@@ -168,5 +179,8 @@ int main() {
         }
     }
     endwin();
+    c64_discard(&state.c64);
+    free(state.chrs);
+    free(state.pixels);
     return 0;
 }
@@ -0,0 +1,287 @@
+#pragma once
+/*
+    Base64 decoder for programs embedded in URLs (prg=...).
+
+    Decodes in a single pass straight into the destination buffer.
+    Runs of valid base64 characters are decoded with SIMD instructions
+    (AVX2 or SSSE3 on x86 selected at runtime, NEON on ARM64), anything
+    else (padding, whitespace and other ignored characters, and the last
+    few bytes) goes through the scalar decoder.
+
+    Characters which are not part of the base64 alphabet are ignored,
+    the number of base64 characters must be a multiple of 4, and
+    decoding stops after the first padded group.
+*/
+
+/* upper bound of the decoded size for src_len base64 characters */
+#define BASE64_DECODED_SIZE(src_len) (((src_len)/4)*3)
+
+/* decode base64, returns number of decoded bytes, or -1 on error */
+extern int base64_decode(const char* src, int src_len, uint8_t* dst, int dst_size);
+/* same as base64_decode() but never uses SIMD instructions */
+extern int base64_decode_scalar(const char* src, int src_len, uint8_t* dst, int dst_size);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BASE64_X86 (1)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define BASE64_TARGET(x)
+#else
+#define BASE64_TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BASE64_NEON (1)
+#include <arm_neon.h>
+#endif
+
+/* 0x80 marks characters outside the base64 alphabet, '=' decodes to 0 */
+static const uint8_t _base64_dtable[256] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x3E, 0x80, 0x80, 0x80, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x80, 0x80, 0x80, 0x00, 0x80, 0x80,
+    0x80, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+
+/* A SIMD block function decodes one block of base64 characters and
+   returns true, or returns false without decoding if the block contains
+   anything other than the 64 alphabet characters. The store may be wider
+   than the decoded bytes.
+*/
+typedef bool (*base64_block_func_t)(const char* src, uint8_t* dst);
+
+typedef struct {
+    int src_bytes;      /* characters consumed per block */
+    int dst_bytes;      /* decoded bytes per block */
+    int store_bytes;    /* bytes written per block */
+    base64_block_func_t func;
+} base64_simd_t;
+
+#if defined(BASE64_X86)
+/* see Wojciech Mula, Daniel Lemire: "Faster Base64 Encoding and Decoding Using AVX2 Instructions" */
+BASE64_TARGET("avx2")
+static bool _base64_block_avx2(const char* src, uint8_t* dst) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+    __m256i str = _mm256_loadu_si256((const __m256i*)src);
+    /* validate */
+    const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+    const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) {
+        return false;
+    }
+    /* translate to 6-bit values */
+    const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+    const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+    /* pack 4x6 bits into 3 bytes */
+    str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+    str = _mm256_shuffle_epi8(str, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+    _mm256_storeu_si256((__m256i*)dst, str);
+    return true;
+}
+
+BASE64_TARGET("ssse3")
+static bool _base64_block_ssse3(const char* src, uint8_t* dst) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
+    __m128i str = _mm_loadu_si128((const __m128i*)src);
+    /* validate (_mm_testz_si128 would need SSE4.1) */
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128()))) {
+        return false;
+    }
+    /* translate to 6-bit values */
+    const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    str = _mm_add_epi8(str, roll);
+    /* pack 4x6 bits into 3 bytes */
+    str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+    str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+    str = _mm_shuffle_epi8(str, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i*)dst, str);
+    return true;
+}
+
+static base64_simd_t _base64_select_simd(void) {
+    bool has_ssse3 = false;
+    bool has_avx2 = false;
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        has_ssse3 = 0 != (info[2] & (1<<9));
+        const bool has_osxsave_avx = (info[2] & ((1<<27)|(1<<28))) == ((1<<27)|(1<<28));
+        __cpuidex(info, 7, 0);
+        has_avx2 = has_osxsave_avx && (0 != (info[1] & (1<<5))) && ((_xgetbv(0) & 6) == 6);
+    #else
+        __builtin_cpu_init();
+        has_ssse3 = __builtin_cpu_supports("ssse3");
+        has_avx2 = __builtin_cpu_supports("avx2");
+    #endif
+    base64_simd_t simd = { 0 };
+    if (has_avx2) {
+        simd = (base64_simd_t) { 32, 24, 32, _base64_block_avx2 };
+    }
+    else if (has_ssse3) {
+        simd = (base64_simd_t) { 16, 12, 16, _base64_block_ssse3 };
+    }
+    return simd;
+}
+#elif defined(BASE64_NEON)
+/* translate 16 characters to 6-bit values, accumulate invalid characters in err */
+static uint8x16_t _base64_neon_translate(uint8x16_t c, uint8x16_t* err) {
+    const uint8x16_t upper = vcleq_u8(vsubq_u8(c, vdupq_n_u8('A')), vdupq_n_u8(25));
+    const uint8x16_t lower = vcleq_u8(vsubq_u8(c, vdupq_n_u8('a')), vdupq_n_u8(25));
+    const uint8x16_t digit = vcleq_u8(vsubq_u8(c, vdupq_n_u8('0')), vdupq_n_u8(9));
+    const uint8x16_t plus = vceqq_u8(c, vdupq_n_u8('+'));
+    const uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+    uint8x16_t res = vandq_u8(upper, vsubq_u8(c, vdupq_n_u8(65)));
+    res = vorrq_u8(res, vandq_u8(lower, vsubq_u8(c, vdupq_n_u8(71))));
+    res = vorrq_u8(res, vandq_u8(digit, vaddq_u8(c, vdupq_n_u8(4))));
+    res = vorrq_u8(res, vandq_u8(plus, vdupq_n_u8(62)));
+    res = vorrq_u8(res, vandq_u8(slash, vdupq_n_u8(63)));
+    const uint8x16_t valid = vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, plus)), slash);
+    *err = vorrq_u8(*err, vmvnq_u8(valid));
+    return res;
+}
+
+static bool _base64_block_neon(const char* src, uint8_t* dst) {
+    const uint8x16x4_t in = vld4q_u8((const uint8_t*)src);
+    uint8x16_t err = vdupq_n_u8(0);
+    const uint8x16_t a = _base64_neon_translate(in.val[0], &err);
+    const uint8x16_t b = _base64_neon_translate(in.val[1], &err);
+    const uint8x16_t c = _base64_neon_translate(in.val[2], &err);
+    const uint8x16_t d = _base64_neon_translate(in.val[3], &err);
+    if (0 != vmaxvq_u8(err)) {
+        return false;
+    }
+    uint8x16x3_t out;
+    out.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+    out.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+    vst3q_u8(dst, out);
+    return true;
+}
+
+static base64_simd_t _base64_select_simd(void) {
+    return (base64_simd_t) { 64, 48, 48, _base64_block_neon };
+}
+#else
+static base64_simd_t _base64_select_simd(void) {
+    return (base64_simd_t) { 0 };
+}
+#endif
+
+static int _base64_decode(const char* src, int src_len, uint8_t* dst, int dst_size, const base64_simd_t* simd) {
+    int pos = 0;
+    int size = 0;
+    int count = 0;
+    int pad = 0;
+    bool padded = false;
+    uint8_t block[4];
+    while (pos < src_len) {
+        /* decode whole blocks while at a group boundary */
+        if (simd && (count == 0)) {
+            while (((src_len - pos) >= simd->src_bytes) &&
+                   ((dst_size - size) >= simd->store_bytes) &&
+                   simd->func(&src[pos], &dst[size]))
+            {
+                pos += simd->src_bytes;
+                size += simd->dst_bytes;
+            }
+            if (pos >= src_len) {
+                break;
+            }
+        }
+        const char c = src[pos++];
+        const uint8_t val = _base64_dtable[(uint8_t)c];
+        if (val == 0x80) {
+            continue;
+        }
+        if (c == '=') {
+            pad++;
+        }
+        block[count++] = val;
+        if (count == 4) {
+            count = 0;
+            if ((dst_size - size) < 3) {
+                return -1;
+            }
+            dst[size++] = (block[0] << 2) | (block[1] >> 4);
+            dst[size++] = (block[1] << 4) | (block[2] >> 2);
+            dst[size++] = (block[2] << 6) | block[3];
+            if (pad > 0) {
+                if (pad > 2) {
+                    // invalid padding
+                    return -1;
+                }
+                size -= pad;
+                padded = true;
+                break;
+            }
+        }
+    }
+    if (padded) {
+        // anything after the padding must still be complete groups
+        int tail = 0;
+        while (pos < src_len) {
+            if (_base64_dtable[(uint8_t)src[pos++]] != 0x80) {
+                tail++;
+            }
+        }
+        return (tail & 3) ? -1 : size;
+    }
+    // input length must be multiple of 4
+    if ((count != 0) || (size == 0)) {
+        return -1;
+    }
+    return size;
+}
+
+int base64_decode_scalar(const char* src, int src_len, uint8_t* dst, int dst_size) {
+    return _base64_decode(src, src_len, dst, dst_size, 0);
+}
+
+int base64_decode(const char* src, int src_len, uint8_t* dst, int dst_size) {
+    static bool valid;
+    static base64_simd_t simd;
+    if (!valid) {
+        simd = _base64_select_simd();
+        valid = true;
+    }
+    return _base64_decode(src, src_len, dst, dst_size, simd.func ? &simd : 0);
+}
+#endif /* COMMON_IMPL */
@@ -0,0 +1,235 @@
+#pragma once
+/*
+    Boot-state cache for instant start-up.
+
+    The first time a system boots with a specific configuration, the
+    emulator state is written to a cache file after 'boot_frames' frames
+    of emulated time at 60 Hz (when the system sits at its READY prompt).
+    The emulated time is counted, not the host frames, so that the boot
+    state is the same on any display refresh rate. On the next start with
+    the same configuration, bootcache_restore() loads that state instead
+    of running the boot sequence again.
+
+    The cache key is an XXH64 hash over everything which affects the
+    boot state: the key material added with bootcache_add_key() (the
+    configuration and ROM images), the size of the state regions and the
+    layout of the executable (so that a rebuilt executable doesn't load
+    a stale state). Pointers in the state are relocated with reloc.h,
+    guest memory inside relocated regions must be excluded with
+    reloc_exclude(), since the cache file is always loaded by another
+    process.
+
+    Cache files are named "[dir]/[system]-[key].boot", and contain
+    "CHIPSBOT", version (u32), key (u64), payload size (u32), the
+    payload and an XXH64 hash of the payload. Files which don't
+    validate are ignored and overwritten.
+*/
+#include "reloc.h"
+#include "gfx.h"
+#include "statehash.h"
+
+#define BOOTCACHE_MAX_REGIONS (4)
+
+typedef struct {
+    const char* dir;            /* directory for the cache files (default: current directory) */
+    const char* system;         /* system name, used in the cache file name */
+    const void* anchor;         /* an address inside the executable's static data, e.g. the system struct */
+    uint32_t boot_frames;       /* number of emulated 60 Hz frames until the system has booted */
+} bootcache_desc_t;
+
+/* enable the boot cache */
+extern void bootcache_init(const bootcache_desc_t* desc);
+/* free all memory */
+extern void bootcache_shutdown(void);
+/* return true if bootcache_init() was called */
+extern bool bootcache_enabled(void);
+/* add data which affects the boot state (config, ROM images) to the cache key */
+extern void bootcache_add_key(const void* ptr, size_t size);
+/* add a memory region that is part of the emulator state */
+extern void bootcache_add_region(void* ptr, uint32_t size, bool relocate);
+/* try to restore the boot state from the cache, returns true on success */
+extern bool bootcache_restore(void);
+/* call once per emulated frame with the emulated frame time, writes the cache file after 'boot_frames' 60 Hz frames */
+extern void bootcache_frame(uint32_t frame_time_us);
+/* true when the system has booted (restored from cache, or 'boot_frames' have passed) */
+extern bool bootcache_booted(void);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sokol_time.h"
+
+#define BOOTCACHE_VERSION (3)
+#define BOOTCACHE_FRAME_TIME_US (16667)
+
+typedef struct {
+    uint8_t* ptr;
+    uint32_t size;
+    bool relocate;
+} bootcache_region_t;
+
+typedef struct {
+    bool enabled;
+    bool booted;
+    uint64_t key;
+    uint64_t boot_time_us;
+    uint64_t emu_time_us;
+    int num_regions;
+    bootcache_region_t regions[BOOTCACHE_MAX_REGIONS];
+    uint32_t state_size;
+    bool path_valid;
+    char path[1024];
+} bootcache_state;
+static bootcache_state btch;
+
+void bootcache_init(const bootcache_desc_t* desc) {
+    bootcache_shutdown();
+    btch.enabled = true;
+    btch.boot_time_us = (uint64_t)desc->boot_frames * BOOTCACHE_FRAME_TIME_US;
+    /* the framebuffer is on the heap, the system structs point into it (registered
+       before the image window, which may contain the heap and would match first) */
+    reloc_add_range(gfx_framebuffer(), (size_t)gfx_framebuffer_size());
+    reloc_add_image(desc->anchor);
+    /* the distance between static data and code changes with each build */
+    const uintptr_t layout = (uintptr_t)desc->anchor - (uintptr_t)bootcache_init;
+    btch.key = statehash_xxh64(&layout, sizeof(layout), 0);
+    snprintf(btch.path, sizeof(btch.path), "%s/%s", desc->dir ? desc->dir : ".", desc->system);
+}
+
+void bootcache_shutdown(void) {
+    memset(&btch, 0, sizeof(btch));
+}
+
+bool bootcache_enabled(void) {
+    return btch.enabled;
+}
+
+bool bootcache_booted(void) {
+    return btch.booted;
+}
+
+void bootcache_add_key(const void* ptr, size_t size) {
+    if (btch.enabled) {
+        btch.key = statehash_xxh64(ptr, size, btch.key);
+    }
+}
+
+void bootcache_add_region(void* ptr, uint32_t size, bool relocate) {
+    if (!btch.enabled || (btch.num_regions >= BOOTCACHE_MAX_REGIONS)) {
+        return;
+    }
+    btch.regions[btch.num_regions++] = (bootcache_region_t) {
+        .ptr = (uint8_t*) ptr,
+        .size = size,
+        .relocate = relocate
+    };
+    btch.state_size += size;
+    btch.key = statehash_xxh64(&size, sizeof(size), btch.key);
+}
+
+/* the file name depends on the final key, so compute it on first use */
+static const char* _bootcache_path(void) {
+    if (!btch.path_valid) {
+        btch.path_valid = true;
+        const size_t len = strlen(btch.path);
+        snprintf(&btch.path[len], sizeof(btch.path) - len, "-%016llx.boot", (unsigned long long)btch.key);
+    }
+    return btch.path;
+}
+
+bool bootcache_restore(void) {
+    if (!btch.enabled || (0 == btch.state_size)) {
+        return false;
+    }
+    FILE* fp = fopen(_bootcache_path(), "rb");
+    if (!fp) {
+        return false;
+    }
+    uint8_t* buf = (uint8_t*) malloc(btch.state_size);
+    if (!buf) {
+        fclose(fp);
+        return false;
+    }
+    char magic[8];
+    uint32_t version = 0, size = 0;
+    uint64_t key = 0, hash = 0;
+    bool valid = (8 == fread(magic, 1, 8, fp)) && (0 == memcmp(magic, "CHIPSBOT", 8)) &&
+                 (1 == fread(&version, sizeof(version), 1, fp)) && (version == BOOTCACHE_VERSION) &&
+                 (1 == fread(&key, sizeof(key), 1, fp)) && (key == btch.key) &&
+                 (1 == fread(&size, sizeof(size), 1, fp)) && (size == btch.state_size) &&
+                 (size == fread(buf, 1, size, fp)) &&
+                 (1 == fread(&hash, sizeof(hash), 1, fp)) && (hash == statehash_xxh64(buf, size, 0));
+    fclose(fp);
+    if (valid) {
+        const uint8_t* src = buf;
+        for (int i = 0; i < btch.num_regions; i++) {
+            const bootcache_region_t* r = &btch.regions[i];
+            memcpy(r->ptr, src, r->size);
+            if (r->relocate) {
+                reloc_denormalize(r->ptr, r->size);
+            }
+            src += r->size;
+        }
+        btch.booted = true;
+    }
+    free(buf);
+    return valid;
+}
+
+static void _bootcache_store(void) {
+    uint8_t* buf = (uint8_t*) malloc(btch.state_size);
+    if (!buf) {
+        return;
+    }
+    uint8_t* dst = buf;
+    for (int i = 0; i < btch.num_regions; i++) {
+        const bootcache_region_t* r = &btch.regions[i];
+        if (r->relocate) {
+            reloc_normalize(dst, r->ptr, r->size);
+        }
+        else {
+            memcpy(dst, r->ptr, r->size);
+        }
+        dst += r->size;
+    }
+    /* write to a temporary file first, so that parallel instances never see a partial file */
+    char tmp_path[sizeof(btch.path) + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%x.tmp", _bootcache_path(), (unsigned)stm_now());
+    FILE* fp = fopen(tmp_path, "wb");
+    if (fp) {
+        const uint32_t version = BOOTCACHE_VERSION;
+        const uint64_t hash = statehash_xxh64(buf, btch.state_size, 0);
+        fwrite("CHIPSBOT", 1, 8, fp);
+        fwrite(&version, sizeof(version), 1, fp);
+        fwrite(&btch.key, sizeof(btch.key), 1, fp);
+        fwrite(&btch.state_size, sizeof(btch.state_size), 1, fp);
+        fwrite(buf, 1, btch.state_size, fp);
+        fwrite(&hash, sizeof(hash), 1, fp);
+        const bool success = (0 == ferror(fp));
+        fclose(fp);
+        bool renamed = success && (0 == rename(tmp_path, btch.path));
+        if (success && !renamed) {
+            /* rename() doesn't replace existing files on Windows */
+            remove(btch.path);
+            renamed = (0 == rename(tmp_path, btch.path));
+        }
+        if (!renamed) {
+            remove(tmp_path);
+        }
+    }
+    free(buf);
+}
+
+void bootcache_frame(uint32_t frame_time_us) {
+    if (!btch.enabled || btch.booted) {
+        return;
+    }
+    btch.emu_time_us += frame_time_us;
+    if (btch.emu_time_us >= btch.boot_time_us) {
+        btch.booted = true;
+        _bootcache_store();
+    }
+}
+#endif /* COMMON_IMPL */
@@ -0,0 +1,426 @@
+#pragma once
+/*
+    Video and audio capture for regression review.
+
+    capture_frame() and capture_audio() only copy the data into a
+    single-producer/single-consumer ring buffer, which is drained by
+    a background writer thread. The writer converts frames to YUV 4:4:4
+    and writes them into a Y4M stream, and audio samples are written as
+    16-bit mono WAV. So the cost on the emulation thread is a memcpy
+    per frame.
+
+    The Y4M stream takes its dimensions from the first captured frame,
+    frames with a different size (e.g. after a video mode change) are
+    skipped. If the writer can't keep up and the ring is full, frames
+    or audio chunks are dropped, both are counted in capture_stats().
+
+    Capturing isn't supported on the web platform (no threads).
+*/
+
+typedef struct {
+    const char* video_path;     /* Y4M output file, or 0 for no video */
+    const char* audio_path;     /* WAV output file, or 0 for no audio */
+    int audio_sample_rate;      /* sample rate of the captured audio */
+    int fps;                    /* frame rate written to the Y4M header (default: 60) */
+    uint32_t ring_size;         /* size of the ring buffer (default: 64 MB) */
+} capture_desc_t;
+
+typedef struct {
+    uint32_t num_frames;            /* frames written to the Y4M stream */
+    uint32_t num_dropped_frames;    /* frames dropped because the ring was full */
+    uint32_t num_skipped_frames;    /* frames skipped because of a size mismatch */
+    uint64_t num_samples;           /* audio samples written to the WAV stream */
+    uint64_t num_dropped_samples;   /* audio samples dropped because the ring was full */
+} capture_stats_t;
+
+/* open the output files and start the writer thread */
+extern bool capture_init(const capture_desc_t* desc);
+/* flush pending data, stop the writer thread and close the output files */
+extern void capture_shutdown(void);
+/* true between capture_init() and capture_shutdown() */
+extern bool capture_active(void);
+/* capture an RGBA8 frame */
+extern void capture_frame(const uint32_t* pixels, int width, int height);
+/* capture mono audio samples */
+extern void capture_audio(const float* samples, int num_samples);
+/* get statistics, only complete after capture_shutdown() */
+extern capture_stats_t capture_stats(void);
+/* print statistics to stdout */
+extern void capture_print_stats(void);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define CAPTURE_DEFAULT_RING_SIZE (64 * 1024 * 1024)
+#define CAPTURE_DEFAULT_FPS (60)
+#define CAPTURE_RECORD_ALIGN (16)
+#define CAPTURE_AUDIO_CHUNK (4096)
+
+typedef enum {
+    CAPTURE_RECORD_PAD = 0,     /* skip to the start of the ring */
+    CAPTURE_RECORD_FRAME,
+    CAPTURE_RECORD_AUDIO,
+} capture_record_type_t;
+
+/* a record in the ring buffer, followed by the payload */
+typedef struct {
+    uint32_t type;
+    uint32_t size;              /* payload size in bytes, or distance to ring start for PAD */
+    uint16_t width;
+    uint16_t height;
+    uint32_t num_samples;
+} capture_record_t;
+
+/* head and tail are free-running byte counters, only the producer
+   writes head, and only the writer thread writes tail
+*/
+#if defined(_WIN32)
+static uint32_t _capture_load(volatile uint32_t* ptr) {
+    return (uint32_t) InterlockedCompareExchange((volatile LONG*)ptr, 0, 0);
+}
+static void _capture_store(volatile uint32_t* ptr, uint32_t val) {
+    InterlockedExchange((volatile LONG*)ptr, (LONG)val);
+}
+#else
+static uint32_t _capture_load(volatile uint32_t* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+static void _capture_store(volatile uint32_t* ptr, uint32_t val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+#endif
+
+typedef struct {
+    bool active;
+    uint8_t* ring;
+    uint32_t ring_size;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t quit;
+    FILE* video_fp;
+    FILE* audio_fp;
+    int fps;
+    int audio_sample_rate;
+    /* writer thread state */
+    int video_width;
+    int video_height;
+    uint8_t* yuv_buf;
+    int16_t pcm_buf[CAPTURE_AUDIO_CHUNK];
+    capture_stats_t stats;
+    #if defined(_WIN32)
+    HANDLE thread;
+    #elif !defined(__EMSCRIPTEN__)
+    pthread_t thread;
+    #endif
+} capture_state;
+static capture_state capt;
+
+static uint32_t _capture_align(uint32_t size) {
+    return (size + (CAPTURE_RECORD_ALIGN - 1)) & ~(uint32_t)(CAPTURE_RECORD_ALIGN - 1);
+}
+
+/* copy a record into the ring, returns false if there's not enough room */
+static bool _capture_push(const capture_record_t* rec, const void* payload) {
+    const uint32_t mask = capt.ring_size - 1;
+    const uint32_t need = _capture_align(sizeof(capture_record_t) + rec->size);
+    uint32_t head = capt.head;
+    uint32_t pos = head & mask;
+    const uint32_t to_end = capt.ring_size - pos;
+    const uint32_t total = need + ((to_end < need) ? to_end : 0);
+    const uint32_t used = head - _capture_load(&capt.tail);
+    if ((capt.ring_size - used) < total) {
+        return false;
+    }
+    if (to_end < need) {
+        /* record doesn't fit before the end of the ring, pad and wrap around */
+        capture_record_t pad = { .type = CAPTURE_RECORD_PAD, .size = to_end };
+        memcpy(&capt.ring[pos], &pad, sizeof(pad));
+        head += to_end;
+        pos = 0;
+    }
+    memcpy(&capt.ring[pos], rec, sizeof(capture_record_t));
+    memcpy(&capt.ring[pos + sizeof(capture_record_t)], payload, rec->size);
+    _capture_store(&capt.head, head + need);
+    return true;
+}
+
+static void _capture_write_le16(FILE* fp, uint16_t val) {
+    fputc(val & 0xFF, fp);
+    fputc((val >> 8) & 0xFF, fp);
+}
+
+static void _capture_write_le32(FILE* fp, uint32_t val) {
+    _capture_write_le16(fp, (uint16_t)val);
+    _capture_write_le16(fp, (uint16_t)(val >> 16));
+}
+
+/* write a 16-bit mono PCM WAV header, the sizes are patched when closing the file */
+static void _capture_write_wav_header(FILE* fp, int sample_rate, uint32_t data_size) {
+    fwrite("RIFF", 1, 4, fp);
+    _capture_write_le32(fp, 36 + data_size);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    _capture_write_le32(fp, 16);
+    _capture_write_le16(fp, 1);                     /* PCM */
+    _capture_write_le16(fp, 1);                     /* mono */
+    _capture_write_le32(fp, (uint32_t)sample_rate);
+    _capture_write_le32(fp, (uint32_t)sample_rate * 2);
+    _capture_write_le16(fp, 2);                     /* block align */
+    _capture_write_le16(fp, 16);                    /* bits per sample */
+    fwrite("data", 1, 4, fp);
+    _capture_write_le32(fp, data_size);
+}
+
+static void _capture_write_frame(const capture_record_t* rec, const uint8_t* rgba) {
+    if (!capt.video_fp) {
+        return;
+    }
+    const int w = rec->width;
+    const int h = rec->height;
+    if (0 == capt.video_width) {
+        capt.video_width = w;
+        capt.video_height = h;
+        capt.yuv_buf = (uint8_t*) malloc((size_t)(w * h * 3));
+        fprintf(capt.video_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", w, h, capt.fps);
+    }
+    if ((w != capt.video_width) || (h != capt.video_height)) {
+        capt.stats.num_skipped_frames++;
+        return;
+    }
+    /* RGBA8 to BT.601 studio range YUV, planar 4:4:4 */
+    const int num_pixels = w * h;
+    uint8_t* y_plane = capt.yuv_buf;
+    uint8_t* u_plane = y_plane + num_pixels;
+    uint8_t* v_plane = u_plane + num_pixels;
+    for (int i = 0; i < num_pixels; i++, rgba += 4) {
+        const int r = rgba[0];
+        const int g = rgba[1];
+        const int b = rgba[2];
+        y_plane[i] = (uint8_t) (((66*r + 129*g + 25*b + 128) >> 8) + 16);
+        u_plane[i] = (uint8_t) (((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+        v_plane[i] = (uint8_t) (((112*r - 94*g - 18*b + 128) >> 8) + 128);
+    }
+    fwrite("FRAME\n", 1, 6, capt.video_fp);
+    fwrite(capt.yuv_buf, 1, (size_t)(num_pixels * 3), capt.video_fp);
+    capt.stats.num_frames++;
+}
+
+static void _capture_write_audio(const capture_record_t* rec, const float* samples) {
+    if (!capt.audio_fp) {
+        return;
+    }
+    uint32_t num = rec->num_samples;
+    while (num > 0) {
+        const uint32_t n = (num < CAPTURE_AUDIO_CHUNK) ? num : CAPTURE_AUDIO_CHUNK;
+        for (uint32_t i = 0; i < n; i++) {
+            float s = samples[i];
+            s = (s > 1.0f) ? 1.0f : ((s < -1.0f) ? -1.0f : s);
+            capt.pcm_buf[i] = (int16_t) (s * 32767.0f);
+        }
+        fwrite(capt.pcm_buf, sizeof(int16_t), n, capt.audio_fp);
+        capt.stats.num_samples += n;
+        samples += n;
+        num -= n;
+    }
+}
+
+/* write all records which are currently in the ring, returns false if the ring was empty */
+static bool _capture_drain(void) {
+    const uint32_t mask = capt.ring_size - 1;
+    const uint32_t head = _capture_load(&capt.head);
+    uint32_t tail = capt.tail;
+    if (tail == head) {
+        return false;
+    }
+    while (tail != head) {
+        capture_record_t rec;
+        const uint8_t* ptr = &capt.ring[tail & mask];
+        memcpy(&rec, ptr, sizeof(rec));
+        if (CAPTURE_RECORD_PAD == rec.type) {
+            tail += rec.size;
+            continue;
+        }
+        if (CAPTURE_RECORD_FRAME == rec.type) {
+            _capture_write_frame(&rec, ptr + sizeof(rec));
+        }
+        else {
+            _capture_write_audio(&rec, (const float*)(ptr + sizeof(rec)));
+        }
+        tail += _capture_align(sizeof(rec) + rec.size);
+        _capture_store(&capt.tail, tail);
+    }
+    _capture_store(&capt.tail, tail);
+    return true;
+}
+
+static void _capture_sleep(void) {
+    #if defined(_WIN32)
+    Sleep(1);
+    #elif !defined(__EMSCRIPTEN__)
+    struct timespec ts = { 0, 1000000 };
+    nanosleep(&ts, 0);
+    #endif
+}
+
+static void _capture_thread_loop(void) {
+    while (!_capture_load(&capt.quit)) {
+        if (!_capture_drain()) {
+            _capture_sleep();
+        }
+    }
+    /* flush anything that was pushed before capture_shutdown() */
+    _capture_drain();
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI _capture_thread_func(LPVOID arg) {
+    (void)arg;
+    _capture_thread_loop();
+    return 0;
+}
+#elif !defined(__EMSCRIPTEN__)
+static void* _capture_thread_func(void* arg) {
+    (void)arg;
+    _capture_thread_loop();
+    return 0;
+}
+#endif
+
+static void _capture_close_files(void) {
+    if (capt.video_fp) {
+        fclose(capt.video_fp);
+    }
+    if (capt.audio_fp) {
+        /* patch the WAV header sizes */
+        const uint32_t data_size = (uint32_t)(capt.stats.num_samples * sizeof(int16_t));
+        fseek(capt.audio_fp, 0, SEEK_SET);
+        _capture_write_wav_header(capt.audio_fp, capt.audio_sample_rate, data_size);
+        fclose(capt.audio_fp);
+    }
+    capt.video_fp = 0;
+    capt.audio_fp = 0;
+}
+
+bool capture_init(const capture_desc_t* desc) {
+    #if defined(__EMSCRIPTEN__)
+    (void)desc;
+    return false;
+    #else
+    capture_shutdown();
+    memset(&capt, 0, sizeof(capt));
+    capt.fps = desc->fps ? desc->fps : CAPTURE_DEFAULT_FPS;
+    capt.audio_sample_rate = desc->audio_sample_rate;
+    uint32_t ring_size = desc->ring_size ? desc->ring_size : CAPTURE_DEFAULT_RING_SIZE;
+    capt.ring_size = 1024;
+    while (capt.ring_size < ring_size) {
+        capt.ring_size <<= 1;
+    }
+    capt.ring = (uint8_t*) malloc(capt.ring_size);
+    if (!capt.ring) {
+        return false;
+    }
+    bool success = true;
+    if (desc->video_path) {
+        capt.video_fp = fopen(desc->video_path, "wb");
+        success &= (0 != capt.video_fp);
+    }
+    if (desc->audio_path) {
+        capt.audio_fp = fopen(desc->audio_path, "wb");
+        if (capt.audio_fp) {
+            _capture_write_wav_header(capt.audio_fp, capt.audio_sample_rate, 0);
+        }
+        success &= (0 != capt.audio_fp);
+    }
+    if (success) {
+        #if defined(_WIN32)
+        capt.thread = CreateThread(NULL, 0, _capture_thread_func, 0, 0, NULL);
+        success = (0 != capt.thread);
+        #else
+        success = (0 == pthread_create(&capt.thread, 0, _capture_thread_func, 0));
+        #endif
+    }
+    if (!success) {
+        _capture_close_files();
+        free(capt.ring);
+        memset(&capt, 0, sizeof(capt));
+        return false;
+    }
+    capt.active = true;
+    return true;
+    #endif
+}
+
+void capture_shutdown(void) {
+    if (!capt.active) {
+        return;
+    }
+    _capture_store(&capt.quit, 1);
+    #if defined(_WIN32)
+    WaitForSingleObject(capt.thread, INFINITE);
+    CloseHandle(capt.thread);
+    #elif !defined(__EMSCRIPTEN__)
+    pthread_join(capt.thread, 0);
+    #endif
+    _capture_close_files();
+    free(capt.ring);
+    free(capt.yuv_buf);
+    capt.ring = 0;
+    capt.yuv_buf = 0;
+    capt.active = false;
+}
+
+bool capture_active(void) {
+    return capt.active;
+}
+
+void capture_frame(const uint32_t* pixels, int width, int height) {
+    if (!capt.active || !capt.video_fp) {
+        return;
+    }
+    capture_record_t rec = {
+        .type = CAPTURE_RECORD_FRAME,
+        .size = (uint32_t)(width * height) * sizeof(uint32_t),
+        .width = (uint16_t) width,
+        .height = (uint16_t) height,
+    };
+    if (!_capture_push(&rec, pixels)) {
+        capt.stats.num_dropped_frames++;
+    }
+}
+
+void capture_audio(const float* samples, int num_samples) {
+    if (!capt.active || !capt.audio_fp || (num_samples <= 0)) {
+        return;
+    }
+    capture_record_t rec = {
+        .type = CAPTURE_RECORD_AUDIO,
+        .size = (uint32_t)num_samples * sizeof(float),
+        .num_samples = (uint32_t)num_samples,
+    };
+    if (!_capture_push(&rec, samples)) {
+        capt.stats.num_dropped_samples += (uint64_t)num_samples;
+    }
+}
+
+capture_stats_t capture_stats(void) {
+    return capt.stats;
+}
+
+void capture_print_stats(void) {
+    const capture_stats_t* s = &capt.stats;
+    printf("capture: %u frames (%u dropped, %u skipped), %llu audio samples (%llu dropped)\n",
+        s->num_frames, s->num_dropped_frames, s->num_skipped_frames,
+        (unsigned long long) s->num_samples, (unsigned long long) s->num_dropped_samples);
+}
+#endif /* COMMON_IMPL */
@@ -1,34 +1,159 @@
 #pragma once
 /*
     Emulator frame timing helper functions.
+
+    By default the emulated time per frame is the measured host frame
+    duration rounded to a common display refresh rate. On displays which
+    are not 60 Hz, or when the host is under load, this slowly drifts
+    against the audio playback, which results in audio buffer under-
+    or overruns.
+
+    With clock_set_audio_pacing(true), the emulated frame time is
+    additionally steered by a small PI controller which keeps the fill
+    level of the sokol-audio ring buffer at a fixed target. The correction
+    is clamped to a few percent, so it is neither audible nor visible.
+
+    In headless builds (CHIPS_HEADLESS), frames run as fast as possible
+    and the emulated frame time is always 1/60 sec, so that runs are
+    reproducible.
 */
+typedef struct {
+    uint64_t num_frames;        /* number of frames since clock_init() */
+    uint32_t num_dropped;       /* frames clamped because the host was too slow */
+    uint32_t num_underruns;     /* frames where the audio ring buffer was empty */
+    uint32_t num_overruns;      /* frames where the audio ring buffer was full */
+    double avg_frame_us;        /* running average of the host frame duration */
+    double jitter_us;           /* running average deviation from avg_frame_us */
+    double audio_fill;          /* smoothed audio ring buffer fill level (0..1) */
+    double correction;          /* current audio pacing time scale (-CLOCK_MAX_CORRECTION..+CLOCK_MAX_CORRECTION) */
+} clock_stats_t;
+
 extern void clock_init(void);
 extern uint32_t clock_frame_time(void);
 extern uint32_t clock_frame_count_60hz(void);
+/* enable or disable steering the emulated time by the audio buffer fill level */
+extern void clock_set_audio_pacing(bool enabled);
+/* get frame timing statistics */
+extern clock_stats_t clock_stats(void);
+/* print frame timing statistics to stdout */
+extern void clock_print_stats(void);
 
 /*== IMPLEMENTATION ==========================================================*/
 #ifdef COMMON_IMPL
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include "sokol_time.h"
+#include "sokol_audio.h"
+
+#define CLOCK_MAX_FRAME_TIME_US (24000)
+#define CLOCK_HEADLESS_FRAME_TIME_US (16667)
+#define CLOCK_MAX_CORRECTION (0.05)
+#define CLOCK_PACING_KP (0.05)
+#define CLOCK_PACING_KI (0.001)
+/* don't count underruns while the audio backend is starting up */
+#define CLOCK_PACING_WARMUP_FRAMES (60)
 
 typedef struct {
     uint64_t cur_time;
     uint64_t last_time_stamp;
+    bool audio_pacing;
+    int audio_capacity;         /* largest observed free space in the audio ring buffer */
+    double audio_integral;
+    clock_stats_t stats;
 } clock_state;
 static clock_state clck;
 
 void clock_init(void) {
     stm_setup();
-    clck.cur_time = 0;
+    memset(&clck, 0, sizeof(clck));
     clck.last_time_stamp = stm_now();
 }
 
+void clock_set_audio_pacing(bool enabled) {
+    clck.audio_pacing = enabled;
+    clck.audio_integral = 0.0;
+    clck.stats.correction = 0.0;
+}
+
+/* returns the emulated time scale derived from the audio ring buffer fill level */
+static double _clock_audio_pacing(void) {
+    if (!saudio_isvalid()) {
+        return 0.0;
+    }
+    /* the ring buffer is empty before the first push, so the largest
+       number of expected frames is the ring buffer capacity
+    */
+    const int expect = saudio_expect();
+    if (expect > clck.audio_capacity) {
+        clck.audio_capacity = expect;
+    }
+    if (clck.audio_capacity == 0) {
+        return 0.0;
+    }
+    const double fill = 1.0 - ((double)expect / (double)clck.audio_capacity);
+    if (clck.stats.num_frames > CLOCK_PACING_WARMUP_FRAMES) {
+        if (expect == clck.audio_capacity) {
+            clck.stats.num_underruns++;
+        }
+        else if (expect == 0) {
+            clck.stats.num_overruns++;
+        }
+    }
+    clck.stats.audio_fill += (fill - clck.stats.audio_fill) * 0.1;
+
+    /* aim for twice the backend buffer size, or half the ring buffer, whatever is smaller */
+    double target = (2.0 * saudio_buffer_frames()) / (double)clck.audio_capacity;
+    if (target > 0.5) {
+        target = 0.5;
+    }
+    const double err = target - clck.stats.audio_fill;
+    clck.audio_integral += err;
+    /* anti-windup */
+    const double max_integral = CLOCK_MAX_CORRECTION / CLOCK_PACING_KI;
+    if (clck.audio_integral > max_integral) {
+        clck.audio_integral = max_integral;
+    }
+    else if (clck.audio_integral < -max_integral) {
+        clck.audio_integral = -max_integral;
+    }
+    double correction = CLOCK_PACING_KP * err + CLOCK_PACING_KI * clck.audio_integral;
+    if (correction > CLOCK_MAX_CORRECTION) {
+        correction = CLOCK_MAX_CORRECTION;
+    }
+    else if (correction < -CLOCK_MAX_CORRECTION) {
+        correction = -CLOCK_MAX_CORRECTION;
+    }
+    return correction;
+}
+
 uint32_t clock_frame_time(void) {
-    uint32_t frame_time_us = (uint32_t) stm_us(stm_round_to_common_refresh_rate(stm_laptime(&clck.last_time_stamp)));
+    const uint64_t lap_time = stm_laptime(&clck.last_time_stamp);
+    #if defined(CHIPS_HEADLESS)
+    uint32_t frame_time_us = CLOCK_HEADLESS_FRAME_TIME_US;
+    #else
+    uint32_t frame_time_us = (uint32_t) stm_us(stm_round_to_common_refresh_rate(lap_time));
+    #endif
+
+    /* jitter of the (unrounded) host frame duration */
+    const double raw_us = stm_us(lap_time);
+    if (clck.stats.num_frames == 0) {
+        clck.stats.avg_frame_us = raw_us;
+    }
+    clck.stats.avg_frame_us += (raw_us - clck.stats.avg_frame_us) * 0.05;
+    clck.stats.jitter_us += (fabs(raw_us - clck.stats.avg_frame_us) - clck.stats.jitter_us) * 0.05;
+
+    if (clck.audio_pacing) {
+        clck.stats.correction = _clock_audio_pacing();
+        frame_time_us = (uint32_t) ((double)frame_time_us * (1.0 + clck.stats.correction));
+    }
     // prevent death-spiral on host systems that are too slow to emulate
     // in real time, or during long frames (e.g. debugging)
-    if (frame_time_us > 24000) {
-        frame_time_us = 24000;
+    if (frame_time_us > CLOCK_MAX_FRAME_TIME_US) {
+        frame_time_us = CLOCK_MAX_FRAME_TIME_US;
+        clck.stats.num_dropped++;
     }
+    clck.stats.num_frames++;
     clck.cur_time += frame_time_us;
     return frame_time_us;
 }
@@ -36,4 +161,18 @@ uint32_t clock_frame_time(void) {
 uint32_t clock_frame_count_60hz(void) {
     return (uint32_t) (clck.cur_time / 16667);
 }
+
+clock_stats_t clock_stats(void) {
+    return clck.stats;
+}
+
+void clock_print_stats(void) {
+    const clock_stats_t* s = &clck.stats;
+    printf("clock: %llu frames, %.1f us avg frame time, %.1f us jitter, %u dropped\n",
+        (unsigned long long) s->num_frames, s->avg_frame_us, s->jitter_us, s->num_dropped);
+    if (clck.audio_pacing) {
+        printf("clock: audio fill %.1f%%, correction %+.2f%%, %u underruns, %u overruns\n",
+            s->audio_fill * 100.0, s->correction * 100.0, s->num_underruns, s->num_overruns);
+    }
+}
 #endif /* COMMON_IMPL */
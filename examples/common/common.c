@@ -1,8 +1,22 @@
 #define COMMON_IMPL
 #include <stdint.h>
 #include <stdbool.h>
+#include "base64.h"
+#include "bootcache.h"
+#include "capture.h"
 #include "clock.h"
 #include "fs.h"
 #include "gfx.h"
+#include "guestprof.h"
+#include "heatmap.h"
+#include "journal.h"
 #include "keybuf.h"
+#include "prof.h"
+#include "reloc.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "statehash.h"
+#include "trace.h"
+#include "warp.h"
+#include "zxtap.h"
 
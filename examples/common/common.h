@@ -3,8 +3,24 @@
 #include "sokol_audio.h"
 #include "sokol_args.h"
 #include "sokol_time.h"
+#include "base64.h"
+#include "bootcache.h"
+#include "capture.h"
 #include "clock.h"
 #include "fs.h"
 #include "gfx.h"
+#include "guestprof.h"
+#include "heatmap.h"
+#include "journal.h"
 #include "keybuf.h"
+#include "prof.h"
+#include "reloc.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "statehash.h"
+#include "trace.h"
+#include "warp.h"
+#include "zxtap.h"
 #include <ctype.h> /* isupper, islower, toupper, tolower */
+#include <stdlib.h> /* atoi */
+#include <stdio.h> /* snprintf */
@@ -1,15 +1,40 @@
 #pragma once
 /*
     Simple file access functions.
+
+    Loaded files live in slots, so that more than one file can be loaded
+    at a time (for instance a disk image and a tape image).
+
+    Loading files is asynchronous on all platforms, fs_load_file() only
+    starts loading, and fs_ptr() returns a null pointer until the data
+    is available. If loading failed, fs_failed() returns true until
+    fs_free() is called on the slot.
+
+    On native platforms, files are loaded on a background thread (or
+    synchronously in headless builds, to keep runs reproducible) and
+    mapped read-only into memory. The mapping is handed out directly,
+    so there's no size limit and no copying. Only base64 payloads, and
+    files loaded on the web platform, are copied into a heap buffer.
+
+    Loaded data is always followed by a zero byte, so that text files
+    can be used as C strings.
 */
+typedef enum {
+    FS_SLOT_IMAGE = 0,      /* main media file (file=, prg=, rom=, ...) */
+    FS_SLOT_TAPE,           /* additional tape image next to the main media file */
+    FS_SLOT_NUM,
+} fs_slot_t;
+
 extern void fs_init(void);
-extern bool fs_load_file(const char* path);
-extern bool fs_load_base64(const char* name, const char* payload);
-extern void fs_load_mem(const char* path, const uint8_t* ptr, uint32_t size);
-extern uint32_t fs_size(void);
-extern const uint8_t* fs_ptr(void);
-extern void fs_free(void);
-extern bool fs_ext(const char* str);
+extern bool fs_load_file(fs_slot_t slot, const char* path);
+extern bool fs_load_base64(fs_slot_t slot, const char* name, const char* payload);
+extern void fs_load_mem(fs_slot_t slot, const char* path, const uint8_t* ptr, uint32_t size);
+extern uint32_t fs_size(fs_slot_t slot);
+extern const uint8_t* fs_ptr(fs_slot_t slot);
+extern bool fs_failed(fs_slot_t slot);
+extern void fs_free(fs_slot_t slot);
+extern bool fs_ext(fs_slot_t slot, const char* str);
+extern const char* fs_ext_str(fs_slot_t slot);
 
 /*== IMPLEMENTATION ==========================================================*/
 #ifdef COMMON_IMPL
@@ -17,23 +42,74 @@ extern bool fs_ext(const char* str);
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
-#if !defined(__EMSCRIPTEN__)
-#include <stdio.h>
-#else
+#if defined(__EMSCRIPTEN__)
 #include <emscripten/emscripten.h>
+#elif defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #endif
 
 #define FS_EXT_SIZE (16)
-#define FS_MAX_SIZE (1024 * 1024)
-static struct {
-    char ext[FS_EXT_SIZE];
+
+typedef enum {
+    FS_STATE_IDLE,
+    FS_STATE_PENDING,
+    FS_STATE_LOADED,
+    FS_STATE_FAILED,
+} fs_state_t;
+
+typedef struct {
     uint8_t* ptr;
     uint32_t size;
-    uint8_t buf[FS_MAX_SIZE + 1];
+    bool mapped;            /* true if ptr is a read-only file mapping */
+} fs_data_t;
+
+typedef struct {
+    char ext[FS_EXT_SIZE];
+    fs_state_t state;
+    uint32_t request_id;    /* bumped on each load or free to discard stale async results */
+    fs_data_t data;
+} fs_slot_state_t;
+
+static struct {
+    fs_slot_state_t slots[FS_SLOT_NUM];
+    #if defined(__EMSCRIPTEN__)
+    /* everything happens on the main thread */
+    #elif defined(_WIN32)
+    SRWLOCK lock;
+    #else
+    pthread_mutex_t lock;
+    #endif
 } fs;
 
-void fs_copy_ext(const char* path) {
-    fs.ext[0] = 0;
+/* the slot state is shared with the loader threads */
+#if defined(__EMSCRIPTEN__)
+static void _fs_lock(void) { }
+static void _fs_unlock(void) { }
+#elif defined(_WIN32)
+static void _fs_lock(void) { AcquireSRWLockExclusive(&fs.lock); }
+static void _fs_unlock(void) { ReleaseSRWLockExclusive(&fs.lock); }
+#else
+static void _fs_lock(void) { pthread_mutex_lock(&fs.lock); }
+static void _fs_unlock(void) { pthread_mutex_unlock(&fs.lock); }
+#endif
+
+static fs_slot_state_t* _fs_slot(fs_slot_t slot) {
+    assert((slot >= 0) && (slot < FS_SLOT_NUM));
+    return &fs.slots[slot];
+}
+
+void fs_copy_ext(fs_slot_t slot, const char* path) {
+    char* dst = _fs_slot(slot)->ext;
+    dst[0] = 0;
     const char* str = path;
     const char* slash = strrchr(str, '/');
     if (slash) {
@@ -44,136 +120,277 @@ void fs_copy_ext(const char* path) {
         int i = 0;
         char c = 0;
         while ((c = *++ext) && (i < (FS_EXT_SIZE-1))) {
-            fs.ext[i] = tolower(c);
+            dst[i] = tolower(c);
             i++;
         }
-        fs.ext[i] = 0;
+        dst[i] = 0;
     }
 }
 
-// http://web.mit.edu/freebsd/head/contrib/wpa/src/utils/base64.c
-static const unsigned char fs_base64_table[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-bool fs_base64_decode(const char* src) {
-    int len = (int)strlen(src);
+/* allocate a zero-terminated heap buffer for the copy path */
+static uint8_t* _fs_alloc(fs_data_t* data, uint32_t size) {
+    assert(0 == data->ptr);
+    data->ptr = (uint8_t*) malloc(size + 1);
+    if (data->ptr) {
+        data->ptr[size] = 0;
+        data->size = size;
+    }
+    return data->ptr;
+}
 
-    uint8_t dtable[256];
-    memset(dtable, 0x80, sizeof(dtable));
-    for (int i = 0; i < (int)sizeof(fs_base64_table)-1; i++) {
-        dtable[fs_base64_table[i]] = (uint8_t)i;
+static void _fs_release(fs_data_t* data) {
+    if (data->ptr) {
+        if (data->mapped) {
+            #if defined(_WIN32)
+                UnmapViewOfFile(data->ptr);
+            #elif !defined(__EMSCRIPTEN__)
+                munmap(data->ptr, data->size);
+            #endif
+        }
+        else {
+            free(data->ptr);
+        }
     }
-    dtable['='] = 0;
+    memset(data, 0, sizeof(fs_data_t));
+}
 
-    int count = 0;
-    for (int i = 0; i < len; i++) {
-        if (dtable[(int)src[i]] != 0x80) {
-            count++;
+/* store the result of a load request, discard it if the request is stale */
+static void _fs_finish(fs_slot_t slot, uint32_t request_id, fs_data_t* data, bool success) {
+    _fs_lock();
+    fs_slot_state_t* s = _fs_slot(slot);
+    if ((s->request_id == request_id) && (s->state == FS_STATE_PENDING)) {
+        if (success) {
+            s->data = *data;
+            s->state = FS_STATE_LOADED;
+        }
+        else {
+            _fs_release(data);
+            s->state = FS_STATE_FAILED;
         }
     }
+    else {
+        _fs_release(data);
+    }
+    _fs_unlock();
+}
 
-    // input length must be multiple of 4
-    if ((count == 0) || (count & 3)) {
+/* start a new load request on a slot, discarding any previous data */
+static uint32_t _fs_begin(fs_slot_t slot, const char* path) {
+    fs_free(slot);
+    _fs_lock();
+    fs_slot_state_t* s = _fs_slot(slot);
+    fs_copy_ext(slot, path);
+    s->state = FS_STATE_PENDING;
+    const uint32_t request_id = s->request_id;
+    _fs_unlock();
+    return request_id;
+}
+
+bool fs_base64_decode(fs_data_t* data, const char* src) {
+    const int len = (int)strlen(src);
+    if (!_fs_alloc(data, BASE64_DECODED_SIZE(len))) {
         return false;
     }
-
-    // output length
-    int olen = (count / 4) * 3;
-    if (olen >= (int)sizeof(fs.buf)) {
+    const int size = base64_decode(src, len, data->ptr, (int)data->size);
+    if (size < 0) {
         return false;
     }
+    /* zero-terminate in case this is a text file */
+    data->ptr[size] = 0;
+    data->size = (uint32_t)size;
+    return true;
+}
+
+bool fs_ext(fs_slot_t slot, const char* ext) {
+    return 0 == strcmp(ext, _fs_slot(slot)->ext);
+}
+
+const char* fs_ext_str(fs_slot_t slot) {
+    return _fs_slot(slot)->ext;
+}
+
+void fs_free(fs_slot_t slot) {
+    _fs_lock();
+    fs_slot_state_t* s = _fs_slot(slot);
+    _fs_release(&s->data);
+    s->ext[0] = 0;
+    s->state = FS_STATE_IDLE;
+    s->request_id++;
+    _fs_unlock();
+}
+
+void fs_load_mem(fs_slot_t slot, const char* path, const uint8_t* ptr, uint32_t size) {
+    const uint32_t request_id = _fs_begin(slot, path);
+    fs_data_t data = { 0 };
+    bool success = false;
+    if ((size > 0) && _fs_alloc(&data, size)) {
+        memcpy(data.ptr, ptr, size);
+        success = true;
+    }
+    _fs_finish(slot, request_id, &data, success);
+}
 
-    // decode loop
-    count = 0;
-    int pad = 0;
-    uint8_t block[4];
-    for (int i = 0; i < len; i++) {
-        uint8_t tmp = dtable[(int)src[i]];
-        if (tmp == 0x80) {
-            continue;
+bool fs_load_base64(fs_slot_t slot, const char* name, const char* payload) {
+    const uint32_t request_id = _fs_begin(slot, name);
+    fs_data_t data = { 0 };
+    const bool success = fs_base64_decode(&data, payload);
+    _fs_finish(slot, request_id, &data, success);
+    return success;
+}
+
+#if !defined(__EMSCRIPTEN__)
+/* Map a file read-only into memory. The remainder of the last page
+   is zero-filled by the OS, so the data is zero-terminated unless the
+   file size is a multiple of the page size, in that case the file is
+   copied into a heap buffer instead.
+*/
+#if defined(_WIN32)
+static bool _fs_map_file(fs_data_t* data, const char* path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool success = false;
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && (file_size.QuadPart > 0) && (file_size.QuadPart < 0xFFFFFFFF)) {
+        const uint32_t size = (uint32_t) file_size.QuadPart;
+        SYSTEM_INFO sys_info;
+        GetSystemInfo(&sys_info);
+        if (0 != (size % sys_info.dwPageSize)) {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) {
+                data->ptr = (uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+                if (data->ptr) {
+                    data->mapped = true;
+                    data->size = size;
+                    success = true;
+                }
+            }
         }
-        if (src[i] == '=') {
-            pad++;
+        else if (_fs_alloc(data, size)) {
+            DWORD num_read = 0;
+            success = ReadFile(file, data->ptr, size, &num_read, NULL) && (num_read == size);
         }
-        block[count] = tmp;
-        count++;
-        if (count == 4) {
-            count = 0;
-            fs.buf[fs.size++] = (block[0] << 2) | (block[1] >> 4);
-            fs.buf[fs.size++] = (block[1] << 4) | (block[2] >> 2);
-            fs.buf[fs.size++] = (block[2] << 6) | block[3];
-            if (pad > 0) {
-                if (pad <= 2) {
-                    fs.size -= pad;
-                }
-                else {
-                    // invalid padding
-                    return false;
-                }
-                break;
+    }
+    CloseHandle(file);
+    return success;
+}
+#else
+static bool _fs_map_file(fs_data_t* data, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool success = false;
+    struct stat st;
+    if ((0 == fstat(fd, &st)) && (st.st_size > 0) && ((uint64_t)st.st_size < 0xFFFFFFFF)) {
+        const uint32_t size = (uint32_t) st.st_size;
+        const long page_size = sysconf(_SC_PAGESIZE);
+        if ((page_size > 0) && (0 != (size % (uint32_t)page_size))) {
+            void* ptr = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+                data->ptr = (uint8_t*) ptr;
+                data->mapped = true;
+                data->size = size;
+                success = true;
             }
         }
+        else if (_fs_alloc(data, size)) {
+            success = (ssize_t)size == read(fd, data->ptr, size);
+        }
     }
-    return true;
+    close(fd);
+    return success;
 }
+#endif
+
+/* a load request handed to the loader thread */
+typedef struct {
+    fs_slot_t slot;
+    uint32_t request_id;
+    char path[1];           /* allocated with the request */
+} fs_request_t;
 
-bool fs_ext(const char* ext) {
-    return 0 == strcmp(ext, fs.ext);
+static void _fs_load_request(fs_request_t* req) {
+    fs_data_t data = { 0 };
+    const bool success = _fs_map_file(&data, req->path);
+    _fs_finish(req->slot, req->request_id, &data, success);
+    free(req);
 }
 
-void fs_free(void) {
-    memset(&fs, 0, sizeof(fs));
+#if defined(CHIPS_HEADLESS)
+/* no loader thread in headless builds */
+#elif defined(_WIN32)
+static DWORD WINAPI _fs_thread_func(LPVOID arg) {
+    _fs_load_request((fs_request_t*)arg);
+    return 0;
 }
 
-void fs_load_mem(const char* path, const uint8_t* ptr, uint32_t size) {
-    fs_free();
-    if ((size > 0) && (size <= FS_MAX_SIZE)) {
-        fs_copy_ext(path);
-        fs.size = size;
-        fs.ptr = fs.buf;
-        memcpy(fs.ptr, ptr, size);
-        /* zero-terminate in case this is a text file */
-        fs.ptr[fs.size] = 0;
+static bool _fs_start_thread(fs_request_t* req) {
+    HANDLE thread = CreateThread(NULL, 0, _fs_thread_func, req, 0, NULL);
+    if (thread) {
+        CloseHandle(thread);
+        return true;
     }
+    return false;
+}
+#else
+static void* _fs_thread_func(void* arg) {
+    _fs_load_request((fs_request_t*)arg);
+    return 0;
 }
 
-bool fs_load_base64(const char* name, const char* payload) {
-    fs_free();
-    fs_copy_ext(name);
-    if (fs_base64_decode(payload)) {
-        fs.ptr = fs.buf;
+static bool _fs_start_thread(fs_request_t* req) {
+    pthread_t thread;
+    if (0 == pthread_create(&thread, 0, _fs_thread_func, req)) {
+        pthread_detach(thread);
         return true;
     }
-    else {
-        return false;
-    }
+    return false;
 }
+#endif
 
-#if !defined(__EMSCRIPTEN__)
-bool fs_load_file(const char* path) {
-    fs_free();
-    fs_copy_ext(path);
-    FILE* fp = fopen(path, "rb");
-    bool success = false;
-    if (fp) {
-        fseek(fp, 0, SEEK_END);
-        int size = ftell(fp);
-        if (size <= FS_MAX_SIZE) {
-            fs.size = size;
-            fseek(fp, 0, SEEK_SET);
-            if (fs.size > 0) {
-                fs.ptr = fs.buf;
-                uint32_t res = (int) fread(fs.ptr, 1, fs.size, fp); (void)res;
-                success = (res == fs.size);
-            }
-            fclose(fp);
-            /* zero-terminate in case this is a text file */
-            fs.ptr[fs.size] = 0;
+/* NOTE: this is loading the data asynchronously, need to check fs_ptr()
+   whether the data has actually been loaded!
+*/
+bool fs_load_file(fs_slot_t slot, const char* path) {
+    const uint32_t request_id = _fs_begin(slot, path);
+    const size_t path_len = strlen(path);
+    fs_request_t* req = (fs_request_t*) malloc(sizeof(fs_request_t) + path_len);
+    if (req) {
+        req->slot = slot;
+        req->request_id = request_id;
+        memcpy(req->path, path, path_len + 1);
+        #if defined(CHIPS_HEADLESS)
+        _fs_load_request(req);
+        return !fs_failed(slot);
+        #else
+        if (_fs_start_thread(req)) {
+            return true;
         }
+        free(req);
+        #endif
     }
-    return success;
+    fs_data_t data = { 0 };
+    _fs_finish(slot, request_id, &data, false);
+    return false;
 }
 #else
-EMSCRIPTEN_KEEPALIVE void emsc_load_data(const char* path, const uint8_t* ptr, int size) {
-    fs_load_mem(path, ptr, size);
+/* the slot's file extension was already set in fs_load_file(), a stale request is discarded in _fs_finish() */
+EMSCRIPTEN_KEEPALIVE void emsc_load_data(int slot, int request_id, const uint8_t* ptr, int size) {
+    fs_data_t data = { 0 };
+    bool success = false;
+    if ((size > 0) && _fs_alloc(&data, (uint32_t)size)) {
+        memcpy(data.ptr, ptr, (size_t)size);
+        success = true;
+    }
+    _fs_finish((fs_slot_t)slot, (uint32_t)request_id, &data, success);
+}
+
+EMSCRIPTEN_KEEPALIVE void emsc_load_failed(int slot, int request_id) {
+    fs_data_t data = { 0 };
+    _fs_finish((fs_slot_t)slot, (uint32_t)request_id, &data, false);
 }
 
 EM_JS(void, emsc_fs_init, (void), {
@@ -181,17 +398,25 @@ EM_JS(void, emsc_fs_init, (void), {
     Module['ccall'] = ccall;
 });
 
-EM_JS(void, emsc_load_file, (const char* path_cstr), {
+EM_JS(void, emsc_load_file, (int slot, int request_id, const char* path_cstr), {
     var path = UTF8ToString(path_cstr);
     var req = new XMLHttpRequest();
     req.open("GET", path);
     req.responseType = "arraybuffer";
     req.onload = function(e) {
-        var uint8Array = new Uint8Array(req.response);
-        var res = ccall('emsc_load_data',
-            'int',
-            ['string', 'array', 'number'],
-            [path, uint8Array, uint8Array.length]);
+        if (req.status == 200) {
+            var uint8Array = new Uint8Array(req.response);
+            var res = ccall('emsc_load_data',
+                'int',
+                ['number', 'number', 'array', 'number'],
+                [slot, request_id, uint8Array, uint8Array.length]);
+        }
+        else {
+            ccall('emsc_load_failed', 'int', ['number', 'number'], [slot, request_id]);
+        }
+    };
+    req.onerror = function(e) {
+        ccall('emsc_load_failed', 'int', ['number', 'number'], [slot, request_id]);
     };
     req.send();
 });
@@ -199,9 +424,9 @@ EM_JS(void, emsc_load_file, (const char* path_cstr), {
 /* NOTE: this is loading the data asynchronously, need to check fs_ptr()
    whether the data has actually been loaded!
 */
-bool fs_load_file(const char* path) {
-    fs_free();
-    emsc_load_file(path);
+bool fs_load_file(fs_slot_t slot, const char* path) {
+    const uint32_t request_id = _fs_begin(slot, path);
+    emsc_load_file((int)slot, (int)request_id, path);
     return true;
 }
 #endif
@@ -210,15 +435,34 @@ void fs_init(void) {
     memset(&fs, 0, sizeof(fs));
     #if defined(__EMSCRIPTEN__)
     emsc_fs_init();
+    #elif defined(_WIN32)
+    InitializeSRWLock(&fs.lock);
+    #else
+    pthread_mutex_init(&fs.lock, 0);
     #endif
 }
 
-const uint8_t* fs_ptr(void) {
-    return fs.ptr;
+const uint8_t* fs_ptr(fs_slot_t slot) {
+    _fs_lock();
+    const fs_slot_state_t* s = _fs_slot(slot);
+    const uint8_t* ptr = (s->state == FS_STATE_LOADED) ? s->data.ptr : 0;
+    _fs_unlock();
+    return ptr;
+}
+
+uint32_t fs_size(fs_slot_t slot) {
+    _fs_lock();
+    const fs_slot_state_t* s = _fs_slot(slot);
+    const uint32_t size = (s->state == FS_STATE_LOADED) ? s->data.size : 0;
+    _fs_unlock();
+    return size;
 }
 
-uint32_t fs_size(void) {
-    return fs.size;
+bool fs_failed(fs_slot_t slot) {
+    _fs_lock();
+    const bool failed = _fs_slot(slot)->state == FS_STATE_FAILED;
+    _fs_unlock();
+    return failed;
 }
 
 #endif /* COMMON_IMPL */
@@ -5,6 +5,9 @@
     REMINDER: consider using this CRT shader?
 
     https://github.com/mattiasgustavsson/rebasic/blob/master/source/libs/crtemu.h
+
+    In headless builds (CHIPS_HEADLESS), nothing is rendered, gfx_draw()
+    only remembers the framebuffer size for gfx_write_ppm().
 */
 #include <stdint.h>
 #include <stdbool.h>
@@ -17,6 +20,8 @@ extern "C" {
 #define GFX_MAX_FB_HEIGHT (1024)
 
 typedef struct {
+    int fb_size;            /* emulator framebuffer size in bytes, usually the system's max display size */
+                            /* (default: GFX_MAX_FB_WIDTH * GFX_MAX_FB_HEIGHT * 4) */
     int top_offset;
     int aspect_x;
     int aspect_y;
@@ -34,6 +39,8 @@ void gfx_update_texture(void* h, void* data, int data_byte_size);
 void gfx_destroy_texture(void* h);
 void gfx_flash_success(void);
 void gfx_flash_error(void);
+/* write the emulator framebuffer of the last gfx_draw() as binary PPM */
+bool gfx_write_ppm(const char* path);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -41,16 +48,21 @@ void gfx_flash_error(void);
 
 /*== IMPLEMENTATION ==========================================================*/
 #ifdef COMMON_IMPL
-
+#include <stdio.h>
+#include <stdlib.h>
+#if !defined(CHIPS_HEADLESS)
 #include "sokol_gfx.h"
 #include "sokol_app.h"
 #include "sokol_time.h"
 #include "sokol_glue.h"
 #include "shaders.glsl.h"
+#include "prof.h"
+#endif
 
 #define _GFX_DEF(v,def) (v?v:def)
 
 static struct {
+    #if !defined(CHIPS_HEADLESS)
     sg_pipeline upscale_pip;
     sg_bindings upscale_bind;
     sg_pass upscale_pass;
@@ -58,6 +70,7 @@ static struct {
     sg_bindings display_bind;
     sg_pass_action upscale_pass_action;
     sg_pass_action draw_pass_action;
+    #endif
     int flash_success_count;
     int flash_error_count;
     int top_offset;
@@ -66,7 +79,8 @@ static struct {
     int fb_aspect_x;
     int fb_aspect_y;
     bool rot90;
-    uint32_t rgba8_buffer[GFX_MAX_FB_WIDTH * GFX_MAX_FB_HEIGHT];
+    uint32_t* rgba8_buffer;     /* allocated on first use */
+    int rgba8_buffer_size;
     void (*draw_extra_cb)(void);
 } gfx;
 
@@ -78,13 +92,86 @@ void gfx_flash_error(void) {
     gfx.flash_error_count = 20;
 }
 
+/* the framebuffer is allocated on first use, for the size passed to gfx_init() */
 uint32_t* gfx_framebuffer(void) {
+    if (!gfx.rgba8_buffer) {
+        if (0 == gfx.rgba8_buffer_size) {
+            gfx.rgba8_buffer_size = GFX_MAX_FB_WIDTH * GFX_MAX_FB_HEIGHT * sizeof(uint32_t);
+        }
+        gfx.rgba8_buffer = (uint32_t*) calloc(1, (size_t)gfx.rgba8_buffer_size);
+    }
     return gfx.rgba8_buffer;
 }
 
 int gfx_framebuffer_size(void) {
-    return sizeof(gfx.rgba8_buffer);
+    return gfx_framebuffer() ? gfx.rgba8_buffer_size : 0;
+}
+
+static void _gfx_init_framebuffer(const gfx_desc_t* desc) {
+    free(gfx.rgba8_buffer);
+    gfx.rgba8_buffer = 0;
+    gfx.rgba8_buffer_size = _GFX_DEF(desc->fb_size, GFX_MAX_FB_WIDTH * GFX_MAX_FB_HEIGHT * (int)sizeof(uint32_t));
+}
+
+static void _gfx_free_framebuffer(void) {
+    free(gfx.rgba8_buffer);
+    gfx.rgba8_buffer = 0;
+    gfx.rgba8_buffer_size = 0;
+}
+
+bool gfx_write_ppm(const char* path) {
+    if ((gfx.fb_width <= 0) || (gfx.fb_height <= 0)) {
+        return false;
+    }
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", gfx.fb_width, gfx.fb_height);
+    /* RGBA8 pixels are stored as R,G,B,A bytes */
+    const uint8_t* src = (const uint8_t*) gfx_framebuffer();
+    const int num_pixels = gfx.fb_width * gfx.fb_height;
+    bool success = true;
+    for (int i = 0; (i < num_pixels) && success; i++, src += 4) {
+        success = 3 == fwrite(src, 1, 3, fp);
+    }
+    fclose(fp);
+    return success;
+}
+
+#if defined(CHIPS_HEADLESS)
+void gfx_init(const gfx_desc_t* desc) {
+    _gfx_init_framebuffer(desc);
+    gfx.top_offset = desc->top_offset;
+    gfx.fb_width = 0;
+    gfx.fb_height = 0;
+    gfx.fb_aspect_x = _GFX_DEF(desc->aspect_x, 1);
+    gfx.fb_aspect_y = _GFX_DEF(desc->aspect_y, 1);
+    gfx.rot90 = desc->rot90;
+}
+
+void gfx_draw(int width, int height) {
+    gfx.fb_width = width;
+    gfx.fb_height = height;
+}
+
+void gfx_shutdown() {
+    _gfx_free_framebuffer();
+}
+
+void* gfx_create_texture(int w, int h) {
+    (void)w; (void)h;
+    return 0;
+}
+
+void gfx_update_texture(void* h, void* data, int data_byte_size) {
+    (void)h; (void)data; (void)data_byte_size;
+}
+
+void gfx_destroy_texture(void* h) {
+    (void)h;
 }
+#else
 
 void gfx_init_images_and_pass(void) {
 
@@ -130,6 +217,7 @@ void gfx_init(const gfx_desc_t* desc) {
         .colors[0] = { .action = SG_ACTION_CLEAR, .value = { 0.05f, 0.05f, 0.05f, 1.0f } }
     };
 
+    _gfx_init_framebuffer(desc);
     gfx.top_offset = desc->top_offset;
     gfx.fb_width = 0;
     gfx.fb_height = 0;
@@ -241,12 +329,14 @@ void gfx_draw(int width, int height) {
     }
 
     /* copy emulator pixel data into upscaling source texture */
+    const uint64_t upload_start = stm_now();
     sg_update_image(gfx.upscale_bind.fs_images[0], &(sg_image_data){
         .subimage[0][0] = {
-            .ptr = gfx.rgba8_buffer,
+            .ptr = gfx_framebuffer(),
             .size = gfx.fb_width*gfx.fb_height*sizeof(uint32_t)
         }
     });
+    prof_push(PROF_UPLOAD, (float)stm_ms(stm_since(upload_start)));
 
     /* upscale the original framebuffer 2x with nearest filtering */
     sg_begin_pass(gfx.upscale_pass, &gfx.upscale_pass_action);
@@ -287,6 +377,7 @@ void gfx_draw(int width, int height) {
 
 void gfx_shutdown() {
     sg_shutdown();
+    _gfx_free_framebuffer();
 }
 
 void* gfx_create_texture(int w, int h) {
@@ -312,4 +403,5 @@ void gfx_destroy_texture(void* h) {
     sg_image img = { .id=(uint32_t)(uintptr_t)h };
     sg_destroy_image(img);
 }
+#endif /* CHIPS_HEADLESS */
 #endif /* COMMON_IMPL */
@@ -0,0 +1,339 @@
+#pragma once
+/*
+    Cycle-attributing profiler for guest code.
+
+    The CPU glue code (see guestprofz80.h) calls guestprof_step() once
+    per executed instruction with the cycles the previous instruction
+    took, and the CPU state before the next instruction. The cycles are
+    added to a per-PC counter and to the current node of a call tree.
+
+    Call stacks are reconstructed from the stack pointer, which makes
+    this independent from the CPU's call and return instructions: a call
+    (CALL, RST, JSR, or an interrupt) is detected when the stack pointer
+    went down by 2 and the word on top of the stack is a return address
+    right behind the previous instruction, while the program counter
+    jumped elsewhere. A call frame ends once the stack pointer moved
+    above the frame's return address (RET, RTS, RETI, or code which
+    drops the return address or resets the stack).
+
+    guestprof_write() writes the call tree as 'collapsed stacks' text
+    (one line per call path with its cycles), which is the input format
+    of flamegraph tools, for instance:
+
+        flamegraph.pl guestprof.txt > guestprof.svg
+
+    Routines are named by their entry address in hex.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GUESTPROF_DEFAULT_PATH "guestprof.txt"
+#define GUESTPROF_MAX_NODES (1<<16)
+#define GUESTPROF_MAX_DEPTH (256)
+
+typedef struct {
+    uint16_t addr;          /* routine entry address */
+    bool root;              /* true for code outside of any detected call */
+    uint32_t calls;         /* number of calls */
+    uint64_t self;          /* cycles spent in the routine itself */
+    uint64_t total;         /* cycles including called routines */
+} guestprof_routine_t;
+
+/* mark the profiler as supported and set the output path (default: GUESTPROF_DEFAULT_PATH) */
+extern void guestprof_init(const char* path);
+/* free the profile data */
+extern void guestprof_shutdown(void);
+/* true if the current system has CPU glue code for the profiler */
+extern bool guestprof_available(void);
+/* start or stop recording, the profile data is kept until guestprof_reset() */
+extern void guestprof_enable(bool enable);
+extern bool guestprof_enabled(void);
+/* discard the recorded profile data */
+extern void guestprof_reset(void);
+/* record one instruction, called by the CPU glue code */
+extern void guestprof_step(uint16_t pc, uint16_t sp, uint16_t stack_word, uint32_t cycles);
+/* get the total recorded cycles, and the cycles spent at one PC */
+extern uint64_t guestprof_total_cycles(void);
+extern uint64_t guestprof_cycles(uint16_t pc);
+/* get the routines with the most self cycles, returns the number written to 'out' */
+extern int guestprof_top(guestprof_routine_t* out, int max_routines);
+/* write the call tree as collapsed stacks to the output path */
+extern bool guestprof_write(void);
+/* get the output path */
+extern const char* guestprof_path(void);
+/* print the total cycles and the hottest routines to stdout */
+extern void guestprof_print_stats(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef struct {
+    uint16_t addr;
+    int parent;
+    int first_child;
+    int next_sibling;
+    uint32_t calls;
+    uint64_t self;
+} _guestprof_node_t;
+
+typedef struct {
+    uint16_t sp;            /* stack pointer with the frame's return address on top */
+    int node;
+} _guestprof_frame_t;
+
+typedef struct {
+    bool available;
+    bool enabled;
+    bool valid;             /* prev_pc/prev_sp are valid */
+    uint16_t prev_pc;
+    uint16_t prev_sp;
+    uint64_t total;
+    int num_nodes;
+    int cur_node;
+    int depth;
+    uint64_t* pc_cycles;
+    _guestprof_node_t* nodes;
+    _guestprof_frame_t stack[GUESTPROF_MAX_DEPTH];
+    char path[1024];
+} guestprof_state;
+static guestprof_state gprf;
+
+void guestprof_init(const char* path) {
+    gprf.available = true;
+    snprintf(gprf.path, sizeof(gprf.path), "%s", (path && path[0]) ? path : GUESTPROF_DEFAULT_PATH);
+}
+
+void guestprof_shutdown(void) {
+    free(gprf.pc_cycles);
+    free(gprf.nodes);
+    memset(&gprf, 0, sizeof(gprf));
+}
+
+bool guestprof_available(void) {
+    return gprf.available;
+}
+
+void guestprof_reset(void) {
+    if (!gprf.nodes) {
+        return;
+    }
+    memset(gprf.pc_cycles, 0, (1<<16) * sizeof(uint64_t));
+    /* node 0 is the root for code outside of any call */
+    memset(&gprf.nodes[0], 0, sizeof(_guestprof_node_t));
+    gprf.nodes[0].parent = -1;
+    gprf.nodes[0].first_child = -1;
+    gprf.nodes[0].next_sibling = -1;
+    gprf.num_nodes = 1;
+    gprf.cur_node = 0;
+    gprf.depth = 0;
+    gprf.total = 0;
+    gprf.valid = false;
+}
+
+void guestprof_enable(bool enable) {
+    if (enable && !gprf.nodes) {
+        gprf.pc_cycles = (uint64_t*) malloc((1<<16) * sizeof(uint64_t));
+        gprf.nodes = (_guestprof_node_t*) malloc(GUESTPROF_MAX_NODES * sizeof(_guestprof_node_t));
+        if (!gprf.pc_cycles || !gprf.nodes) {
+            free(gprf.pc_cycles); gprf.pc_cycles = 0;
+            free(gprf.nodes); gprf.nodes = 0;
+            return;
+        }
+        guestprof_reset();
+    }
+    /* the CPU state may have changed while stopped */
+    gprf.valid = false;
+    gprf.enabled = enable && (0 != gprf.nodes);
+}
+
+bool guestprof_enabled(void) {
+    return gprf.enabled;
+}
+
+/* find or create the child node for a called routine, stays in the parent if out of nodes */
+static int _guestprof_child(int parent, uint16_t addr) {
+    for (int i = gprf.nodes[parent].first_child; i != -1; i = gprf.nodes[i].next_sibling) {
+        if (gprf.nodes[i].addr == addr) {
+            return i;
+        }
+    }
+    if (gprf.num_nodes == GUESTPROF_MAX_NODES) {
+        return parent;
+    }
+    const int i = gprf.num_nodes++;
+    _guestprof_node_t* node = &gprf.nodes[i];
+    memset(node, 0, sizeof(_guestprof_node_t));
+    node->addr = addr;
+    node->parent = parent;
+    node->first_child = -1;
+    node->next_sibling = gprf.nodes[parent].first_child;
+    gprf.nodes[parent].first_child = i;
+    return i;
+}
+
+void guestprof_step(uint16_t pc, uint16_t sp, uint16_t stack_word, uint32_t cycles) {
+    if (!gprf.enabled) {
+        return;
+    }
+    if (gprf.valid) {
+        gprf.pc_cycles[gprf.prev_pc] += cycles;
+        gprf.nodes[gprf.cur_node].self += cycles;
+        gprf.total += cycles;
+        /* returns: the stack pointer moved above the return address of a frame */
+        while ((gprf.depth > 0) && ((int16_t)(sp - gprf.stack[gprf.depth - 1].sp) > 0)) {
+            gprf.depth--;
+            gprf.cur_node = (gprf.depth > 0) ? gprf.stack[gprf.depth - 1].node : 0;
+        }
+        /* calls: a return address behind the previous instruction was pushed, and PC jumped */
+        const bool pushed_ret_addr = (sp == (uint16_t)(gprf.prev_sp - 2)) &&
+                                     ((uint16_t)(stack_word - gprf.prev_pc - 1) < 4);
+        if (pushed_ret_addr && (pc != stack_word) && (gprf.depth < GUESTPROF_MAX_DEPTH)) {
+            const int node = _guestprof_child(gprf.cur_node, pc);
+            if (node != gprf.cur_node) {
+                gprf.nodes[node].calls++;
+            }
+            gprf.cur_node = node;
+            gprf.stack[gprf.depth].sp = sp;
+            gprf.stack[gprf.depth].node = gprf.cur_node;
+            gprf.depth++;
+        }
+    }
+    gprf.prev_pc = pc;
+    gprf.prev_sp = sp;
+    gprf.valid = true;
+}
+
+uint64_t guestprof_total_cycles(void) {
+    return gprf.total;
+}
+
+uint64_t guestprof_cycles(uint16_t pc) {
+    return gprf.pc_cycles ? gprf.pc_cycles[pc] : 0;
+}
+
+/* true if a node's routine also appears further up in its call path (recursion) */
+static bool _guestprof_recursive(int node) {
+    const uint16_t addr = gprf.nodes[node].addr;
+    for (int i = gprf.nodes[node].parent; i > 0; i = gprf.nodes[i].parent) {
+        if (gprf.nodes[i].addr == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int _guestprof_cmp_self(const void* a, const void* b) {
+    const uint64_t sa = ((const guestprof_routine_t*)a)->self;
+    const uint64_t sb = ((const guestprof_routine_t*)b)->self;
+    return (sa > sb) ? -1 : ((sa < sb) ? 1 : 0);
+}
+
+int guestprof_top(guestprof_routine_t* out, int max_routines) {
+    if (!gprf.nodes || (max_routines <= 0)) {
+        return 0;
+    }
+    /* subtree totals, children are always created after their parents */
+    uint64_t* totals = (uint64_t*) malloc((size_t)gprf.num_nodes * sizeof(uint64_t));
+    /* one entry per routine address, plus the root */
+    guestprof_routine_t* routines = (guestprof_routine_t*) calloc((1<<16) + 1, sizeof(guestprof_routine_t));
+    if (!totals || !routines) {
+        free(totals);
+        free(routines);
+        return 0;
+    }
+    for (int i = 0; i < gprf.num_nodes; i++) {
+        totals[i] = gprf.nodes[i].self;
+    }
+    for (int i = gprf.num_nodes - 1; i > 0; i--) {
+        totals[gprf.nodes[i].parent] += totals[i];
+    }
+    for (int i = 0; i < gprf.num_nodes; i++) {
+        const _guestprof_node_t* node = &gprf.nodes[i];
+        guestprof_routine_t* r = (i == 0) ? &routines[1<<16] : &routines[node->addr];
+        r->addr = node->addr;
+        r->root = (i == 0);
+        r->calls += node->calls;
+        r->self += node->self;
+        /* recursive calls are already contained in the outer call's total */
+        if ((i == 0) || !_guestprof_recursive(i)) {
+            r->total += totals[i];
+        }
+    }
+    /* only sort the routines which spent any cycles */
+    int num_used = 0;
+    for (int i = 0; i < (1<<16) + 1; i++) {
+        if (routines[i].self > 0) {
+            routines[num_used++] = routines[i];
+        }
+    }
+    qsort(routines, (size_t)num_used, sizeof(guestprof_routine_t), _guestprof_cmp_self);
+    const int num = (num_used < max_routines) ? num_used : max_routines;
+    memcpy(out, routines, (size_t)num * sizeof(guestprof_routine_t));
+    free(totals);
+    free(routines);
+    return num;
+}
+
+bool guestprof_write(void) {
+    if (!gprf.nodes) {
+        return false;
+    }
+    FILE* fp = fopen(gprf.path, "w");
+    if (!fp) {
+        printf("guestprof: failed to write '%s'\n", gprf.path);
+        return false;
+    }
+    int path[GUESTPROF_MAX_DEPTH + 1];
+    for (int i = 0; i < gprf.num_nodes; i++) {
+        if (0 == gprf.nodes[i].self) {
+            continue;
+        }
+        int depth = 0;
+        for (int n = i; n > 0; n = gprf.nodes[n].parent) {
+            path[depth++] = n;
+        }
+        fputs("root", fp);
+        while (depth > 0) {
+            fprintf(fp, ";%04X", gprf.nodes[path[--depth]].addr);
+        }
+        fprintf(fp, " %llu\n", (unsigned long long)gprf.nodes[i].self);
+    }
+    const bool success = (0 == ferror(fp));
+    fclose(fp);
+    if (!success) {
+        printf("guestprof: failed to write '%s'\n", gprf.path);
+    }
+    return success;
+}
+
+const char* guestprof_path(void) {
+    return gprf.path;
+}
+
+void guestprof_print_stats(void) {
+    const int max_routines = 10;
+    guestprof_routine_t top[10];
+    const int num = guestprof_top(top, max_routines);
+    const double total = (gprf.total > 0) ? (double)gprf.total : 1.0;
+    printf("guestprof: %llu cycles, %d call paths\n", (unsigned long long)gprf.total, gprf.num_nodes);
+    for (int i = 0; i < num; i++) {
+        char name[8] = "root";
+        if (!top[i].root) {
+            snprintf(name, sizeof(name), "%04X", top[i].addr);
+        }
+        printf("guestprof: %-4s self %5.1f%% total %5.1f%% calls %u\n", name,
+            (100.0 * top[i].self) / total, (100.0 * top[i].total) / total, top[i].calls);
+    }
+}
+#endif /* COMMON_IMPL */
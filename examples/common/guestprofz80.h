@@ -0,0 +1,54 @@
+#pragma once
+/*
+    Z80 glue code for guestprof.h, include after chips/z80.h and chips/mem.h.
+
+    guestprofz80_attach() hooks the CPU's per-instruction trap callback
+    and feeds each instruction into guestprof_step(), the previously
+    installed trap callback is chained. Call it before running the
+    emulator for a frame and guestprofz80_detach() after. When used
+    together with tracez80.h, detach in the reverse order of attaching.
+
+    The trap callback runs after each instruction with the number of
+    ticks executed so far in the current z80_exec() call, the difference
+    to the previous call are the cycles of the previous instruction.
+*/
+#include "guestprof.h"
+
+static struct {
+    z80_t* cpu;
+    mem_t* mem;
+    uint32_t prev_ticks;
+    z80_trap_t chained_cb;
+    void* chained_user_data;
+} guestprofz80;
+
+static int guestprofz80_trap(uint16_t pc, uint32_t ticks, uint64_t pins, void* user_data) {
+    (void)user_data;
+    /* ticks start at 0 again in each z80_exec() call */
+    const uint32_t cycles = (ticks >= guestprofz80.prev_ticks) ? (ticks - guestprofz80.prev_ticks) : ticks;
+    guestprofz80.prev_ticks = ticks;
+    const uint16_t sp = z80_sp(guestprofz80.cpu);
+    const uint16_t stack_word = mem_rd(guestprofz80.mem, sp) | (mem_rd(guestprofz80.mem, (uint16_t)(sp + 1)) << 8);
+    guestprof_step(pc, sp, stack_word, cycles);
+    return guestprofz80.chained_cb ? guestprofz80.chained_cb(pc, ticks, pins, guestprofz80.chained_user_data) : 0;
+}
+
+static void guestprofz80_attach(z80_t* cpu, mem_t* mem) {
+    if (!guestprof_enabled()) {
+        return;
+    }
+    if (cpu->trap_cb != guestprofz80_trap) {
+        guestprofz80.cpu = cpu;
+        guestprofz80.mem = mem;
+        guestprofz80.prev_ticks = 0;
+        guestprofz80.chained_cb = cpu->trap_cb;
+        guestprofz80.chained_user_data = cpu->trap_user_data;
+        z80_trap_cb(cpu, guestprofz80_trap, 0);
+    }
+}
+
+static void guestprofz80_detach(z80_t* cpu) {
+    if (cpu->trap_cb == guestprofz80_trap) {
+        z80_trap_cb(cpu, guestprofz80.chained_cb, guestprofz80.chained_user_data);
+    }
+}
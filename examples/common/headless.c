@@ -0,0 +1,107 @@
+/*
+    Headless replacement for sokol.c, used by the *-headless example
+    targets (compiled with CHIPS_HEADLESS).
+
+    There's no window, 3D-API or audio device. main() calls the
+    frontend's sokol_main() with the command line arguments, and then
+    runs the init-, frame- and cleanup-callbacks directly. The frames
+    run as fast as possible, but each emulates 1/60 sec (see clock.h).
+
+    Additional command line arguments:
+
+    frames=N    number of frames to run (default: 600)
+    dump=path   where to write the final framebuffer as PPM (default: frame.ppm)
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "sokol_app.h"
+#include "sokol_audio.h"
+#define SOKOL_IMPL
+#include "sokol_args.h"
+#include "sokol_time.h"
+#include "gfx.h"
+
+#define HEADLESS_DEFAULT_FRAMES (600)
+#define HEADLESS_SAMPLE_RATE (44100)
+
+/* sokol-app stubs */
+void sapp_show_keyboard(bool show) {
+    (void)show;
+}
+
+int sapp_width(void) {
+    return 0;
+}
+
+int sapp_height(void) {
+    return 0;
+}
+
+/* sokol-audio stubs, audio samples are discarded */
+void saudio_setup(const saudio_desc* desc) {
+    (void)desc;
+}
+
+void saudio_shutdown(void) { }
+
+bool saudio_isvalid(void) {
+    return false;
+}
+
+int saudio_sample_rate(void) {
+    return HEADLESS_SAMPLE_RATE;
+}
+
+int saudio_buffer_frames(void) {
+    return 0;
+}
+
+int saudio_channels(void) {
+    return 1;
+}
+
+int saudio_expect(void) {
+    return 0;
+}
+
+int saudio_push(const float* frames, int num_frames) {
+    (void)frames;
+    return num_frames;
+}
+
+int main(int argc, char* argv[]) {
+    sapp_desc desc = sokol_main(argc, argv);
+    int num_frames = HEADLESS_DEFAULT_FRAMES;
+    if (sargs_exists("frames")) {
+        num_frames = atoi(sargs_value("frames"));
+    }
+    /* the frontend calls sargs_shutdown() in its cleanup callback */
+    char dump_path[1024];
+    snprintf(dump_path, sizeof(dump_path), "%s", sargs_value_def("dump", "frame.ppm"));
+
+    stm_setup();
+    const uint64_t start = stm_now();
+    if (desc.init_cb) {
+        desc.init_cb();
+    }
+    for (int i = 0; i < num_frames; i++) {
+        if (desc.frame_cb) {
+            desc.frame_cb();
+        }
+    }
+    const double secs = stm_sec(stm_since(start));
+    const bool success = gfx_write_ppm(dump_path);
+    if (desc.cleanup_cb) {
+        desc.cleanup_cb();
+    }
+    printf("%s: %d frames in %.3f secs (%.1fx realtime)\n",
+        desc.window_title ? desc.window_title : "headless",
+        num_frames, secs, (secs > 0.0) ? ((num_frames / 60.0) / secs) : 0.0);
+    if (!success) {
+        printf("failed to write '%s'\n", dump_path);
+        return 10;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#pragma once
+/*
+    Memory access heatmap for the debugger.
+
+    Three counters per 16-bit guest address, for memory reads, writes and
+    opcode fetches. The CPU glue code (see heatz80.h) adds to the counters
+    in the CPU's memory access path, heatmap_update() is called once per
+    frame to let the counters decay and to convert them into a 256x256
+    RGBA8 image (one pixel per address, rows of 256 bytes) with writes
+    in red, reads in green and opcode fetches in blue.
+
+    Counting is only active while the heatmap is enabled (usually while
+    the heatmap window is open), the counters are allocated on the first
+    heatmap_enable().
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEATMAP_NUM_ADDRS (1<<16)
+#define HEATMAP_WIDTH (256)
+#define HEATMAP_HEIGHT (256)
+
+typedef enum {
+    HEATMAP_READ,
+    HEATMAP_WRITE,
+    HEATMAP_EXEC,
+    HEATMAP_NUM,
+} heatmap_access_t;
+
+/* mark the heatmap as supported, called at startup by frontends which use CPU glue code */
+extern void heatmap_init(void);
+/* free the counters and image */
+extern void heatmap_shutdown(void);
+/* true if the current system has CPU glue code for the heatmap */
+extern bool heatmap_available(void);
+/* start or stop counting, starting clears the counters */
+extern void heatmap_enable(bool enable);
+extern bool heatmap_enabled(void);
+/* get the counters as [HEATMAP_NUM][HEATMAP_NUM_ADDRS] array for the CPU glue code */
+extern uint32_t* heatmap_counters(void);
+/* decay the counters and update the image, call once per frame */
+extern void heatmap_update(void);
+/* get the 256x256 RGBA8 image */
+extern const uint32_t* heatmap_pixels(void);
+extern int heatmap_pixels_size(void);
+/* get the current (decayed) counter value of an address */
+extern uint32_t heatmap_count(heatmap_access_t access, uint16_t addr);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* each frame, counters lose 1/2^HEATMAP_DECAY_SHIFT of their value */
+#define HEATMAP_DECAY_SHIFT (3)
+
+typedef struct {
+    bool available;
+    bool enabled;
+    uint32_t* counters;
+    uint32_t* pixels;
+} heatmap_state;
+static heatmap_state heat;
+
+void heatmap_init(void) {
+    heat.available = true;
+}
+
+void heatmap_shutdown(void) {
+    free(heat.counters);
+    free(heat.pixels);
+    memset(&heat, 0, sizeof(heat));
+}
+
+bool heatmap_available(void) {
+    return heat.available;
+}
+
+void heatmap_enable(bool enable) {
+    if (enable && !heat.counters) {
+        heat.counters = (uint32_t*) malloc(HEATMAP_NUM * HEATMAP_NUM_ADDRS * sizeof(uint32_t));
+        heat.pixels = (uint32_t*) malloc(HEATMAP_WIDTH * HEATMAP_HEIGHT * sizeof(uint32_t));
+        if (!heat.counters || !heat.pixels) {
+            heatmap_shutdown();
+            return;
+        }
+    }
+    if (enable && !heat.enabled) {
+        memset(heat.counters, 0, HEATMAP_NUM * HEATMAP_NUM_ADDRS * sizeof(uint32_t));
+        memset(heat.pixels, 0, HEATMAP_WIDTH * HEATMAP_HEIGHT * sizeof(uint32_t));
+    }
+    heat.enabled = enable && (0 != heat.counters);
+}
+
+bool heatmap_enabled(void) {
+    return heat.enabled;
+}
+
+uint32_t* heatmap_counters(void) {
+    return heat.counters;
+}
+
+/* map a counter to 0..255 on a logarithmic scale, +16 per doubling, saturating at 64K accesses */
+static uint32_t _heatmap_level(uint32_t v) {
+    uint32_t bits = 0;
+    if (v >= (1<<16)) { v >>= 16; bits += 16; }
+    if (v >= (1<<8)) { v >>= 8; bits += 8; }
+    if (v >= (1<<4)) { v >>= 4; bits += 4; }
+    if (v >= (1<<2)) { v >>= 2; bits += 2; }
+    if (v >= (1<<1)) { v >>= 1; bits += 1; }
+    bits += v;
+    return (bits >= 16) ? 255 : (bits * 16);
+}
+
+/* rounded up, so that small counters decay to zero */
+static uint32_t _heatmap_decay(uint32_t v) {
+    return (v + (1<<HEATMAP_DECAY_SHIFT) - 1) >> HEATMAP_DECAY_SHIFT;
+}
+
+void heatmap_update(void) {
+    if (!heat.enabled) {
+        return;
+    }
+    uint32_t* rd = &heat.counters[HEATMAP_READ * HEATMAP_NUM_ADDRS];
+    uint32_t* wr = &heat.counters[HEATMAP_WRITE * HEATMAP_NUM_ADDRS];
+    uint32_t* ex = &heat.counters[HEATMAP_EXEC * HEATMAP_NUM_ADDRS];
+    for (int i = 0; i < HEATMAP_NUM_ADDRS; i++) {
+        heat.pixels[i] = 0xFF000000 |
+            (_heatmap_level(ex[i]) << 16) |
+            (_heatmap_level(rd[i]) << 8) |
+            _heatmap_level(wr[i]);
+        rd[i] -= _heatmap_decay(rd[i]);
+        wr[i] -= _heatmap_decay(wr[i]);
+        ex[i] -= _heatmap_decay(ex[i]);
+    }
+}
+
+const uint32_t* heatmap_pixels(void) {
+    return heat.pixels;
+}
+
+int heatmap_pixels_size(void) {
+    return HEATMAP_WIDTH * HEATMAP_HEIGHT * (int)sizeof(uint32_t);
+}
+
+uint32_t heatmap_count(heatmap_access_t access, uint16_t addr) {
+    assert((access >= 0) && (access < HEATMAP_NUM));
+    return heat.counters ? heat.counters[access * HEATMAP_NUM_ADDRS + addr] : 0;
+}
+#endif /* COMMON_IMPL */
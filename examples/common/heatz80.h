@@ -0,0 +1,47 @@
+#pragma once
+/*
+    Z80 glue code for heatmap.h, include after chips/z80.h.
+
+    heatz80_attach() wraps the CPU's tick callback (the system's memory
+    and IO access path) to count memory reads, writes and opcode fetches
+    per address, heatz80_detach() restores the system's tick callback.
+    Call both around running the emulator for a frame, they do nothing
+    while the heatmap is disabled, so the system runs without overhead.
+
+    The counting itself has no branches, each access adds the 0/1 results
+    of the pin tests to all three counters of the address.
+*/
+#include "heatmap.h"
+
+static struct {
+    uint32_t* counters;
+    z80_tick_t chained_cb;
+} heatz80;
+
+static uint64_t heatz80_tick(int num_ticks, uint64_t pins, void* user_data) {
+    const uint32_t addr = Z80_GET_ADDR(pins);
+    const uint32_t mreq = (pins & Z80_MREQ) != 0;
+    const uint32_t m1 = (pins & Z80_M1) != 0;
+    const uint32_t rd = mreq & ((pins & Z80_RD) != 0);
+    const uint32_t wr = mreq & ((pins & Z80_WR) != 0);
+    uint32_t* c = heatz80.counters;
+    c[HEATMAP_READ * HEATMAP_NUM_ADDRS + addr] += rd & (m1 ^ 1);
+    c[HEATMAP_WRITE * HEATMAP_NUM_ADDRS + addr] += wr;
+    c[HEATMAP_EXEC * HEATMAP_NUM_ADDRS + addr] += rd & m1;
+    return heatz80.chained_cb(num_ticks, pins, user_data);
+}
+
+static void heatz80_attach(z80_t* cpu) {
+    if (!heatmap_enabled() || (cpu->tick_cb == heatz80_tick)) {
+        return;
+    }
+    heatz80.counters = heatmap_counters();
+    heatz80.chained_cb = cpu->tick_cb;
+    cpu->tick_cb = heatz80_tick;
+}
+
+static void heatz80_detach(z80_t* cpu) {
+    if (cpu->tick_cb == heatz80_tick) {
+        cpu->tick_cb = heatz80.chained_cb;
+    }
+}
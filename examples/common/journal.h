@@ -0,0 +1,414 @@
+#pragma once
+/*
+    Input journal for recording and deterministic replay.
+
+    The journal records the emulated duration of each frame, and all
+    input events (key presses, keys typed from the keyboard buffer, and
+    inserted media files) in the order they are applied to the emulator.
+    Events are applied between frames, so the position of an event in
+    the stream is its timestamp in emulated microseconds (the unit the
+    systems' exec functions take).
+
+    On replay, the recorded frame durations replace the host frame time
+    and the events are fed back at the same emulated time, so that an
+    emulator started with the same arguments ends up in the same state
+    bit by bit. Replay can run unthrottled, in that case as many frames
+    as fit into a host frame are run.
+
+    Stream format (all integers are LEB128 varints):
+
+    "CHIPSJNL" + version byte, followed by records starting with a tag byte:
+
+    JOURNAL_TAG_FRAME       frame_time_us
+    JOURNAL_TAG_FRAMES_SAME count (repeat the previous frame duration)
+    JOURNAL_TAG_KEY_DOWN    key
+    JOURNAL_TAG_KEY_UP      key
+    JOURNAL_TAG_KEY_TYPED   key
+    JOURNAL_TAG_KEY_INJECTED key
+    JOURNAL_TAG_MEDIA       slot, ext_len, ext bytes, size, data bytes
+*/
+typedef enum {
+    JOURNAL_EVENT_KEY_DOWN,
+    JOURNAL_EVENT_KEY_UP,
+    JOURNAL_EVENT_KEY_TYPED,    /* key from the keyboard buffer, pressed and released in one go */
+    JOURNAL_EVENT_KEY_INJECTED, /* key put directly into the guest's keyboard buffer (turbo typing) */
+    JOURNAL_EVENT_MEDIA,        /* a loaded file which is inserted into the emulator */
+} journal_event_type_t;
+
+typedef struct {
+    journal_event_type_t type;
+    uint64_t time_us;           /* emulated time, only set for replayed events */
+    int key;
+    int slot;                   /* media: fs slot */
+    const char* ext;            /* media: lower-case file extension */
+    const uint8_t* data;        /* media: file content */
+    uint32_t size;
+} journal_event_t;
+
+typedef void (*journal_event_cb_t)(const journal_event_t* event);
+
+typedef struct {
+    const char* record_path;    /* if set, record into this file */
+    const char* replay_path;    /* if set, replay from this file */
+    bool unthrottled;           /* replay as fast as possible */
+    journal_event_cb_t event_cb; /* called for replayed events */
+} journal_desc_t;
+
+/* start recording or replaying */
+extern void journal_init(const journal_desc_t* desc);
+/* finish writing the recording and free the replay data */
+extern void journal_shutdown(void);
+/* true while recording */
+extern bool journal_recording(void);
+/* true until all recorded frames have been replayed */
+extern bool journal_replaying(void);
+/* true if replay should run as fast as possible */
+extern bool journal_unthrottled(void);
+/* emulated time since journal_init() in microseconds */
+extern uint64_t journal_time(void);
+/* record the duration of the next frame (no-op when not recording) */
+extern void journal_record_frame(uint32_t frame_time_us);
+/* record an input event (no-op when not recording) */
+extern void journal_record(const journal_event_t* event);
+/* get the duration of the next recorded frame, returns false at the end of the journal */
+extern bool journal_replay_frame(uint32_t* out_frame_time_us);
+/* dispatch the events recorded after the current frame */
+extern void journal_replay_events(void);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sokol_time.h"
+
+#define JOURNAL_MAGIC "CHIPSJNL"
+#define JOURNAL_VERSION (1)
+
+enum {
+    JOURNAL_TAG_FRAME = 0x01,
+    JOURNAL_TAG_FRAMES_SAME = 0x02,
+    JOURNAL_TAG_KEY_DOWN = 0x10,
+    JOURNAL_TAG_KEY_UP = 0x11,
+    JOURNAL_TAG_KEY_TYPED = 0x12,
+    JOURNAL_TAG_KEY_INJECTED = 0x13,
+    JOURNAL_TAG_MEDIA = 0x20,
+};
+
+typedef struct {
+    bool recording;
+    bool replaying;
+    bool unthrottled;
+    journal_event_cb_t event_cb;
+    uint64_t time_us;
+    uint64_t num_frames;
+    uint32_t last_frame_us;
+    /* recording */
+    FILE* fp;
+    uint32_t same_count;        /* pending repeats of last_frame_us */
+    /* replay */
+    uint8_t* buf;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t repeat;            /* remaining repeats of last_frame_us */
+    uint64_t start_time;
+} journal_state;
+static journal_state jrnl;
+
+static void _journal_write_varint(uint64_t val) {
+    do {
+        uint8_t b = val & 0x7F;
+        val >>= 7;
+        if (val) {
+            b |= 0x80;
+        }
+        fputc(b, jrnl.fp);
+    } while (val);
+}
+
+static void _journal_flush_frames(void) {
+    if (jrnl.same_count > 0) {
+        fputc(JOURNAL_TAG_FRAMES_SAME, jrnl.fp);
+        _journal_write_varint(jrnl.same_count);
+        jrnl.same_count = 0;
+    }
+}
+
+static bool _journal_read_varint(uint64_t* val) {
+    *val = 0;
+    for (int shift = 0; (shift < 64) && (jrnl.pos < jrnl.size); shift += 7) {
+        const uint8_t b = jrnl.buf[jrnl.pos++];
+        *val |= (uint64_t)(b & 0x7F) << shift;
+        if (0 == (b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool _journal_load(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    const size_t header_size = strlen(JOURNAL_MAGIC) + 1;
+    bool success = false;
+    if ((size > (long)header_size) && (size < 0x7FFFFFFF)) {
+        jrnl.buf = (uint8_t*) malloc((size_t)size);
+        if (jrnl.buf && (fread(jrnl.buf, 1, (size_t)size, fp) == (size_t)size)) {
+            success = (0 == memcmp(jrnl.buf, JOURNAL_MAGIC, header_size - 1)) &&
+                      (jrnl.buf[header_size - 1] == JOURNAL_VERSION);
+            jrnl.size = (uint32_t)size;
+            jrnl.pos = (uint32_t)header_size;
+        }
+    }
+    fclose(fp);
+    if (!success) {
+        free(jrnl.buf);
+        jrnl.buf = 0;
+    }
+    return success;
+}
+
+void journal_init(const journal_desc_t* desc) {
+    assert(desc);
+    memset(&jrnl, 0, sizeof(jrnl));
+    jrnl.event_cb = desc->event_cb;
+    jrnl.unthrottled = desc->unthrottled;
+    if (desc->replay_path) {
+        if (_journal_load(desc->replay_path)) {
+            jrnl.replaying = true;
+            jrnl.start_time = stm_now();
+        }
+        else {
+            printf("journal: failed to load '%s'\n", desc->replay_path);
+        }
+    }
+    else if (desc->record_path) {
+        jrnl.fp = fopen(desc->record_path, "wb");
+        if (jrnl.fp) {
+            fwrite(JOURNAL_MAGIC, 1, strlen(JOURNAL_MAGIC), jrnl.fp);
+            fputc(JOURNAL_VERSION, jrnl.fp);
+            jrnl.recording = true;
+        }
+        else {
+            printf("journal: failed to open '%s' for writing\n", desc->record_path);
+        }
+    }
+}
+
+void journal_shutdown(void) {
+    if (jrnl.fp) {
+        _journal_flush_frames();
+        printf("journal: recorded %llu frames, %.1f emulated secs, %ld bytes\n",
+            (unsigned long long)jrnl.num_frames, jrnl.time_us / 1000000.0, ftell(jrnl.fp));
+        fclose(jrnl.fp);
+    }
+    free(jrnl.buf);
+    memset(&jrnl, 0, sizeof(jrnl));
+}
+
+bool journal_recording(void) {
+    return jrnl.recording;
+}
+
+bool journal_replaying(void) {
+    return jrnl.replaying;
+}
+
+bool journal_unthrottled(void) {
+    return jrnl.unthrottled;
+}
+
+uint64_t journal_time(void) {
+    return jrnl.time_us;
+}
+
+void journal_record_frame(uint32_t frame_time_us) {
+    if (!jrnl.recording) {
+        return;
+    }
+    if ((jrnl.num_frames > 0) && (frame_time_us == jrnl.last_frame_us)) {
+        jrnl.same_count++;
+    }
+    else {
+        _journal_flush_frames();
+        fputc(JOURNAL_TAG_FRAME, jrnl.fp);
+        _journal_write_varint(frame_time_us);
+        jrnl.last_frame_us = frame_time_us;
+    }
+    jrnl.num_frames++;
+    jrnl.time_us += frame_time_us;
+}
+
+void journal_record(const journal_event_t* ev) {
+    assert(ev);
+    if (!jrnl.recording) {
+        return;
+    }
+    _journal_flush_frames();
+    switch (ev->type) {
+        case JOURNAL_EVENT_KEY_DOWN:
+            fputc(JOURNAL_TAG_KEY_DOWN, jrnl.fp);
+            _journal_write_varint((uint64_t)ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_UP:
+            fputc(JOURNAL_TAG_KEY_UP, jrnl.fp);
+            _journal_write_varint((uint64_t)ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_TYPED:
+            fputc(JOURNAL_TAG_KEY_TYPED, jrnl.fp);
+            _journal_write_varint((uint64_t)ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_INJECTED:
+            fputc(JOURNAL_TAG_KEY_INJECTED, jrnl.fp);
+            _journal_write_varint((uint64_t)ev->key);
+            break;
+        case JOURNAL_EVENT_MEDIA:
+            {
+                const size_t ext_len = ev->ext ? strlen(ev->ext) : 0;
+                fputc(JOURNAL_TAG_MEDIA, jrnl.fp);
+                _journal_write_varint((uint64_t)ev->slot);
+                _journal_write_varint(ext_len);
+                fwrite(ev->ext, 1, ext_len, jrnl.fp);
+                _journal_write_varint(ev->size);
+                fwrite(ev->data, 1, ev->size, jrnl.fp);
+            }
+            break;
+    }
+}
+
+static void _journal_finish_replay(void) {
+    if (jrnl.replaying) {
+        jrnl.replaying = false;
+        printf("journal: replayed %llu frames, %.1f emulated secs in %.1f secs\n",
+            (unsigned long long)jrnl.num_frames, jrnl.time_us / 1000000.0, stm_sec(stm_since(jrnl.start_time)));
+    }
+}
+
+/* dispatch events up to the next frame record, returns false on end of stream or error */
+static bool _journal_dispatch_events(void) {
+    while (jrnl.pos < jrnl.size) {
+        const uint8_t tag = jrnl.buf[jrnl.pos];
+        if ((tag == JOURNAL_TAG_FRAME) || (tag == JOURNAL_TAG_FRAMES_SAME)) {
+            return true;
+        }
+        jrnl.pos++;
+        journal_event_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.time_us = jrnl.time_us;
+        uint64_t val = 0;
+        switch (tag) {
+            case JOURNAL_TAG_KEY_DOWN:
+            case JOURNAL_TAG_KEY_UP:
+            case JOURNAL_TAG_KEY_TYPED:
+            case JOURNAL_TAG_KEY_INJECTED:
+                if (!_journal_read_varint(&val)) {
+                    return false;
+                }
+                switch (tag) {
+                    case JOURNAL_TAG_KEY_DOWN:  ev.type = JOURNAL_EVENT_KEY_DOWN; break;
+                    case JOURNAL_TAG_KEY_UP:    ev.type = JOURNAL_EVENT_KEY_UP; break;
+                    case JOURNAL_TAG_KEY_TYPED: ev.type = JOURNAL_EVENT_KEY_TYPED; break;
+                    default:                    ev.type = JOURNAL_EVENT_KEY_INJECTED; break;
+                }
+                ev.key = (int)val;
+                break;
+            case JOURNAL_TAG_MEDIA:
+                {
+                    /* the extension is copied so that it can be zero-terminated */
+                    static char ext[16];
+                    uint64_t slot, ext_len, size;
+                    if (!_journal_read_varint(&slot) || !_journal_read_varint(&ext_len) || (ext_len >= sizeof(ext))) {
+                        return false;
+                    }
+                    if ((jrnl.size - jrnl.pos) < ext_len) {
+                        return false;
+                    }
+                    memcpy(ext, &jrnl.buf[jrnl.pos], ext_len);
+                    ext[ext_len] = 0;
+                    jrnl.pos += (uint32_t)ext_len;
+                    if (!_journal_read_varint(&size) || ((jrnl.size - jrnl.pos) < size)) {
+                        return false;
+                    }
+                    ev.type = JOURNAL_EVENT_MEDIA;
+                    ev.slot = (int)slot;
+                    ev.ext = ext;
+                    ev.data = &jrnl.buf[jrnl.pos];
+                    ev.size = (uint32_t)size;
+                    jrnl.pos += (uint32_t)size;
+                }
+                break;
+            default:
+                printf("journal: invalid record 0x%02X at offset %u\n", tag, jrnl.pos - 1);
+                return false;
+        }
+        if (jrnl.event_cb) {
+            jrnl.event_cb(&ev);
+        }
+    }
+    return false;
+}
+
+static void _journal_dispatch(void) {
+    if (!_journal_dispatch_events()) {
+        /* end of stream, or a malformed record */
+        jrnl.pos = jrnl.size;
+    }
+}
+
+/* read the next frame record */
+static bool _journal_read_frame(void) {
+    if (jrnl.pos >= jrnl.size) {
+        return false;
+    }
+    const uint8_t tag = jrnl.buf[jrnl.pos++];
+    uint64_t val = 0;
+    if (!_journal_read_varint(&val)) {
+        return false;
+    }
+    if (tag == JOURNAL_TAG_FRAME) {
+        jrnl.last_frame_us = (uint32_t)val;
+        return true;
+    }
+    else if ((tag == JOURNAL_TAG_FRAMES_SAME) && (val > 0)) {
+        jrnl.repeat = (uint32_t)(val - 1);
+        return true;
+    }
+    return false;
+}
+
+bool journal_replay_frame(uint32_t* out_frame_time_us) {
+    assert(out_frame_time_us);
+    if (!jrnl.replaying) {
+        return false;
+    }
+    if (jrnl.repeat == 0) {
+        /* events before the first frame */
+        if (jrnl.num_frames == 0) {
+            _journal_dispatch();
+        }
+        if (!_journal_read_frame()) {
+            _journal_finish_replay();
+            return false;
+        }
+    }
+    else {
+        jrnl.repeat--;
+    }
+    *out_frame_time_us = jrnl.last_frame_us;
+    jrnl.num_frames++;
+    jrnl.time_us += jrnl.last_frame_us;
+    return true;
+}
+
+void journal_replay_events(void) {
+    if (jrnl.replaying && (jrnl.repeat == 0)) {
+        _journal_dispatch();
+    }
+}
+#endif /* COMMON_IMPL */
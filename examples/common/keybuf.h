@@ -5,7 +5,16 @@
     Special embedded commands:
 
     ${wait:20} - wait 20 frames before continuing
+
+    By default, keys are fed with a fixed delay between keys. In turbo
+    mode (keybuf_set_turbo()), keys are handed to a callback instead,
+    as fast as the callback accepts them. The callback typically puts the
+    key straight into the guest system's keyboard buffer, and rejects
+    it while that buffer is full, so that text types in at the rate the
+    guest consumes it.
 */
+/* turbo mode callback, return false if the guest isn't ready for the key, it will be retried next frame */
+typedef bool (*keybuf_turbo_cb_t)(uint8_t key);
 
 /* initialize the keybuf with a base-delay between keys in 60 Hz frames */
 extern void keybuf_init(int key_delay_frames);
@@ -13,23 +22,30 @@ extern void keybuf_init(int key_delay_frames);
 extern void keybuf_put(const char* text);
 /* get next key to feed into emulator, call once per frame, returns 0 if no key to feed */
 extern uint8_t keybuf_get(uint32_t frame_time_us);
+/* enable turbo mode with a callback, or disable with a null pointer */
+extern void keybuf_set_turbo(keybuf_turbo_cb_t cb);
 
 /*== IMPLEMENTATION ==========================================================*/
 #ifdef COMMON_IMPL
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "keybuf.h"
 
-#define KEYBUF_MAX_KEYS (64 * 1024)
+/* upper bound for keys handed to the turbo callback in one frame */
+#define KEYBUF_MAX_TURBO_KEYS (256)
 typedef struct {
     int cur_pos;
     int cur_delay_time;
     int key_delay_time;
-    uint8_t buf[KEYBUF_MAX_KEYS];
+    keybuf_turbo_cb_t turbo_cb;
+    uint8_t* buf;           /* allocated in keybuf_put() for the text's length */
+    int buf_size;
 } keybuf_state;
 static keybuf_state keybuf;
 
 void keybuf_init(int key_delay_frames) {
+    free(keybuf.buf);
     memset(&keybuf, 0, sizeof(keybuf));
     keybuf.key_delay_time = key_delay_frames * 16667;
 }
@@ -39,18 +55,21 @@ void keybuf_put(const char* text) {
         return;
     }
     keybuf.cur_delay_time = 0;
-    int len = (int) strlen(text);
-    if ((len+1) < KEYBUF_MAX_KEYS) {
-        strcpy((char*)keybuf.buf, text);
-    }
-    else {
-        keybuf.buf[0] = 0;
+    const int len = (int) strlen(text);
+    if ((len + 1) > keybuf.buf_size) {
+        uint8_t* buf = (uint8_t*) realloc(keybuf.buf, (size_t)len + 1);
+        if (!buf) {
+            return;
+        }
+        keybuf.buf = buf;
+        keybuf.buf_size = len + 1;
     }
+    memcpy(keybuf.buf, text, (size_t)len + 1);
     keybuf.cur_pos = 0;
 }
 
 static uint8_t _keybuf_peek(void) {
-    if (keybuf.cur_pos < KEYBUF_MAX_KEYS) {
+    if (keybuf.cur_pos < keybuf.buf_size) {
         return keybuf.buf[keybuf.cur_pos];
     }
     else {
@@ -102,7 +121,48 @@ static uint8_t _keybuf_parse_cmd(void) {
     return 0;
 }
 
+void keybuf_set_turbo(keybuf_turbo_cb_t cb) {
+    keybuf.turbo_cb = cb;
+}
+
+/* hand keys to the turbo callback until it rejects one */
+static void _keybuf_turbo(void) {
+    for (int i = 0; i < KEYBUF_MAX_TURBO_KEYS; i++) {
+        const int pos = keybuf.cur_pos;
+        uint8_t c = _keybuf_next();
+        if (c == 0) {
+            break;
+        }
+        if (((c == '$') || (c == '#')) && (_keybuf_peek() == '{')) {
+            c = _keybuf_parse_cmd();
+            if (keybuf.cur_delay_time > 0) {
+                /* ${wait:N} */
+                break;
+            }
+            if (c == 0) {
+                continue;
+            }
+        }
+        if (c == 0x0A) {
+            c = 0x0D;
+        }
+        if (!keybuf.turbo_cb(c)) {
+            keybuf.cur_pos = pos;
+            break;
+        }
+    }
+}
+
 uint8_t keybuf_get(uint32_t frame_time_us) {
+    if (keybuf.turbo_cb) {
+        if (keybuf.cur_delay_time <= 0) {
+            _keybuf_turbo();
+        }
+        else {
+            keybuf.cur_delay_time -= (int) frame_time_us;
+        }
+        return 0;
+    }
     uint8_t c = 0;
     if (keybuf.cur_delay_time <= 0) {
         keybuf.cur_delay_time = keybuf.key_delay_time;
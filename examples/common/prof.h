@@ -0,0 +1,130 @@
+#pragma once
+/*
+    Per-frame timing samples for the profiler window in the debugging UI.
+
+    The frontends and common modules push one value per frame into
+    a bucket (for instance the emulation time, or the time to upload
+    the framebuffer texture), each bucket keeps the last PROF_NUM_SAMPLES
+    values in a ring buffer for the histogram and min/avg/p99 stats.
+
+    Pushing a value is only a ring buffer store, so the samples are
+    always collected, also in frontends without UI.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROF_NUM_SAMPLES (256)
+
+typedef enum {
+    PROF_EMU,               /* emulator exec time (ms) */
+    PROF_DECODE,            /* separate video decoding step (ms), only the arcade machines have one */
+    PROF_UPLOAD,            /* framebuffer texture upload in gfx_draw() (ms) */
+    PROF_UI,                /* ImGui frame build and render (ms) */
+    PROF_AUDIO,             /* queued audio samples */
+    PROF_NUM,
+} prof_bucket_t;
+
+typedef struct {
+    int count;              /* number of samples in the stats */
+    float min;
+    float avg;
+    float max;
+    float p99;
+} prof_stats_t;
+
+/* push the value of the current frame into a bucket */
+extern void prof_push(prof_bucket_t bucket, float value);
+/* get the name of a bucket */
+extern const char* prof_name(prof_bucket_t bucket);
+/* get the number of samples in a bucket */
+extern int prof_count(prof_bucket_t bucket);
+/* get a sample value, index 0 is the oldest sample */
+extern float prof_value(prof_bucket_t bucket, int index);
+/* compute min/avg/max/p99 over the samples in a bucket */
+extern prof_stats_t prof_stats(prof_bucket_t bucket);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+    uint32_t head;          /* total number of pushed samples */
+    float samples[PROF_NUM_SAMPLES];
+} prof_ring_t;
+
+static struct {
+    prof_ring_t rings[PROF_NUM];
+} prof;
+
+static const char* _prof_names[PROF_NUM] = {
+    "Emulator", "Video Decode", "Texture Upload", "UI", "Audio Queue"
+};
+
+void prof_push(prof_bucket_t bucket, float value) {
+    assert((bucket >= 0) && (bucket < PROF_NUM));
+    prof_ring_t* ring = &prof.rings[bucket];
+    ring->samples[ring->head++ % PROF_NUM_SAMPLES] = value;
+}
+
+const char* prof_name(prof_bucket_t bucket) {
+    assert((bucket >= 0) && (bucket < PROF_NUM));
+    return _prof_names[bucket];
+}
+
+int prof_count(prof_bucket_t bucket) {
+    assert((bucket >= 0) && (bucket < PROF_NUM));
+    const uint32_t head = prof.rings[bucket].head;
+    return (head < PROF_NUM_SAMPLES) ? (int)head : PROF_NUM_SAMPLES;
+}
+
+float prof_value(prof_bucket_t bucket, int index) {
+    const int count = prof_count(bucket);
+    if ((index < 0) || (index >= count)) {
+        return 0.0f;
+    }
+    const prof_ring_t* ring = &prof.rings[bucket];
+    return ring->samples[(ring->head - (uint32_t)count + (uint32_t)index) % PROF_NUM_SAMPLES];
+}
+
+static int _prof_cmp(const void* a, const void* b) {
+    const float fa = *(const float*)a;
+    const float fb = *(const float*)b;
+    return (fa < fb) ? -1 : ((fa > fb) ? 1 : 0);
+}
+
+prof_stats_t prof_stats(prof_bucket_t bucket) {
+    prof_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.count = prof_count(bucket);
+    if (0 == stats.count) {
+        return stats;
+    }
+    float sorted[PROF_NUM_SAMPLES];
+    double sum = 0.0;
+    for (int i = 0; i < stats.count; i++) {
+        sorted[i] = prof_value(bucket, i);
+        sum += sorted[i];
+    }
+    qsort(sorted, (size_t)stats.count, sizeof(float), _prof_cmp);
+    stats.min = sorted[0];
+    stats.max = sorted[stats.count - 1];
+    stats.avg = (float)(sum / stats.count);
+    /* nearest-rank percentile */
+    int p99_index = (99 * stats.count + 99) / 100 - 1;
+    if (p99_index < 0) {
+        p99_index = 0;
+    }
+    stats.p99 = sorted[p99_index];
+    return stats;
+}
+#endif /* COMMON_IMPL */
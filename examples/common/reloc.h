@@ -0,0 +1,189 @@
+#pragma once
+/*
+    Pointer relocation for emulator state snapshots.
+
+    The system structs contain pointers (memory pages into RAM and ROM,
+    the pixel buffer, callbacks and their user data). These differ
+    between runs of the same program (address space layout randomization),
+    so a byte-wise copy of the struct is neither comparable nor loadable
+    in another process.
+
+    reloc_normalize() copies a memory block and replaces every aligned
+    pointer-sized word that points into a registered range with a
+    position-independent token (range index and offset).
+    reloc_denormalize() turns tokens back into pointers of the current
+    process.
+
+    Ranges are registered either explicitly with reloc_add_range(), or
+    with reloc_add_image(), which covers a window around an address
+    inside the executable (e.g. a function). The window catches code
+    pointers and pointers into static data (the system structs and ROM
+    images of the example emulators are statics), because the executable
+    image is relocated as a whole. Pointers are matched against the
+    ranges in registration order, so heap buffers must be registered
+    before the image window (which may contain the heap), and in the same
+    order in each run.
+
+    Any word is checked, so a plain integer which happens to look like
+    a pointer into a range (or like a token) is transformed as well. In
+    another process, where the ranges are at different addresses, such
+    an integer is changed. Guest memory inside the system structs (RAM,
+    video RAM, ROM images) can contain any bit pattern, and must be
+    excluded from relocation with reloc_exclude(). The remaining parts of
+    the system structs are host-side state, where pointer-like integers
+    don't occur in practice.
+*/
+#include <stddef.h>
+
+#define RELOC_MAX_RANGES (16)
+#define RELOC_MAX_EXCLUDES (16)
+
+/* remove all ranges */
+extern void reloc_reset(void);
+/* register a memory range which pointers may point into */
+extern void reloc_add_range(const void* ptr, size_t size);
+/* register a window around an address inside the executable image */
+extern void reloc_add_image(const void* anchor);
+/* never relocate the words inside a memory range (guest memory inside a system struct) */
+extern void reloc_exclude(const void* ptr, size_t size);
+/* copy src to dst and replace pointers with tokens, dst and src may be identical, src must be the live data */
+extern void reloc_normalize(void* dst, const void* src, size_t size);
+/* replace tokens with pointers in place, ptr must be the live data */
+extern void reloc_denormalize(void* ptr, size_t size);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <string.h>
+#include <assert.h>
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+#define RELOC_TAG_MASK (0xFFFF000000000000ULL)
+#define RELOC_TAG (0x7E1C000000000000ULL)
+#define RELOC_INDEX_SHIFT (40)
+#define RELOC_IMAGE_WINDOW (256 * 1024 * 1024)
+#else
+#define RELOC_TAG_MASK (0xF0000000UL)
+#define RELOC_TAG (0xE0000000UL)
+#define RELOC_INDEX_SHIFT (24)
+#define RELOC_IMAGE_WINDOW (4 * 1024 * 1024)
+#endif
+#define RELOC_OFFSET_MASK ((((uintptr_t)1) << RELOC_INDEX_SHIFT) - 1)
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} reloc_range_t;
+
+typedef struct {
+    int num_ranges;
+    reloc_range_t ranges[RELOC_MAX_RANGES];
+    int num_excludes;
+    reloc_range_t excludes[RELOC_MAX_EXCLUDES];
+} reloc_state;
+static reloc_state rloc;
+
+void reloc_reset(void) {
+    memset(&rloc, 0, sizeof(rloc));
+}
+
+void reloc_add_range(const void* ptr, size_t size) {
+    assert(rloc.num_ranges < RELOC_MAX_RANGES);
+    assert(size <= RELOC_OFFSET_MASK);
+    const uintptr_t start = (uintptr_t)ptr;
+    /* several modules may register the same range, the token indices must not depend on that */
+    for (int i = 0; i < rloc.num_ranges; i++) {
+        if ((rloc.ranges[i].start == start) && (rloc.ranges[i].end == (start + size))) {
+            return;
+        }
+    }
+    if (rloc.num_ranges < RELOC_MAX_RANGES) {
+        reloc_range_t* r = &rloc.ranges[rloc.num_ranges++];
+        r->start = start;
+        r->end = start + size;
+    }
+}
+
+void reloc_add_image(const void* anchor) {
+    /* small integers are never relocated, the lowest 64 KB of the address space aren't mapped */
+    const uintptr_t addr = (uintptr_t)anchor;
+    const uintptr_t min_addr = 0x10000;
+    const uintptr_t start = (addr > (min_addr + RELOC_IMAGE_WINDOW)) ? (addr - RELOC_IMAGE_WINDOW) : min_addr;
+    reloc_add_range((const void*)start, (addr - start) + RELOC_IMAGE_WINDOW);
+}
+
+void reloc_exclude(const void* ptr, size_t size) {
+    assert(rloc.num_excludes < RELOC_MAX_EXCLUDES);
+    const uintptr_t start = (uintptr_t)ptr;
+    for (int i = 0; i < rloc.num_excludes; i++) {
+        if ((rloc.excludes[i].start == start) && (rloc.excludes[i].end == (start + size))) {
+            return;
+        }
+    }
+    if (rloc.num_excludes < RELOC_MAX_EXCLUDES) {
+        reloc_range_t* r = &rloc.excludes[rloc.num_excludes++];
+        r->start = start;
+        r->end = start + size;
+    }
+}
+
+/* number of words to skip if the word at 'addr' overlaps an excluded range, or 0 */
+static size_t _reloc_skip(uintptr_t addr) {
+    for (int i = 0; i < rloc.num_excludes; i++) {
+        const reloc_range_t* r = &rloc.excludes[i];
+        if (((addr + sizeof(uintptr_t)) > r->start) && (addr < r->end)) {
+            return (r->end - addr + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        }
+    }
+    return 0;
+}
+
+void reloc_normalize(void* dst, const void* src, size_t size) {
+    if (dst != src) {
+        memcpy(dst, src, size);
+    }
+    /* excluded ranges are checked against the live data, not the copy */
+    const uintptr_t src_addr = (uintptr_t)src;
+    uint8_t* ptr = (uint8_t*) dst;
+    const size_t num_words = size / sizeof(uintptr_t);
+    for (size_t i = 0; i < num_words; i++, ptr += sizeof(uintptr_t)) {
+        const size_t skip = _reloc_skip(src_addr + i * sizeof(uintptr_t));
+        if (skip > 0) {
+            i += skip - 1;
+            ptr += (skip - 1) * sizeof(uintptr_t);
+            continue;
+        }
+        uintptr_t val;
+        memcpy(&val, ptr, sizeof(val));
+        for (int ri = 0; ri < rloc.num_ranges; ri++) {
+            const reloc_range_t* r = &rloc.ranges[ri];
+            if ((val >= r->start) && (val < r->end)) {
+                val = RELOC_TAG | ((uintptr_t)ri << RELOC_INDEX_SHIFT) | (val - r->start);
+                memcpy(ptr, &val, sizeof(val));
+                break;
+            }
+        }
+    }
+}
+
+void reloc_denormalize(void* ptr, size_t size) {
+    uint8_t* p = (uint8_t*) ptr;
+    const size_t num_words = size / sizeof(uintptr_t);
+    for (size_t i = 0; i < num_words; i++, p += sizeof(uintptr_t)) {
+        const size_t skip = _reloc_skip((uintptr_t)p);
+        if (skip > 0) {
+            i += skip - 1;
+            p += (skip - 1) * sizeof(uintptr_t);
+            continue;
+        }
+        uintptr_t val;
+        memcpy(&val, p, sizeof(val));
+        if ((val & RELOC_TAG_MASK) == RELOC_TAG) {
+            const int ri = (int)((val & ~RELOC_TAG_MASK) >> RELOC_INDEX_SHIFT);
+            if (ri < rloc.num_ranges) {
+                val = rloc.ranges[ri].start + (val & RELOC_OFFSET_MASK);
+                memcpy(p, &val, sizeof(val));
+            }
+        }
+    }
+}
+#endif /* COMMON_IMPL */
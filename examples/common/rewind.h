@@ -0,0 +1,457 @@
+#pragma once
+/*
+    Memory-bounded rewind history for the example emulators.
+
+    The emulator state is described by up to REWIND_MAX_REGIONS memory
+    regions (usually the system struct and the visible part of the
+    framebuffer). rewind_capture() is called once per frame and stores
+    the difference to the previous frame as an XOR delta, compressed
+    with a simple zero-run-length encoding. Every 'keyframe_interval'
+    frames a full keyframe is stored instead.
+
+    All captured frames live in a fixed-size ring buffer of 'max_bytes'.
+    When the ring is full, the oldest keyframe and its deltas are
+    discarded, so that the oldest entry is always a keyframe.
+
+    rewind_step_back() restores the previous frame into the regions.
+    Undoing a delta is just another XOR with the same delta, so this
+    costs about as much as a capture. Only when the newest entry is a
+    keyframe does the previous state need to be rebuilt from the
+    preceding keyframe and its deltas.
+
+    Encoding (for keyframes and deltas alike) is a sequence of
+    [zero_run][literal_len][literal bytes...] chunks with the lengths
+    as LEB128 varints, runs are detected in 8-byte words.
+*/
+
+#define REWIND_MAX_REGIONS (4)
+#define REWIND_MAX_RING_SIZE (0x80000000U)  /* 2 GB, ring offsets are 32 bits */
+
+typedef struct {
+    int keyframe_interval;      /* store a keyframe every N frames (default: 60) */
+    uint32_t max_bytes;         /* memory cap for the history ring (default: 64 MB, max: REWIND_MAX_RING_SIZE) */
+} rewind_desc_t;
+
+typedef struct {
+    uint32_t num_frames;        /* number of frames currently in the history */
+    uint32_t used_bytes;        /* number of bytes used by those frames */
+    uint32_t max_bytes;         /* size of the history ring */
+    uint32_t state_size;        /* uncompressed size of a single frame */
+    uint64_t captured_frames;   /* total number of captured frames */
+    uint64_t captured_bytes;    /* total number of compressed bytes */
+    double avg_capture_ms;      /* average time spent in rewind_capture() */
+    double max_capture_ms;      /* slowest call to rewind_capture() */
+} rewind_stats_t;
+
+/* initialize the rewind history, allocates the history ring */
+extern void rewind_init(const rewind_desc_t* desc);
+/* free all memory */
+extern void rewind_shutdown(void);
+/* return true if rewind_init() was called */
+extern bool rewind_enabled(void);
+/* add a memory region that is part of the emulator state */
+extern void rewind_add_region(void* ptr, uint32_t size);
+/* discard the history (e.g. after a reboot or loading a snapshot) */
+extern void rewind_reset(void);
+/* capture the current state, call once per frame after the emulator has been ticked */
+extern void rewind_capture(void);
+/* restore the previous frame, returns false if the history is exhausted */
+extern bool rewind_step_back(void);
+/* get statistics */
+extern rewind_stats_t rewind_stats(void);
+/* print statistics to stdout */
+extern void rewind_print_stats(void);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include "sokol_time.h"
+
+#define REWIND_MAX_ENTRIES (1<<16)
+/* the entry table is sized for entries of this average size, smaller frames evict older frames earlier */
+#define REWIND_MIN_ENTRY_SIZE (256)
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL (60)
+#define REWIND_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    bool keyframe;
+} rewind_entry_t;
+
+static struct {
+    bool valid;
+    int keyframe_interval;
+    int frames_since_keyframe;
+    int num_regions;
+    struct {
+        uint8_t* ptr;
+        uint32_t size;
+    } regions[REWIND_MAX_REGIONS];
+    uint32_t state_size;
+    uint8_t* prev;              /* the state of the newest history entry */
+    uint8_t* scratch;           /* encoding buffer, large enough for the worst case */
+    uint8_t* ring;
+    uint32_t ring_size;
+    uint32_t head;              /* ring offset where the next entry goes */
+    uint32_t used_bytes;
+    uint32_t first_entry;       /* index of the oldest entry */
+    uint32_t num_entries;
+    uint32_t max_entries;
+    rewind_entry_t* entries;
+    uint64_t captured_frames;
+    uint64_t captured_bytes;
+    uint64_t capture_ticks;
+    uint64_t max_capture_ticks;
+} rwnd;
+
+void rewind_init(const rewind_desc_t* desc) {
+    assert(desc);
+    rewind_shutdown();
+    rwnd.keyframe_interval = desc->keyframe_interval > 0 ? desc->keyframe_interval : REWIND_DEFAULT_KEYFRAME_INTERVAL;
+    rwnd.ring_size = desc->max_bytes > 0 ? desc->max_bytes : REWIND_DEFAULT_MAX_BYTES;
+    if (rwnd.ring_size > REWIND_MAX_RING_SIZE) {
+        rwnd.ring_size = REWIND_MAX_RING_SIZE;
+    }
+    rwnd.max_entries = rwnd.ring_size / REWIND_MIN_ENTRY_SIZE;
+    if (rwnd.max_entries < 2) {
+        rwnd.max_entries = 2;
+    }
+    else if (rwnd.max_entries > REWIND_MAX_ENTRIES) {
+        rwnd.max_entries = REWIND_MAX_ENTRIES;
+    }
+    rwnd.ring = (uint8_t*) malloc(rwnd.ring_size);
+    rwnd.entries = (rewind_entry_t*) malloc(rwnd.max_entries * sizeof(rewind_entry_t));
+    rwnd.valid = rwnd.ring && rwnd.entries;
+    if (!rwnd.valid) {
+        rewind_shutdown();
+    }
+}
+
+void rewind_shutdown(void) {
+    free(rwnd.ring);
+    free(rwnd.entries);
+    free(rwnd.prev);
+    free(rwnd.scratch);
+    memset(&rwnd, 0, sizeof(rwnd));
+}
+
+bool rewind_enabled(void) {
+    return rwnd.valid;
+}
+
+void rewind_reset(void) {
+    rwnd.head = 0;
+    rwnd.used_bytes = 0;
+    rwnd.first_entry = 0;
+    rwnd.num_entries = 0;
+    rwnd.frames_since_keyframe = 0;
+}
+
+void rewind_add_region(void* ptr, uint32_t size) {
+    assert(ptr && (size > 0));
+    if (!rwnd.valid || (rwnd.num_regions >= REWIND_MAX_REGIONS)) {
+        return;
+    }
+    rwnd.regions[rwnd.num_regions].ptr = (uint8_t*) ptr;
+    rwnd.regions[rwnd.num_regions].size = size;
+    rwnd.num_regions++;
+    rwnd.state_size += size;
+    free(rwnd.prev);
+    free(rwnd.scratch);
+    rwnd.prev = (uint8_t*) malloc(rwnd.state_size);
+    /* worst case is alternating zero- and literal-words (3 bytes overhead per 16 bytes) */
+    rwnd.scratch = (uint8_t*) malloc(rwnd.state_size + (rwnd.state_size / 4) + 16 * REWIND_MAX_REGIONS);
+    if (!rwnd.prev || !rwnd.scratch) {
+        rewind_shutdown();
+        return;
+    }
+    rewind_reset();
+}
+
+static uint8_t* _rewind_put_varint(uint8_t* dst, uint32_t val) {
+    while (val >= 0x80) {
+        *dst++ = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    *dst++ = (uint8_t)val;
+    return dst;
+}
+
+static const uint8_t* _rewind_get_varint(const uint8_t* src, uint32_t* val) {
+    uint32_t res = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *src++;
+        res |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    *val = res;
+    return src;
+}
+
+static inline uint64_t _rewind_load64(const uint8_t* ptr) {
+    uint64_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+/* Encode the XOR of cur and base, if base is null, encode cur as is.
+   If base is not null it will be updated to the content of cur.
+   Runs are detected on 8-byte words, any trailing bytes are literals.
+*/
+static uint8_t* _rewind_encode(uint8_t* dst, const uint8_t* cur, uint8_t* base, uint32_t size) {
+    const uint32_t words_end = size & ~7U;
+    uint32_t pos = 0;
+    while (pos < size) {
+        const uint32_t zero_start = pos;
+        if (base) {
+            while ((pos < words_end) && (_rewind_load64(cur + pos) == _rewind_load64(base + pos))) {
+                pos += 8;
+            }
+        }
+        else {
+            while ((pos < words_end) && (0 == _rewind_load64(cur + pos))) {
+                pos += 8;
+            }
+        }
+        const uint32_t lit_start = pos;
+        if (base) {
+            while ((pos < words_end) && (_rewind_load64(cur + pos) != _rewind_load64(base + pos))) {
+                pos += 8;
+            }
+        }
+        else {
+            while ((pos < words_end) && (0 != _rewind_load64(cur + pos))) {
+                pos += 8;
+            }
+        }
+        if (pos == words_end) {
+            pos = size;
+        }
+        const uint32_t lit_len = pos - lit_start;
+        dst = _rewind_put_varint(dst, lit_start - zero_start);
+        dst = _rewind_put_varint(dst, lit_len);
+        if (base) {
+            for (uint32_t i = 0; i < lit_len; i++) {
+                dst[i] = cur[lit_start + i] ^ base[lit_start + i];
+            }
+            memcpy(base + lit_start, cur + lit_start, lit_len);
+        }
+        else {
+            memcpy(dst, cur + lit_start, lit_len);
+        }
+        dst += lit_len;
+    }
+    return dst;
+}
+
+/* decode a keyframe (overwrite dst) or delta (XOR into dst) */
+static const uint8_t* _rewind_decode(const uint8_t* src, uint8_t* dst, uint32_t size, bool keyframe) {
+    uint32_t pos = 0;
+    while (pos < size) {
+        uint32_t zero_run, lit_len;
+        src = _rewind_get_varint(src, &zero_run);
+        src = _rewind_get_varint(src, &lit_len);
+        assert((pos + zero_run + lit_len) <= size);
+        if (keyframe) {
+            memset(dst + pos, 0, zero_run);
+            pos += zero_run;
+            memcpy(dst + pos, src, lit_len);
+        }
+        else {
+            pos += zero_run;
+            for (uint32_t i = 0; i < lit_len; i++) {
+                dst[pos + i] ^= src[i];
+            }
+        }
+        pos += lit_len;
+        src += lit_len;
+    }
+    return src;
+}
+
+static void _rewind_decode_entry(const rewind_entry_t* e, uint8_t* state) {
+    const uint8_t* src = rwnd.ring + e->offset;
+    uint32_t offset = 0;
+    for (int i = 0; i < rwnd.num_regions; i++) {
+        src = _rewind_decode(src, state + offset, rwnd.regions[i].size, e->keyframe);
+        offset += rwnd.regions[i].size;
+    }
+    assert(src == (rwnd.ring + e->offset + e->size));
+}
+
+static inline rewind_entry_t* _rewind_entry(uint32_t i) {
+    return &rwnd.entries[(rwnd.first_entry + i) % rwnd.max_entries];
+}
+
+/* discard the oldest entry and the deltas that depend on it */
+static void _rewind_evict(void) {
+    do {
+        rwnd.used_bytes -= _rewind_entry(0)->size;
+        rwnd.first_entry = (rwnd.first_entry + 1) % rwnd.max_entries;
+        rwnd.num_entries--;
+    } while ((rwnd.num_entries > 0) && !_rewind_entry(0)->keyframe);
+}
+
+/* find a contiguous ring area for a new entry, evict old entries as needed */
+static bool _rewind_alloc(uint32_t size, uint32_t* out_offset) {
+    if (size > rwnd.ring_size) {
+        return false;
+    }
+    if (rwnd.num_entries == rwnd.max_entries) {
+        _rewind_evict();
+    }
+    for (;;) {
+        if (rwnd.num_entries == 0) {
+            rwnd.head = 0;
+            break;
+        }
+        const uint32_t tail = _rewind_entry(0)->offset;
+        if (rwnd.head > tail) {
+            /* free space at the end and at the start of the ring */
+            if ((rwnd.head + size) <= rwnd.ring_size) {
+                break;
+            }
+            else if (size <= tail) {
+                rwnd.head = 0;
+                break;
+            }
+        }
+        else if ((rwnd.head + size) <= tail) {
+            /* ring has wrapped around, free space is between head and tail */
+            break;
+        }
+        _rewind_evict();
+    }
+    *out_offset = rwnd.head;
+    rwnd.head += size;
+    return true;
+}
+
+void rewind_capture(void) {
+    if (!rwnd.valid || (0 == rwnd.num_regions)) {
+        return;
+    }
+    const uint64_t start = stm_now();
+    const bool keyframe = (0 == rwnd.num_entries) || (rwnd.frames_since_keyframe >= rwnd.keyframe_interval);
+    uint8_t* dst = rwnd.scratch;
+    uint32_t offset = 0;
+    for (int i = 0; i < rwnd.num_regions; i++) {
+        const uint8_t* cur = rwnd.regions[i].ptr;
+        const uint32_t size = rwnd.regions[i].size;
+        if (keyframe) {
+            dst = _rewind_encode(dst, cur, 0, size);
+            memcpy(rwnd.prev + offset, cur, size);
+        }
+        else {
+            dst = _rewind_encode(dst, cur, rwnd.prev + offset, size);
+        }
+        offset += size;
+    }
+    const uint32_t size = (uint32_t)(dst - rwnd.scratch);
+    uint32_t ring_offset;
+    if (!_rewind_alloc(size, &ring_offset)) {
+        /* a single frame doesn't fit into the ring */
+        rewind_reset();
+        return;
+    }
+    memcpy(rwnd.ring + ring_offset, rwnd.scratch, size);
+    rewind_entry_t* e = _rewind_entry(rwnd.num_entries++);
+    e->offset = ring_offset;
+    e->size = size;
+    e->keyframe = keyframe;
+    rwnd.used_bytes += size;
+    rwnd.frames_since_keyframe = keyframe ? 1 : rwnd.frames_since_keyframe + 1;
+
+    rwnd.captured_frames++;
+    rwnd.captured_bytes += size;
+    const uint64_t ticks = stm_since(start);
+    rwnd.capture_ticks += ticks;
+    if (ticks > rwnd.max_capture_ticks) {
+        rwnd.max_capture_ticks = ticks;
+    }
+}
+
+bool rewind_step_back(void) {
+    if (!rwnd.valid || (rwnd.num_entries < 2)) {
+        return false;
+    }
+    const uint32_t newest = rwnd.num_entries - 1;
+    rewind_entry_t* e = _rewind_entry(newest);
+    if (!e->keyframe) {
+        /* XOR-ing the delta again yields the previous state */
+        _rewind_decode_entry(e, rwnd.prev);
+    }
+    else {
+        /* rebuild from the previous keyframe and its deltas */
+        uint32_t key = newest;
+        do {
+            if (key == 0) {
+                return false;
+            }
+            key--;
+        } while (!_rewind_entry(key)->keyframe);
+        for (uint32_t i = key; i < newest; i++) {
+            _rewind_decode_entry(_rewind_entry(i), rwnd.prev);
+        }
+    }
+    rwnd.used_bytes -= e->size;
+    rwnd.head = e->offset;
+    rwnd.num_entries--;
+
+    /* frames since last keyframe, so the keyframe cadence continues correctly */
+    rwnd.frames_since_keyframe = 0;
+    for (uint32_t i = rwnd.num_entries; i-- > 0;) {
+        rwnd.frames_since_keyframe++;
+        if (_rewind_entry(i)->keyframe) {
+            break;
+        }
+    }
+
+    /* write the restored state back into the emulator */
+    uint32_t offset = 0;
+    for (int i = 0; i < rwnd.num_regions; i++) {
+        memcpy(rwnd.regions[i].ptr, rwnd.prev + offset, rwnd.regions[i].size);
+        offset += rwnd.regions[i].size;
+    }
+    return true;
+}
+
+rewind_stats_t rewind_stats(void) {
+    rewind_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.num_frames = rwnd.num_entries;
+    stats.used_bytes = rwnd.used_bytes;
+    stats.max_bytes = rwnd.ring_size;
+    stats.state_size = rwnd.state_size;
+    stats.captured_frames = rwnd.captured_frames;
+    stats.captured_bytes = rwnd.captured_bytes;
+    if (rwnd.captured_frames > 0) {
+        stats.avg_capture_ms = stm_ms(rwnd.capture_ticks) / (double)rwnd.captured_frames;
+    }
+    stats.max_capture_ms = stm_ms(rwnd.max_capture_ticks);
+    return stats;
+}
+
+void rewind_print_stats(void) {
+    if (!rwnd.valid) {
+        return;
+    }
+    const rewind_stats_t stats = rewind_stats();
+    const double bytes_per_frame = stats.captured_frames > 0 ? ((double)stats.captured_bytes / (double)stats.captured_frames) : 0.0;
+    printf("rewind: %u frames in history (%.2f of %.2f MB), state size: %u bytes\n",
+        stats.num_frames,
+        stats.used_bytes / (1024.0 * 1024.0),
+        stats.max_bytes / (1024.0 * 1024.0),
+        stats.state_size);
+    printf("rewind: %.1f bytes/frame, capture: %.3f ms avg, %.3f ms max\n",
+        bytes_per_frame,
+        stats.avg_capture_ms,
+        stats.max_capture_ms);
+}
+#endif /* COMMON_IMPL */
@@ -0,0 +1,263 @@
+#pragma once
+/*
+    Save states for the example emulators.
+
+    Like rewind.h, the system state is described by memory regions
+    (usually the system struct and the visible part of the framebuffer).
+    savestate_save() stores the state in a memory slot, and if a path
+    was provided, in a file. savestate_load() restores the state from
+    the memory slot, or from the file if nothing has been saved yet.
+
+    Regions which contain pointers are passed through reloc.h, so that
+    a save state file can be loaded by another process of the same
+    executable (guest memory inside those regions must be excluded with
+    reloc_exclude()). The file starts with a header ("CHIPSSAV", version,
+    layout key), the key is a hash over the system name, the region
+    sizes and the executable layout, so that save states of a different
+    build or system are rejected instead of being loaded into a
+    mismatching struct layout.
+
+    All buffers are allocated in savestate_add_region(), saving and
+    loading doesn't allocate memory. The regions are compressed with
+    the same zero-run-length encoding as rewind.h keyframes.
+
+    File format: "CHIPSSAV", version (u32), key (u64), payload size (u32),
+    payload, XXH64 hash of the payload (u64).
+*/
+#include "reloc.h"
+#include "gfx.h"
+#include "rewind.h"
+#include "statehash.h"
+
+#define SAVESTATE_MAX_REGIONS (4)
+
+typedef struct {
+    const char* system;         /* system name, part of the layout key */
+    const void* anchor;         /* an address inside the executable's static data, e.g. the system struct */
+    const char* path;           /* optional save state file */
+} savestate_desc_t;
+
+/* initialize save states */
+extern void savestate_init(const savestate_desc_t* desc);
+/* free all memory */
+extern void savestate_shutdown(void);
+/* add a memory region that is part of the emulator state, 'relocate' if it contains pointers */
+extern void savestate_add_region(void* ptr, uint32_t size, bool relocate);
+/* save the current state into the memory slot and the file */
+extern bool savestate_save(void);
+/* load the state from the memory slot, or the file */
+extern bool savestate_load(void);
+/* true if the memory slot contains a state */
+extern bool savestate_valid(void);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sokol_time.h"
+
+#define SAVESTATE_VERSION (3)
+#define SAVESTATE_HEADER_SIZE (8 + 4 + 8 + 4)
+
+typedef struct {
+    bool enabled;
+    bool valid;
+    const char* path;
+    uint64_t key;
+    int num_regions;
+    struct {
+        uint8_t* ptr;
+        uint32_t size;
+        bool relocate;
+    } regions[SAVESTATE_MAX_REGIONS];
+    uint32_t state_size;
+    uint8_t* scratch;           /* normalized copy of a relocated region */
+    uint32_t scratch_size;
+    uint8_t* slot;              /* encoded state */
+    uint32_t slot_capacity;
+    uint32_t slot_size;
+} savestate_state;
+static savestate_state svst;
+
+void savestate_init(const savestate_desc_t* desc) {
+    savestate_shutdown();
+    svst.enabled = true;
+    svst.path = desc->path;
+    /* the framebuffer is on the heap, the system structs point into it (registered
+       before the image window, which may contain the heap and would match first) */
+    reloc_add_range(gfx_framebuffer(), (size_t)gfx_framebuffer_size());
+    reloc_add_image(desc->anchor);
+    const uintptr_t layout = (uintptr_t)desc->anchor - (uintptr_t)savestate_init;
+    svst.key = statehash_xxh64(&layout, sizeof(layout), 0);
+    svst.key = statehash_xxh64(desc->system, strlen(desc->system), svst.key);
+}
+
+void savestate_shutdown(void) {
+    free(svst.scratch);
+    free(svst.slot);
+    memset(&svst, 0, sizeof(svst));
+}
+
+bool savestate_valid(void) {
+    return svst.valid;
+}
+
+void savestate_add_region(void* ptr, uint32_t size, bool relocate) {
+    if (!svst.enabled || (svst.num_regions >= SAVESTATE_MAX_REGIONS)) {
+        return;
+    }
+    svst.regions[svst.num_regions].ptr = (uint8_t*) ptr;
+    svst.regions[svst.num_regions].size = size;
+    svst.regions[svst.num_regions].relocate = relocate;
+    svst.num_regions++;
+    svst.state_size += size;
+    svst.key = statehash_xxh64(&size, sizeof(size), svst.key);
+    if (relocate && (size > svst.scratch_size)) {
+        free(svst.scratch);
+        svst.scratch = (uint8_t*) malloc(size);
+        svst.scratch_size = size;
+    }
+    /* worst case of the encoding, plus the file header and trailing hash */
+    free(svst.slot);
+    svst.slot_capacity = svst.state_size + (svst.state_size / 4) + 16 * SAVESTATE_MAX_REGIONS + SAVESTATE_HEADER_SIZE + 8;
+    svst.slot = (uint8_t*) malloc(svst.slot_capacity);
+    svst.valid = false;
+    if (!svst.slot || (relocate && !svst.scratch)) {
+        /* out of memory, disable save states */
+        savestate_shutdown();
+    }
+}
+
+static uint8_t* _savestate_put(uint8_t* dst, const void* src, size_t size) {
+    memcpy(dst, src, size);
+    return dst + size;
+}
+
+/* decode a zero-run-length encoded region, with bounds checks, since the data may come from a file */
+static const uint8_t* _savestate_decode(const uint8_t* src, const uint8_t* end, uint8_t* dst, uint32_t size) {
+    uint32_t pos = 0;
+    while (pos < size) {
+        uint32_t len[2] = { 0, 0 };
+        for (int i = 0; i < 2; i++) {
+            int shift = 0;
+            uint8_t b;
+            do {
+                if ((src >= end) || (shift > 28)) {
+                    return 0;
+                }
+                b = *src++;
+                len[i] |= (uint32_t)(b & 0x7F) << shift;
+                shift += 7;
+            } while (b & 0x80);
+        }
+        if ((len[0] > (size - pos)) || (len[1] > (size - pos - len[0])) || (len[1] > (uint32_t)(end - src))) {
+            return 0;
+        }
+        memset(dst + pos, 0, len[0]);
+        pos += len[0];
+        memcpy(dst + pos, src, len[1]);
+        pos += len[1];
+        src += len[1];
+    }
+    return src;
+}
+
+bool savestate_save(void) {
+    if (!svst.enabled || (0 == svst.num_regions)) {
+        return false;
+    }
+    const uint64_t start = stm_now();
+    uint8_t* dst = svst.slot + SAVESTATE_HEADER_SIZE;
+    for (int i = 0; i < svst.num_regions; i++) {
+        const uint8_t* src = svst.regions[i].ptr;
+        if (svst.regions[i].relocate) {
+            reloc_normalize(svst.scratch, src, svst.regions[i].size);
+            src = svst.scratch;
+        }
+        dst = _rewind_encode(dst, src, 0, svst.regions[i].size);
+    }
+    const uint32_t payload_size = (uint32_t)(dst - (svst.slot + SAVESTATE_HEADER_SIZE));
+    const uint64_t hash = statehash_xxh64(svst.slot + SAVESTATE_HEADER_SIZE, payload_size, 0);
+    const uint32_t version = SAVESTATE_VERSION;
+    uint8_t* hdr = svst.slot;
+    hdr = _savestate_put(hdr, "CHIPSSAV", 8);
+    hdr = _savestate_put(hdr, &version, sizeof(version));
+    hdr = _savestate_put(hdr, &svst.key, sizeof(svst.key));
+    _savestate_put(hdr, &payload_size, sizeof(payload_size));
+    dst = _savestate_put(dst, &hash, sizeof(hash));
+    svst.slot_size = (uint32_t)(dst - svst.slot);
+    svst.valid = true;
+    const double ms = stm_ms(stm_since(start));
+    bool success = true;
+    if (svst.path) {
+        FILE* fp = fopen(svst.path, "wb");
+        success = fp && (1 == fwrite(svst.slot, svst.slot_size, 1, fp));
+        if (fp) {
+            success &= (0 == fclose(fp));
+        }
+    }
+    printf("savestate: saved %u bytes (%u uncompressed) in %.3f ms\n", svst.slot_size, svst.state_size, ms);
+    return success;
+}
+
+/* read the file into the memory slot */
+static bool _savestate_read_file(void) {
+    FILE* fp = fopen(svst.path, "rb");
+    if (!fp) {
+        return false;
+    }
+    svst.slot_size = (uint32_t) fread(svst.slot, 1, svst.slot_capacity, fp);
+    /* a file which doesn't fit into the slot can't be valid */
+    const bool fits = (EOF == fgetc(fp));
+    fclose(fp);
+    return fits;
+}
+
+bool savestate_load(void) {
+    if (!svst.enabled || (0 == svst.num_regions)) {
+        return false;
+    }
+    if (!svst.valid) {
+        if (!svst.path || !_savestate_read_file()) {
+            return false;
+        }
+    }
+    const uint64_t start = stm_now();
+    /* validate the header and payload */
+    uint32_t version, payload_size;
+    uint64_t key, hash;
+    const uint8_t* src = svst.slot;
+    if ((svst.slot_size < (SAVESTATE_HEADER_SIZE + 8)) || (0 != memcmp(src, "CHIPSSAV", 8))) {
+        return false;
+    }
+    memcpy(&version, src + 8, sizeof(version));
+    memcpy(&key, src + 12, sizeof(key));
+    memcpy(&payload_size, src + 20, sizeof(payload_size));
+    if ((version != SAVESTATE_VERSION) || (key != svst.key) || (payload_size != (svst.slot_size - SAVESTATE_HEADER_SIZE - 8))) {
+        printf("savestate: state doesn't match this system or version\n");
+        return false;
+    }
+    src += SAVESTATE_HEADER_SIZE;
+    const uint8_t* end = src + payload_size;
+    memcpy(&hash, end, sizeof(hash));
+    if (hash != statehash_xxh64(src, payload_size, 0)) {
+        printf("savestate: state is corrupted\n");
+        return false;
+    }
+    /* decode directly into the regions */
+    for (int i = 0; i < svst.num_regions; i++) {
+        src = _savestate_decode(src, end, svst.regions[i].ptr, svst.regions[i].size);
+        if (!src) {
+            /* can only happen if a valid hash was computed over bad data */
+            return false;
+        }
+        if (svst.regions[i].relocate) {
+            reloc_denormalize(svst.regions[i].ptr, svst.regions[i].size);
+        }
+    }
+    svst.valid = true;
+    printf("savestate: loaded in %.3f ms\n", stm_ms(stm_since(start)));
+    return true;
+}
+#endif /* COMMON_IMPL */
@@ -0,0 +1,343 @@
+#pragma once
+/*
+    Per-frame state hashing for determinism checks.
+
+    The emulator state is described by named memory regions (for instance
+    the system struct, RAM and the framebuffer). statehash_frame() is
+    called once per emulated frame and computes an XXH64 hash for each
+    component (all regions with the same name are hashed together).
+    Regions which contain pointers are passed through reloc_normalize()
+    first, so that the hashes don't depend on where the process lives in
+    memory (the reloc ranges must be registered by the caller).
+
+    With a record path, the per-frame hashes are written to a hash stream
+    file. With a compare path, the hashes are compared against a previously
+    recorded stream (of a run with identical input, e.g. a journal replay),
+    and the first diverging frame and the differing components are printed
+    to stdout.
+
+    Hash stream format: "CHIPSHSH", version (u32), number of
+    components (u32), component names (u8 length + chars), followed by
+    one u64 hash per component and frame. All numbers are little endian.
+*/
+
+#define STATEHASH_MAX_REGIONS (8)
+#define STATEHASH_MAX_COMPONENTS (8)
+#define STATEHASH_MAX_NAME_LENGTH (15)
+
+typedef struct {
+    const char* record_path;    /* write the hash stream to this file, or 0 */
+    const char* compare_path;   /* compare against this hash stream, or 0 */
+} statehash_desc_t;
+
+/* start hashing, returns false if a file couldn't be opened */
+extern bool statehash_init(const statehash_desc_t* desc);
+/* close the hash stream files */
+extern void statehash_shutdown(void);
+/* true if statehash_init() was called successfully */
+extern bool statehash_enabled(void);
+/* add a named memory region, set 'relocate' if the region may contain pointers */
+extern void statehash_add_region(const char* name, const void* ptr, uint32_t size, bool relocate);
+/* hash the current state, call once per emulated frame */
+extern void statehash_frame(void);
+/* true if a divergence against the compare stream was detected */
+extern bool statehash_diverged(void);
+/* print statistics to stdout */
+extern void statehash_print_stats(void);
+/* XXH64 hash function */
+extern uint64_t statehash_xxh64(const void* ptr, size_t size, uint64_t seed);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sokol_time.h"
+
+#define STATEHASH_VERSION (1)
+
+#define _STATEHASH_P1 (11400714785074694791ULL)
+#define _STATEHASH_P2 (14029467366897019727ULL)
+#define _STATEHASH_P3 (1609587929392839161ULL)
+#define _STATEHASH_P4 (9650029242287828579ULL)
+#define _STATEHASH_P5 (2870177450012600261ULL)
+
+typedef struct {
+    int component;
+    const uint8_t* ptr;
+    uint32_t size;
+    bool relocate;
+} statehash_region_t;
+
+typedef struct {
+    bool enabled;
+    bool diverged;
+    FILE* record_fp;
+    FILE* compare_fp;
+    int num_regions;
+    statehash_region_t regions[STATEHASH_MAX_REGIONS];
+    int num_components;
+    char names[STATEHASH_MAX_COMPONENTS][STATEHASH_MAX_NAME_LENGTH + 1];
+    bool header_done;
+    uint8_t* scratch;
+    uint32_t scratch_size;
+    uint64_t num_frames;
+    uint64_t diverged_frame;
+    double total_ms;
+} statehash_state;
+static statehash_state shsh;
+
+static uint64_t _statehash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t _statehash_read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t _statehash_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t _statehash_round(uint64_t acc, uint64_t input) {
+    acc += input * _STATEHASH_P2;
+    acc = _statehash_rotl(acc, 31);
+    return acc * _STATEHASH_P1;
+}
+
+static uint64_t _statehash_merge(uint64_t acc, uint64_t val) {
+    acc ^= _statehash_round(0, val);
+    return acc * _STATEHASH_P1 + _STATEHASH_P4;
+}
+
+/* NOTE: assumes a little-endian host, like the rest of the emulators */
+uint64_t statehash_xxh64(const void* ptr, size_t size, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*) ptr;
+    const uint8_t* end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        const uint8_t* limit = end - 32;
+        uint64_t v1 = seed + _STATEHASH_P1 + _STATEHASH_P2;
+        uint64_t v2 = seed + _STATEHASH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - _STATEHASH_P1;
+        do {
+            v1 = _statehash_round(v1, _statehash_read64(p));
+            v2 = _statehash_round(v2, _statehash_read64(p + 8));
+            v3 = _statehash_round(v3, _statehash_read64(p + 16));
+            v4 = _statehash_round(v4, _statehash_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = _statehash_rotl(v1, 1) + _statehash_rotl(v2, 7) + _statehash_rotl(v3, 12) + _statehash_rotl(v4, 18);
+        h = _statehash_merge(h, v1);
+        h = _statehash_merge(h, v2);
+        h = _statehash_merge(h, v3);
+        h = _statehash_merge(h, v4);
+    }
+    else {
+        h = seed + _STATEHASH_P5;
+    }
+    h += (uint64_t) size;
+    while ((p + 8) <= end) {
+        h ^= _statehash_round(0, _statehash_read64(p));
+        h = _statehash_rotl(h, 27) * _STATEHASH_P1 + _STATEHASH_P4;
+        p += 8;
+    }
+    if ((p + 4) <= end) {
+        h ^= (uint64_t)_statehash_read32(p) * _STATEHASH_P1;
+        h = _statehash_rotl(h, 23) * _STATEHASH_P2 + _STATEHASH_P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * _STATEHASH_P5;
+        h = _statehash_rotl(h, 11) * _STATEHASH_P1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= _STATEHASH_P2;
+    h ^= h >> 29;
+    h *= _STATEHASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void _statehash_write_u32(FILE* fp, uint32_t val) {
+    uint8_t buf[4] = { (uint8_t)val, (uint8_t)(val>>8), (uint8_t)(val>>16), (uint8_t)(val>>24) };
+    fwrite(buf, 1, sizeof(buf), fp);
+}
+
+static bool _statehash_read_u32(FILE* fp, uint32_t* val) {
+    uint8_t buf[4];
+    if (sizeof(buf) != fread(buf, 1, sizeof(buf), fp)) {
+        return false;
+    }
+    *val = buf[0] | (buf[1]<<8) | (buf[2]<<16) | ((uint32_t)buf[3]<<24);
+    return true;
+}
+
+bool statehash_init(const statehash_desc_t* desc) {
+    statehash_shutdown();
+    if (desc->record_path) {
+        shsh.record_fp = fopen(desc->record_path, "wb");
+        if (!shsh.record_fp) {
+            return false;
+        }
+    }
+    if (desc->compare_path) {
+        shsh.compare_fp = fopen(desc->compare_path, "rb");
+        if (!shsh.compare_fp) {
+            statehash_shutdown();
+            return false;
+        }
+    }
+    shsh.enabled = true;
+    return true;
+}
+
+void statehash_shutdown(void) {
+    if (shsh.record_fp) {
+        fclose(shsh.record_fp);
+    }
+    if (shsh.compare_fp) {
+        fclose(shsh.compare_fp);
+    }
+    if (shsh.scratch) {
+        free(shsh.scratch);
+    }
+    memset(&shsh, 0, sizeof(shsh));
+}
+
+bool statehash_enabled(void) {
+    return shsh.enabled;
+}
+
+bool statehash_diverged(void) {
+    return shsh.diverged;
+}
+
+void statehash_add_region(const char* name, const void* ptr, uint32_t size, bool relocate) {
+    if (!shsh.enabled || shsh.header_done || (shsh.num_regions >= STATEHASH_MAX_REGIONS)) {
+        return;
+    }
+    int comp = 0;
+    while ((comp < shsh.num_components) && (0 != strcmp(shsh.names[comp], name))) {
+        comp++;
+    }
+    if (comp == shsh.num_components) {
+        if (comp >= STATEHASH_MAX_COMPONENTS) {
+            return;
+        }
+        snprintf(shsh.names[comp], sizeof(shsh.names[comp]), "%s", name);
+        shsh.num_components++;
+    }
+    statehash_region_t* r = &shsh.regions[shsh.num_regions++];
+    r->component = comp;
+    r->ptr = (const uint8_t*) ptr;
+    r->size = size;
+    r->relocate = relocate;
+    if (relocate && (size > shsh.scratch_size)) {
+        shsh.scratch = (uint8_t*) realloc(shsh.scratch, size);
+        shsh.scratch_size = size;
+    }
+}
+
+/* write the stream header, and check the compare stream's header */
+static void _statehash_header(void) {
+    shsh.header_done = true;
+    if (shsh.record_fp) {
+        fwrite("CHIPSHSH", 1, 8, shsh.record_fp);
+        _statehash_write_u32(shsh.record_fp, STATEHASH_VERSION);
+        _statehash_write_u32(shsh.record_fp, (uint32_t)shsh.num_components);
+        for (int i = 0; i < shsh.num_components; i++) {
+            const uint8_t len = (uint8_t) strlen(shsh.names[i]);
+            fwrite(&len, 1, 1, shsh.record_fp);
+            fwrite(shsh.names[i], 1, len, shsh.record_fp);
+        }
+    }
+    if (shsh.compare_fp) {
+        char magic[8];
+        uint32_t version = 0, num_components = 0;
+        bool valid = (8 == fread(magic, 1, 8, shsh.compare_fp)) && (0 == memcmp(magic, "CHIPSHSH", 8)) &&
+                     _statehash_read_u32(shsh.compare_fp, &version) && (version == STATEHASH_VERSION) &&
+                     _statehash_read_u32(shsh.compare_fp, &num_components) &&
+                     (num_components == (uint32_t)shsh.num_components);
+        for (int i = 0; valid && (i < shsh.num_components); i++) {
+            uint8_t len = 0;
+            char name[256];
+            valid = (1 == fread(&len, 1, 1, shsh.compare_fp)) && (len == fread(name, 1, len, shsh.compare_fp)) &&
+                    (len == strlen(shsh.names[i])) && (0 == memcmp(name, shsh.names[i], len));
+        }
+        if (!valid) {
+            printf("statehash: compare stream doesn't match the state layout, not comparing\n");
+            fclose(shsh.compare_fp);
+            shsh.compare_fp = 0;
+        }
+    }
+}
+
+void statehash_frame(void) {
+    if (!shsh.enabled) {
+        return;
+    }
+    if (!shsh.header_done) {
+        _statehash_header();
+    }
+    const uint64_t start = stm_now();
+    uint64_t hashes[STATEHASH_MAX_COMPONENTS];
+    for (int i = 0; i < shsh.num_components; i++) {
+        hashes[i] = 0;
+    }
+    for (int i = 0; i < shsh.num_regions; i++) {
+        const statehash_region_t* r = &shsh.regions[i];
+        const uint8_t* ptr = r->ptr;
+        if (r->relocate) {
+            reloc_normalize(shsh.scratch, r->ptr, r->size);
+            ptr = shsh.scratch;
+        }
+        /* regions of the same component are chained through the seed */
+        hashes[r->component] = statehash_xxh64(ptr, r->size, hashes[r->component]);
+    }
+    if (shsh.record_fp) {
+        fwrite(hashes, sizeof(uint64_t), (size_t)shsh.num_components, shsh.record_fp);
+    }
+    if (shsh.compare_fp) {
+        uint64_t expected[STATEHASH_MAX_COMPONENTS];
+        if ((size_t)shsh.num_components == fread(expected, sizeof(uint64_t), (size_t)shsh.num_components, shsh.compare_fp)) {
+            if (!shsh.diverged && (0 != memcmp(hashes, expected, (size_t)shsh.num_components * sizeof(uint64_t)))) {
+                shsh.diverged = true;
+                shsh.diverged_frame = shsh.num_frames;
+                printf("statehash: first divergence in frame %llu:", (unsigned long long)shsh.num_frames);
+                for (int i = 0; i < shsh.num_components; i++) {
+                    if (hashes[i] != expected[i]) {
+                        printf(" %s", shsh.names[i]);
+                    }
+                }
+                printf("\n");
+            }
+        }
+        else {
+            printf("statehash: end of compare stream after %llu frames\n", (unsigned long long)shsh.num_frames);
+            fclose(shsh.compare_fp);
+            shsh.compare_fp = 0;
+        }
+    }
+    shsh.num_frames++;
+    shsh.total_ms += stm_ms(stm_since(start));
+}
+
+void statehash_print_stats(void) {
+    if (!shsh.enabled) {
+        return;
+    }
+    printf("statehash: %llu frames, %.3f ms avg per frame\n",
+        (unsigned long long)shsh.num_frames,
+        shsh.num_frames ? (shsh.total_ms / (double)shsh.num_frames) : 0.0);
+    if (shsh.diverged) {
+        printf("statehash: diverged in frame %llu\n", (unsigned long long)shsh.diverged_frame);
+    }
+}
+#endif /* COMMON_IMPL */
@@ -0,0 +1,171 @@
+#pragma once
+/*
+    Execution history for the debugger.
+
+    A fixed-size ring buffer which records one entry per executed CPU
+    instruction: the frame and tick it was executed at, the program
+    counter, the opcode bytes and the CPU registers before the instruction
+    ran. The ring is allocated once in trace_init() and recording is a
+    plain store into the next slot, so it can stay enabled while the
+    emulator runs at full speed.
+
+    The module doesn't know about specific CPUs, the CPU glue code (in
+    the *-ui.cc files) hooks the CPU's per-instruction trap callback,
+    and fills the entries returned by trace_next(). The register names
+    for the UI are provided in trace_init().
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_DEFAULT_ENTRIES (1<<20)
+#define TRACE_MAX_OPCODE_BYTES (4)
+#define TRACE_MAX_REGS (8)
+
+typedef struct {
+    uint32_t frame;                 /* frame number (see trace_frame()) */
+    uint32_t tick;                  /* CPU tick inside the frame */
+    uint16_t pc;
+    uint8_t opcode[TRACE_MAX_OPCODE_BYTES];
+    uint16_t regs[TRACE_MAX_REGS];
+} trace_entry_t;
+
+typedef struct {
+    int num_entries;                /* ring buffer size (default: TRACE_DEFAULT_ENTRIES) */
+    int num_regs;                   /* number of used registers in an entry */
+    const char* reg_names[TRACE_MAX_REGS];
+} trace_desc_t;
+
+/* allocate the ring buffer and start recording */
+extern void trace_init(const trace_desc_t* desc);
+/* free the ring buffer */
+extern void trace_shutdown(void);
+/* true if recording */
+extern bool trace_enabled(void);
+/* start a new frame, call once before running the emulator for a frame */
+extern void trace_frame(void);
+/* get the current frame number */
+extern uint32_t trace_frame_count(void);
+/* get the next entry to record into (overwrites the oldest entry when the ring is full) */
+extern trace_entry_t* trace_next(void);
+/* get the number of recorded entries */
+extern int trace_count(void);
+/* get a recorded entry, index 0 is the oldest */
+extern const trace_entry_t* trace_entry(int index);
+/* get the number of registers in an entry and their names */
+extern int trace_num_regs(void);
+extern const char* trace_reg_name(int index);
+/* find the next (or previous) entry with a program counter, starting after 'start', returns -1 if not found */
+extern int trace_find_pc(uint16_t pc, int start, bool backward);
+/* discard all entries */
+extern void trace_clear(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    bool enabled;
+    uint32_t frame;
+    uint32_t mask;
+    uint32_t head;                  /* total number of recorded entries, wraps around */
+    bool full;                      /* true once the ring has wrapped around */
+    trace_entry_t* entries;
+    int num_regs;
+    const char* reg_names[TRACE_MAX_REGS];
+} trace_state;
+static trace_state trc;
+
+void trace_init(const trace_desc_t* desc) {
+    trace_shutdown();
+    /* round the size up to a power of two, so that the ring index is a mask */
+    uint32_t num_entries = 1;
+    const uint32_t requested = (desc->num_entries > 0) ? (uint32_t)desc->num_entries : TRACE_DEFAULT_ENTRIES;
+    while (num_entries < requested) {
+        num_entries <<= 1;
+    }
+    trc.entries = (trace_entry_t*) malloc(num_entries * sizeof(trace_entry_t));
+    if (!trc.entries) {
+        return;
+    }
+    trc.enabled = true;
+    trc.mask = num_entries - 1;
+    trc.num_regs = (desc->num_regs < TRACE_MAX_REGS) ? desc->num_regs : TRACE_MAX_REGS;
+    for (int i = 0; i < trc.num_regs; i++) {
+        trc.reg_names[i] = desc->reg_names[i];
+    }
+}
+
+void trace_shutdown(void) {
+    free(trc.entries);
+    memset(&trc, 0, sizeof(trc));
+}
+
+bool trace_enabled(void) {
+    return trc.enabled;
+}
+
+void trace_frame(void) {
+    trc.frame++;
+}
+
+uint32_t trace_frame_count(void) {
+    return trc.frame;
+}
+
+trace_entry_t* trace_next(void) {
+    trace_entry_t* e = &trc.entries[trc.head & trc.mask];
+    trc.head++;
+    if (0 == (trc.head & trc.mask)) {
+        trc.full = true;
+    }
+    return e;
+}
+
+int trace_count(void) {
+    if (!trc.enabled) {
+        return 0;
+    }
+    return trc.full ? (int)(trc.mask + 1) : (int)(trc.head & trc.mask);
+}
+
+const trace_entry_t* trace_entry(int index) {
+    const int count = trace_count();
+    if ((index < 0) || (index >= count)) {
+        return 0;
+    }
+    return &trc.entries[(trc.head - (uint32_t)count + (uint32_t)index) & trc.mask];
+}
+
+int trace_num_regs(void) {
+    return trc.num_regs;
+}
+
+const char* trace_reg_name(int index) {
+    return ((index >= 0) && (index < trc.num_regs)) ? trc.reg_names[index] : "";
+}
+
+int trace_find_pc(uint16_t pc, int start, bool backward) {
+    const int count = trace_count();
+    const int step = backward ? -1 : 1;
+    for (int i = start + step; (i >= 0) && (i < count); i += step) {
+        if (trace_entry(i)->pc == pc) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void trace_clear(void) {
+    trc.head = 0;
+    trc.full = false;
+}
+#endif /* COMMON_IMPL */
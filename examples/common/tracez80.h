@@ -0,0 +1,69 @@
+#pragma once
+/*
+    Z80 glue code for trace.h, include after chips/z80.h and chips/mem.h.
+
+    tracez80_attach() hooks the CPU's per-instruction trap callback to
+    record an entry into the trace ring, and chains the trap callback
+    which was installed before (the debugger's breakpoint check), so
+    that breakpoints keep working. Call it each frame before running
+    the emulator, and tracez80_detach() after, this keeps the trace
+    trap out of the way of other code which re-installs its own trap
+    callback each frame (like the ZX tape loader), without the two
+    chaining each other in a loop.
+
+    Entries contain the PC of the next instruction, its opcode bytes and
+    the registers AF, BC, DE, HL, IX, IY and SP before it runs.
+*/
+#include "trace.h"
+
+static struct {
+    z80_t* cpu;
+    mem_t* mem;
+    z80_trap_t chained_cb;
+    void* chained_user_data;
+} tracez80;
+
+static const trace_desc_t tracez80_desc = {
+    TRACE_DEFAULT_ENTRIES, 7, { "AF", "BC", "DE", "HL", "IX", "IY", "SP" }
+};
+
+static int tracez80_trap(uint16_t pc, uint32_t ticks, uint64_t pins, void* user_data) {
+    (void)user_data;
+    trace_entry_t* e = trace_next();
+    e->frame = trace_frame_count();
+    e->tick = ticks;
+    e->pc = pc;
+    for (int i = 0; i < TRACE_MAX_OPCODE_BYTES; i++) {
+        e->opcode[i] = mem_rd(tracez80.mem, (uint16_t)(pc + i));
+    }
+    const z80_t* cpu = tracez80.cpu;
+    e->regs[0] = z80_af(cpu);
+    e->regs[1] = z80_bc(cpu);
+    e->regs[2] = z80_de(cpu);
+    e->regs[3] = z80_hl(cpu);
+    e->regs[4] = z80_ix(cpu);
+    e->regs[5] = z80_iy(cpu);
+    e->regs[6] = z80_sp(cpu);
+    return tracez80.chained_cb ? tracez80.chained_cb(pc, ticks, pins, tracez80.chained_user_data) : 0;
+}
+
+static void tracez80_attach(z80_t* cpu, mem_t* mem) {
+    if (!trace_enabled()) {
+        return;
+    }
+    trace_frame();
+    if (cpu->trap_cb != tracez80_trap) {
+        tracez80.cpu = cpu;
+        tracez80.mem = mem;
+        tracez80.chained_cb = cpu->trap_cb;
+        tracez80.chained_user_data = cpu->trap_user_data;
+        z80_trap_cb(cpu, tracez80_trap, 0);
+    }
+}
+
+static void tracez80_detach(z80_t* cpu) {
+    /* only if nobody replaced the trap callback in the meantime (e.g. a cold boot from the UI) */
+    if (cpu->trap_cb == tracez80_trap) {
+        z80_trap_cb(cpu, tracez80.chained_cb, tracez80.chained_user_data);
+    }
+}
@@ -1,16 +1,34 @@
 //------------------------------------------------------------------------------
 //  ui.cc
 //------------------------------------------------------------------------------
+#include <stdio.h>
 #include "ui.h"
 #include "sokol_gfx.h"
 #include "sokol_app.h"
+#include "sokol_audio.h"
 #include "sokol_time.h"
+#include "prof.h"
+#include "guestprof.h"
+#include "trace.h"
+#include "heatmap.h"
+#include "gfx.h"
 #include "imgui.h"
 #define SOKOL_IMGUI_IMPL
 #include "sokol_imgui.h"
 
 static uint64_t last_time;
 static ui_draw_t ui_draw_cb;
+static bool prof_open;
+static bool trace_open;
+static int trace_selected = -1;
+static bool trace_scroll;
+static uint16_t trace_pc;
+static bool heatmap_open;
+static void* heatmap_texture;
+static int audio_capacity;
+static guestprof_routine_t guestprof_table[16];
+static int guestprof_table_num;
+static int guestprof_table_refresh;
 
 void ui_init(ui_draw_t draw_cb) {
     simgui_desc_t simgui_desc = { };
@@ -23,15 +41,235 @@ void ui_init(ui_draw_t draw_cb) {
 }
 
 void ui_discard(void) {
+    if (heatmap_texture) {
+        gfx_destroy_texture(heatmap_texture);
+        heatmap_texture = 0;
+    }
     simgui_shutdown();
 }
 
+/* the number of audio samples waiting for playback, the ring buffer
+   capacity is the largest number of samples sokol-audio ever expected
+*/
+static void push_audio_queue(void) {
+    if (!saudio_isvalid()) {
+        return;
+    }
+    const int expect = saudio_expect();
+    if (expect > audio_capacity) {
+        audio_capacity = expect;
+    }
+    prof_push(PROF_AUDIO, (float)(audio_capacity - expect));
+}
+
+static float prof_sample(void* data, int index) {
+    return prof_value((prof_bucket_t)(intptr_t)data, index);
+}
+
+/* guest code profiler section in the profiler window, the table is refreshed twice per second */
+static void draw_guestprof(void) {
+    if (!ImGui::CollapsingHeader("Guest Code")) {
+        return;
+    }
+    const bool enabled = guestprof_enabled();
+    if (ImGui::Button(enabled ? "Stop" : "Start")) {
+        guestprof_enable(!enabled);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reset")) {
+        guestprof_reset();
+        guestprof_table_num = 0;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Write")) {
+        guestprof_write();
+    }
+    ImGui::SameLine();
+    ImGui::Text("%s", guestprof_path());
+    const uint64_t total = guestprof_total_cycles();
+    ImGui::Text("%llu cycles", (unsigned long long)total);
+    if (--guestprof_table_refresh <= 0) {
+        guestprof_table_num = guestprof_top(guestprof_table, (int)(sizeof(guestprof_table) / sizeof(guestprof_table[0])));
+        guestprof_table_refresh = 30;
+    }
+    const double scale = (total > 0) ? (100.0 / (double)total) : 0.0;
+    ImGui::Columns(4, "##guestprof");
+    ImGui::Text("Routine"); ImGui::NextColumn();
+    ImGui::Text("Self"); ImGui::NextColumn();
+    ImGui::Text("Total"); ImGui::NextColumn();
+    ImGui::Text("Calls"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (int i = 0; i < guestprof_table_num; i++) {
+        const guestprof_routine_t* r = &guestprof_table[i];
+        if (r->root) {
+            ImGui::Text("root");
+        }
+        else {
+            ImGui::Text("%04X", r->addr);
+        }
+        ImGui::NextColumn();
+        ImGui::Text("%.1f%%", r->self * scale); ImGui::NextColumn();
+        ImGui::Text("%.1f%%", r->total * scale); ImGui::NextColumn();
+        ImGui::Text("%u", r->calls); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
+/* the profiler window, opened from the Tools menu */
+static void draw_profiler(void) {
+    if (!prof_open) {
+        return;
+    }
+    ImGui::SetNextWindowSize(ImVec2(420, 0), ImGuiCond_Once);
+    if (ImGui::Begin("Profiler", &prof_open)) {
+        ImGui::Text("last %d frames", PROF_NUM_SAMPLES);
+        for (int i = 0; i < PROF_NUM; i++) {
+            const prof_bucket_t bucket = (prof_bucket_t)i;
+            const int count = prof_count(bucket);
+            if (0 == count) {
+                continue;
+            }
+            const prof_stats_t s = prof_stats(bucket);
+            const char* unit = (bucket == PROF_AUDIO) ? "" : " ms";
+            ImGui::Separator();
+            ImGui::Text("%s: min %.2f%s avg %.2f%s p99 %.2f%s", prof_name(bucket), s.min, unit, s.avg, unit, s.p99, unit);
+            ImGui::PushID(i);
+            const float scale_max = (s.max > 0.0f) ? (s.max * 1.1f) : 1.0f;
+            ImGui::PlotHistogram("", prof_sample, (void*)(intptr_t)bucket, count, 0, 0, 0.0f, scale_max, ImVec2(-1, 40));
+            ImGui::PopID();
+        }
+        if (guestprof_available()) {
+            ImGui::Separator();
+            draw_guestprof();
+        }
+    }
+    ImGui::End();
+}
+
+static void trace_select(int index) {
+    if (index >= 0) {
+        trace_selected = index;
+        trace_scroll = true;
+    }
+}
+
+/* the execution history window, opened from the Tools menu */
+static void draw_trace(void) {
+    if (!trace_open || !trace_enabled()) {
+        return;
+    }
+    ImGui::SetNextWindowSize(ImVec2(640, 400), ImGuiCond_Once);
+    if (ImGui::Begin("Trace", &trace_open)) {
+        const int count = trace_count();
+        ImGui::Text("%d instructions", count);
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            trace_clear();
+            trace_selected = -1;
+        }
+        ImGui::SameLine();
+        ImGui::PushItemWidth(48);
+        ImGui::InputScalar("PC", ImGuiDataType_U16, &trace_pc, 0, 0, "%04X", ImGuiInputTextFlags_CharsHexadecimal);
+        ImGui::PopItemWidth();
+        ImGui::SameLine();
+        if (ImGui::Button("Prev")) {
+            trace_select(trace_find_pc(trace_pc, (trace_selected < 0) ? count : trace_selected, true));
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Next")) {
+            trace_select(trace_find_pc(trace_pc, trace_selected, false));
+        }
+        ImGui::Separator();
+        ImGui::BeginChild("##trace", ImVec2(0, 0), false);
+        const float line_height = ImGui::GetTextLineHeightWithSpacing();
+        if (trace_scroll) {
+            ImGui::SetScrollY(trace_selected * line_height - ImGui::GetWindowHeight() * 0.5f);
+            trace_scroll = false;
+        }
+        ImGuiListClipper clipper(count, line_height);
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                const trace_entry_t* e = trace_entry(i);
+                char line[128];
+                int pos = snprintf(line, sizeof(line), "%6u %6u %04X ", e->frame, e->tick, e->pc);
+                for (int b = 0; b < TRACE_MAX_OPCODE_BYTES; b++) {
+                    pos += snprintf(&line[pos], sizeof(line) - pos, "%02X ", e->opcode[b]);
+                }
+                for (int r = 0; r < trace_num_regs(); r++) {
+                    pos += snprintf(&line[pos], sizeof(line) - pos, " %s:%04X", trace_reg_name(r), e->regs[r]);
+                }
+                ImGui::PushID(i);
+                if (ImGui::Selectable(line, i == trace_selected)) {
+                    trace_selected = i;
+                    trace_pc = e->pc;
+                }
+                ImGui::PopID();
+            }
+        }
+        ImGui::EndChild();
+    }
+    ImGui::End();
+}
+
+/* the memory access heatmap window, opened from the Tools menu, counting only runs while it's open */
+static void draw_heatmap(void) {
+    heatmap_enable(heatmap_open);
+    if (!heatmap_open) {
+        return;
+    }
+    heatmap_update();
+    if (!heatmap_texture) {
+        heatmap_texture = gfx_create_texture(HEATMAP_WIDTH, HEATMAP_HEIGHT);
+    }
+    gfx_update_texture(heatmap_texture, (void*)heatmap_pixels(), heatmap_pixels_size());
+    ImGui::SetNextWindowSize(ImVec2(540, 600), ImGuiCond_Once);
+    if (ImGui::Begin("Memory Heatmap", &heatmap_open)) {
+        ImGui::Text("write: red, read: green, opcode fetch: blue");
+        const ImVec2 pos = ImGui::GetCursorScreenPos();
+        const float scale = 2.0f;
+        ImGui::Image(heatmap_texture, ImVec2(HEATMAP_WIDTH * scale, HEATMAP_HEIGHT * scale));
+        if (ImGui::IsItemHovered()) {
+            const ImVec2 mouse = ImGui::GetMousePos();
+            const int x = (int)((mouse.x - pos.x) / scale);
+            const int y = (int)((mouse.y - pos.y) / scale);
+            if ((x >= 0) && (x < HEATMAP_WIDTH) && (y >= 0) && (y < HEATMAP_HEIGHT)) {
+                const uint16_t addr = (uint16_t)(y * HEATMAP_WIDTH + x);
+                ImGui::SetTooltip("%04X\nread: %u\nwrite: %u\nfetch: %u", addr,
+                    heatmap_count(HEATMAP_READ, addr),
+                    heatmap_count(HEATMAP_WRITE, addr),
+                    heatmap_count(HEATMAP_EXEC, addr));
+            }
+        }
+    }
+    ImGui::End();
+}
+
+/* append a Tools menu to the main menu bar of the system UI, function keys are guest keys in some systems */
+static void draw_menu(void) {
+    if (ImGui::BeginMainMenuBar()) {
+        if (ImGui::BeginMenu("Tools")) {
+            ImGui::MenuItem("Profiler", 0, &prof_open);
+            ImGui::MenuItem("Trace", 0, &trace_open, trace_enabled());
+            ImGui::MenuItem("Memory Heatmap", 0, &heatmap_open, heatmap_available());
+            ImGui::EndMenu();
+        }
+        ImGui::EndMainMenuBar();
+    }
+}
+
 void ui_draw(void) {
+    const uint64_t start = stm_now();
+    push_audio_queue();
     simgui_new_frame(sapp_width(), sapp_height(), stm_sec(stm_laptime(&last_time)));
     if (ui_draw_cb) {
         ui_draw_cb();
     }
+    draw_menu();
+    draw_profiler();
+    draw_trace();
+    draw_heatmap();
     simgui_render();
+    prof_push(PROF_UI, (float)stm_ms(stm_since(start)));
 }
 
 bool ui_input(const sapp_event* event) {
@@ -0,0 +1,99 @@
+#pragma once
+/*
+    Warp mode helper functions.
+
+    Warp mode is either toggled manually (e.g. with a hotkey), or engaged
+    automatically while a frontend-provided condition is true (e.g. while
+    the tape motor is running, or the floppy drive motor is on).
+
+    In warp mode, the frontend runs emulated frames back to back until
+    most of the host frame time is used up, and only the last one is
+    presented. Audio output is dropped while warping, so that the audio
+    ring buffer isn't flooded.
+
+    The achieved speed multiplier is printed to stdout about once per
+    second while warping, and when warp mode is left.
+
+    Headless builds (CHIPS_HEADLESS) are unthrottled anyway, there
+    warp_continue() never asks for extra frames, so that the number of
+    emulated frames doesn't depend on the host speed.
+*/
+/* toggle manual warp mode */
+extern void warp_toggle(void);
+/* engage or disengage automatic warp mode, call once per frame */
+extern void warp_set_auto(bool active);
+/* true if warp mode is active (manual or automatic) */
+extern bool warp_active(void);
+/* call after each emulated frame, returns true if another frame should be run in this host frame */
+extern bool warp_continue(uint64_t host_frame_start, uint32_t frame_time_us);
+/* the speed multiplier achieved in the current (or last) warp period */
+extern double warp_speed(void);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdio.h>
+#include "sokol_time.h"
+
+/* host time per frame spent on emulation in warp mode, leaves room for presenting */
+#define WARP_HOST_BUDGET_MS (12.0)
+#define WARP_REPORT_INTERVAL_MS (1000.0)
+
+typedef struct {
+    bool manual;
+    bool automatic;
+    bool active;
+    uint64_t start_time;
+    uint64_t report_time;
+    uint64_t emu_us;
+} warp_state;
+static warp_state wrp;
+
+double warp_speed(void) {
+    const double host_us = stm_us(stm_since(wrp.start_time));
+    return (host_us > 0.0) ? ((double)wrp.emu_us / host_us) : 0.0;
+}
+
+static void _warp_update(void) {
+    const bool active = wrp.manual || wrp.automatic;
+    if (active && !wrp.active) {
+        wrp.start_time = stm_now();
+        wrp.report_time = wrp.start_time;
+        wrp.emu_us = 0;
+    }
+    else if (!active && wrp.active) {
+        printf("warp: %.1fx for %.1f secs\n", warp_speed(), stm_sec(stm_since(wrp.start_time)));
+    }
+    wrp.active = active;
+}
+
+void warp_toggle(void) {
+    wrp.manual = !wrp.manual;
+    _warp_update();
+}
+
+void warp_set_auto(bool active) {
+    wrp.automatic = active;
+    _warp_update();
+}
+
+bool warp_active(void) {
+    return wrp.active;
+}
+
+bool warp_continue(uint64_t host_frame_start, uint32_t frame_time_us) {
+    #if defined(CHIPS_HEADLESS)
+    (void)host_frame_start; (void)frame_time_us;
+    return false;
+    #else
+    if (!wrp.active) {
+        return false;
+    }
+    wrp.emu_us += frame_time_us;
+    if (stm_ms(stm_since(wrp.report_time)) > WARP_REPORT_INTERVAL_MS) {
+        wrp.report_time = stm_now();
+        printf("warp: %.1fx\n", warp_speed());
+    }
+    return stm_ms(stm_since(host_frame_start)) < WARP_HOST_BUDGET_MS;
+    #endif
+}
+#endif /* COMMON_IMPL */
@@ -0,0 +1,194 @@
+#pragma once
+/*
+    Instant loading of ZX Spectrum .tap files via a ROM loader trap.
+
+    A .tap file is a sequence of blocks, each prefixed with a 16-bit
+    little-endian length. A block starts with the flag byte, followed
+    by the data bytes and an XOR checksum byte.
+
+    The frontend traps the ROM's LD-BYTES routine at its entry point
+    (ZXTAP_LD_BYTES) and calls zxtap_ld_bytes() with the CPU registers
+    at that point:
+
+        A   - the expected flag byte
+        F   - carry set for LOAD, carry clear for VERIFY
+        IX  - the destination address
+        DE  - the number of bytes to load
+
+    zxtap_ld_bytes() consumes the next block, copies (or compares) its
+    data through the provided memory callbacks, and updates A, F, IX
+    and DE the same way the ROM routine would leave them. The frontend
+    then writes the registers back into the CPU and emulates a RET.
+
+    The result flags follow the ROM routine's exit paths:
+
+        - success: A=0, F as after CP 1 (carry set)
+        - checksum error: A=checksum, F as after CP 1 (carry clear)
+        - flag mismatch or verify error: A=xor of both bytes, F as after XOR (carry clear)
+        - block too short: A=0, F=0x50 as after the edge detection timeout (carry clear)
+
+    If no tape is inserted or the end of the tape is reached,
+    zxtap_ld_bytes() returns false and the ROM routine should run
+    normally (it waits for a signal that never comes, until BREAK
+    is pressed).
+*/
+
+/* entry address of LD-BYTES in the 48K ROM (and the 128K ROM 1) */
+#define ZXTAP_LD_BYTES (0x0556)
+
+/* CPU registers at entry and exit of LD-BYTES */
+typedef struct {
+    uint8_t a;
+    uint8_t f;
+    uint16_t de;
+    uint16_t ix;
+} zxtap_regs_t;
+
+typedef uint8_t (*zxtap_read_t)(uint16_t addr, void* user_data);
+typedef void (*zxtap_write_t)(uint16_t addr, uint8_t data, void* user_data);
+
+/* insert a .tap file (data is copied), returns false if the data isn't a valid .tap file */
+extern bool zxtap_insert(const uint8_t* ptr, int size);
+/* remove the inserted tape */
+extern void zxtap_remove(void);
+/* true if a tape is inserted and not at its end */
+extern bool zxtap_ready(void);
+/* get the read position in the inserted tape (for save states) */
+extern int zxtap_position(void);
+/* set the read position in the inserted tape */
+extern void zxtap_set_position(int pos);
+/* load the next block into emulated memory, returns false if no block is available */
+extern bool zxtap_ld_bytes(zxtap_regs_t* regs, zxtap_read_t rd, zxtap_write_t wr, void* user_data);
+
+/*== IMPLEMENTATION ==========================================================*/
+#ifdef COMMON_IMPL
+#include <stdlib.h>
+#include <string.h>
+
+#define ZXTAP_SF (1<<7)
+#define ZXTAP_ZF (1<<6)
+#define ZXTAP_HF (1<<4)
+#define ZXTAP_PF (1<<2)
+#define ZXTAP_NF (1<<1)
+#define ZXTAP_CF (1<<0)
+
+typedef struct {
+    uint8_t* ptr;
+    int size;
+    int pos;
+} zxtap_state;
+static zxtap_state ztap;
+
+void zxtap_remove(void) {
+    if (ztap.ptr) {
+        free(ztap.ptr);
+    }
+    memset(&ztap, 0, sizeof(ztap));
+}
+
+bool zxtap_insert(const uint8_t* ptr, int size) {
+    /* check that the blocks exactly cover the data */
+    int pos = 0;
+    while ((pos + 2) <= size) {
+        const int len = ptr[pos] | (ptr[pos+1]<<8);
+        if (0 == len) {
+            return false;
+        }
+        pos += 2 + len;
+    }
+    if ((0 == size) || (pos != size)) {
+        return false;
+    }
+    zxtap_remove();
+    ztap.ptr = (uint8_t*) malloc((size_t)size);
+    if (!ztap.ptr) {
+        return false;
+    }
+    memcpy(ztap.ptr, ptr, (size_t)size);
+    ztap.size = size;
+    return true;
+}
+
+bool zxtap_ready(void) {
+    return ztap.ptr && (ztap.pos < ztap.size);
+}
+
+int zxtap_position(void) {
+    return ztap.pos;
+}
+
+void zxtap_set_position(int pos) {
+    if (ztap.ptr && (pos >= 0) && (pos <= ztap.size)) {
+        ztap.pos = pos;
+    }
+}
+
+static uint8_t _zxtap_flags_xor(uint8_t r) {
+    uint8_t p = r;
+    p ^= p>>4; p ^= p>>2; p ^= p>>1;
+    return (r & 0xA8) | (r ? 0 : ZXTAP_ZF) | ((p & 1) ? 0 : ZXTAP_PF);
+}
+
+static uint8_t _zxtap_flags_cp1(uint8_t a) {
+    const uint8_t r = a - 1;
+    uint8_t f = (r & ZXTAP_SF) | (r ? 0 : ZXTAP_ZF) | ZXTAP_NF;
+    if ((a & 0x0F) == 0) {
+        f |= ZXTAP_HF;
+    }
+    if (a == 0x80) {
+        f |= ZXTAP_PF;
+    }
+    if (a == 0) {
+        f |= ZXTAP_CF;
+    }
+    return f;
+}
+
+bool zxtap_ld_bytes(zxtap_regs_t* regs, zxtap_read_t rd, zxtap_write_t wr, void* user_data) {
+    if (!zxtap_ready()) {
+        return false;
+    }
+    const uint8_t* block = &ztap.ptr[ztap.pos + 2];
+    const int len = ztap.ptr[ztap.pos] | (ztap.ptr[ztap.pos+1]<<8);
+    ztap.pos += 2 + len;
+
+    /* the ROM reads DE bytes after the flag byte, followed by the checksum */
+    uint8_t parity = block[0];
+    if (regs->de > 0) {
+        if (block[0] != regs->a) {
+            regs->a ^= block[0];
+            regs->f = _zxtap_flags_xor(regs->a);
+            return true;
+        }
+        const bool verify = 0 == (regs->f & ZXTAP_CF);
+        int i = 1;
+        for (; (i < len) && (regs->de > 0); i++) {
+            const uint8_t b = block[i];
+            if (verify) {
+                const uint8_t m = rd(regs->ix, user_data);
+                if (m != b) {
+                    regs->a = m ^ b;
+                    regs->f = _zxtap_flags_xor(regs->a);
+                    return true;
+                }
+            }
+            else {
+                wr(regs->ix, b, user_data);
+            }
+            parity ^= b;
+            regs->ix++;
+            regs->de--;
+        }
+        if (i >= len) {
+            /* end of block reached before the checksum byte */
+            regs->a = 0;
+            regs->f = ZXTAP_ZF | ZXTAP_HF;
+            return true;
+        }
+        parity ^= block[i];
+    }
+    regs->a = parity;
+    regs->f = _zxtap_flags_cp1(parity);
+    return true;
+}
+#endif /* COMMON_IMPL */
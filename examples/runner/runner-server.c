@@ -0,0 +1,423 @@
+/*
+    runner-server.c -- a headless emulator server for automation.
+
+    Hosts a pool of emulator instances (all the same system), and
+    accepts batched commands from one client at a time over a Unix
+    domain socket. Framebuffers and audio are not sent over the socket,
+    instead each instance has a slot in a shared memory block, which
+    is updated after each STEP command.
+
+    Usage:
+
+        runner-server socket=/tmp/chips.sock shm=/chips system=zx [type=zx48k] [instances=16] [max_step=60]
+
+    All messages are little-endian, a request is a server_cmd_t header,
+    optionally followed by a payload of 'payload_size' bytes, and is
+    answered with a server_reply_t header, optionally followed by a
+    payload:
+
+        INFO        reply payload: server_info_t
+        STEP        run all instances for 'arg' frames (at most max_step), then update the shared memory
+        INPUT       payload: array of server_input_t, applied in order
+        SNAPSHOT    reply payload: snapshot of instance 'arg'
+        RESTORE     payload: snapshot to restore into instance 'arg'
+
+    Shared memory layout: a server_shm_header_t, followed by one slot
+    per instance at offset (header_size + i * slot_size). A slot is a
+    server_shm_slot_t, followed by the RGBA8 framebuffer (framebuffer_size
+    bytes, the current display is the slot's width * height pixels) and
+    the audio ring (audio_ring_size mono float samples, the slot's
+    audio_head is the total number of samples written, a client tracks
+    its own read position). The audio ring holds the samples of at least
+    max_step frames, so a client doesn't lose audio when it reads the
+    ring after each STEP.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "runner.h"
+
+#define SERVER_MAX_INSTANCES (256)
+#define SERVER_SAMPLE_RATE (44100)
+#define SERVER_FRAME_RATE (60)          /* runner_exec_frames() runs 60 Hz frames */
+#define SERVER_DEFAULT_MAX_STEP (60)
+#define SERVER_MAX_STEP (600)
+#define SERVER_AUDIO_CHUNK_SIZE (4096)
+#define SERVER_SHM_MAGIC (0x4D485343)   /* 'CSHM' */
+#define SERVER_MAX_PAYLOAD (64 * 1024 * 1024)
+
+typedef enum {
+    SERVER_CMD_INFO = 1,
+    SERVER_CMD_STEP,
+    SERVER_CMD_INPUT,
+    SERVER_CMD_SNAPSHOT,
+    SERVER_CMD_RESTORE,
+} server_cmd_type_t;
+
+typedef enum {
+    SERVER_STATUS_OK = 0,
+    SERVER_STATUS_ERROR,
+} server_status_t;
+
+typedef struct {
+    uint32_t cmd;
+    uint32_t arg;
+    uint32_t payload_size;
+} server_cmd_t;
+
+typedef struct {
+    uint32_t status;
+    uint32_t payload_size;
+} server_reply_t;
+
+typedef struct {
+    uint32_t instance;
+    int32_t key_code;
+    uint32_t down;
+} server_input_t;
+
+typedef struct {
+    uint32_t system;
+    uint32_t num_instances;
+    uint32_t shm_size;
+    uint32_t snapshot_size;
+} server_info_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_instances;
+    uint32_t header_size;
+    uint32_t slot_size;
+    uint32_t framebuffer_size;
+    uint32_t audio_ring_size;
+    uint32_t reserved[2];
+} server_shm_header_t;
+
+typedef struct {
+    uint32_t frame_count;       /* number of frames the instance has run */
+    uint32_t width;             /* current display width */
+    uint32_t height;            /* current display height */
+    uint32_t audio_head;        /* total number of audio samples written */
+} server_shm_slot_t;
+
+static struct {
+    runner_system_t system;
+    int num_instances;
+    runner_t* instances[SERVER_MAX_INSTANCES];
+    uint8_t* shm;
+    size_t shm_size;
+    size_t slot_size;
+    size_t pixels_size;
+    size_t snapshot_size;
+    int max_step;               /* max number of frames per STEP */
+    uint32_t audio_ring_size;   /* power of 2 */
+    uint8_t* buf;               /* request/reply payload buffer */
+    size_t buf_size;
+    float audio[SERVER_AUDIO_CHUNK_SIZE];
+} srv;
+
+static const struct {
+    const char* name;
+    runner_system_t system;
+} server_systems[] = {
+    { "atom", RUNNER_SYSTEM_ATOM },
+    { "bombjack", RUNNER_SYSTEM_BOMBJACK },
+    { "c64", RUNNER_SYSTEM_C64 },
+    { "cpc", RUNNER_SYSTEM_CPC },
+    { "kc85", RUNNER_SYSTEM_KC85 },
+    { "pacman", RUNNER_SYSTEM_PACMAN },
+    { "vic20", RUNNER_SYSTEM_VIC20 },
+    { "z1013", RUNNER_SYSTEM_Z1013 },
+    { "z9001", RUNNER_SYSTEM_Z9001 },
+    { "zx", RUNNER_SYSTEM_ZX },
+};
+
+/* get the value of a key=value argument, or 0 */
+static const char* arg_value(int argc, char* argv[], const char* key) {
+    const size_t len = strlen(key);
+    for (int i = 1; i < argc; i++) {
+        if ((0 == strncmp(argv[i], key, len)) && (argv[i][len] == '=')) {
+            return &argv[i][len + 1];
+        }
+    }
+    return 0;
+}
+
+static bool read_all(int fd, void* ptr, size_t size) {
+    uint8_t* p = (uint8_t*) ptr;
+    while (size > 0) {
+        const ssize_t n = read(fd, p, size);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* ptr, size_t size) {
+    const uint8_t* p = (const uint8_t*) ptr;
+    while (size > 0) {
+        const ssize_t n = write(fd, p, size);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool reply(int fd, server_status_t status, const void* payload, uint32_t payload_size) {
+    const server_reply_t r = { .status = status, .payload_size = payload_size };
+    return write_all(fd, &r, sizeof(r)) && ((0 == payload_size) || write_all(fd, payload, payload_size));
+}
+
+static server_shm_slot_t* shm_slot(int index) {
+    return (server_shm_slot_t*) (srv.shm + sizeof(server_shm_header_t) + (size_t)index * srv.slot_size);
+}
+
+/* move the new audio samples of an instance into its shared memory slot,
+   called after each frame, the instance's own audio ring is small
+*/
+static void update_audio(int index) {
+    runner_t* r = srv.instances[index];
+    server_shm_slot_t* slot = shm_slot(index);
+    float* ring = (float*) ((uint8_t*)slot + sizeof(server_shm_slot_t) + srv.pixels_size);
+    uint32_t head = slot->audio_head;
+    int num_samples;
+    while ((num_samples = runner_audio(r, srv.audio, SERVER_AUDIO_CHUNK_SIZE)) > 0) {
+        for (int i = 0; i < num_samples; i++) {
+            ring[head++ & (srv.audio_ring_size - 1)] = srv.audio[i];
+        }
+    }
+    /* publish the new head last, a polling client must see complete data */
+    __atomic_store_n(&slot->audio_head, head, __ATOMIC_RELEASE);
+}
+
+/* copy the framebuffer and new audio samples of an instance into its shared memory slot */
+static void update_slot(int index) {
+    runner_t* r = srv.instances[index];
+    server_shm_slot_t* slot = shm_slot(index);
+    int w, h;
+    const uint32_t* pixels = runner_framebuffer(r, &w, &h);
+    const size_t copy_size = (size_t)(w * h) * sizeof(uint32_t);
+    memcpy((uint8_t*)slot + sizeof(server_shm_slot_t), pixels, (copy_size < srv.pixels_size) ? copy_size : srv.pixels_size);
+    slot->width = (uint32_t)w;
+    slot->height = (uint32_t)h;
+    update_audio(index);
+}
+
+static bool handle_cmd(int fd, const server_cmd_t* cmd) {
+    if (cmd->payload_size > srv.buf_size) {
+        return false;
+    }
+    if ((cmd->payload_size > 0) && !read_all(fd, srv.buf, cmd->payload_size)) {
+        return false;
+    }
+    switch (cmd->cmd) {
+        case SERVER_CMD_INFO:
+            {
+                const server_info_t info = {
+                    .system = (uint32_t) srv.system,
+                    .num_instances = (uint32_t) srv.num_instances,
+                    .shm_size = (uint32_t) srv.shm_size,
+                    .snapshot_size = (uint32_t) srv.snapshot_size
+                };
+                return reply(fd, SERVER_STATUS_OK, &info, sizeof(info));
+            }
+        case SERVER_CMD_STEP:
+            if (cmd->arg > (uint32_t)srv.max_step) {
+                return reply(fd, SERVER_STATUS_ERROR, 0, 0);
+            }
+            for (int i = 0; i < srv.num_instances; i++) {
+                for (uint32_t frame = 0; frame < cmd->arg; frame++) {
+                    runner_exec_frames(srv.instances[i], 1);
+                    update_audio(i);
+                }
+                shm_slot(i)->frame_count += cmd->arg;
+                update_slot(i);
+            }
+            return reply(fd, SERVER_STATUS_OK, 0, 0);
+        case SERVER_CMD_INPUT:
+            {
+                const int num = (int)(cmd->payload_size / sizeof(server_input_t));
+                server_status_t status = SERVER_STATUS_OK;
+                for (int i = 0; i < num; i++) {
+                    server_input_t inp;
+                    memcpy(&inp, srv.buf + i * sizeof(server_input_t), sizeof(inp));
+                    if (inp.instance >= (uint32_t)srv.num_instances) {
+                        status = SERVER_STATUS_ERROR;
+                    }
+                    else if (inp.down) {
+                        runner_key_down(srv.instances[inp.instance], inp.key_code);
+                    }
+                    else {
+                        runner_key_up(srv.instances[inp.instance], inp.key_code);
+                    }
+                }
+                return reply(fd, status, 0, 0);
+            }
+        case SERVER_CMD_SNAPSHOT:
+            if ((cmd->arg >= (uint32_t)srv.num_instances) || !runner_snapshot(srv.instances[cmd->arg], srv.buf, srv.buf_size)) {
+                return reply(fd, SERVER_STATUS_ERROR, 0, 0);
+            }
+            return reply(fd, SERVER_STATUS_OK, srv.buf, (uint32_t)srv.snapshot_size);
+        case SERVER_CMD_RESTORE:
+            if ((cmd->arg >= (uint32_t)srv.num_instances) || !runner_restore(srv.instances[cmd->arg], srv.buf, cmd->payload_size)) {
+                return reply(fd, SERVER_STATUS_ERROR, 0, 0);
+            }
+            update_slot((int)cmd->arg);
+            return reply(fd, SERVER_STATUS_OK, 0, 0);
+        default:
+            return reply(fd, SERVER_STATUS_ERROR, 0, 0);
+    }
+}
+
+static bool init_shm(const char* name) {
+    /* the current display size may be smaller than the framebuffer */
+    srv.pixels_size = (size_t) runner_max_framebuffer_size(srv.instances[0]);
+    /* room for the audio of max_step frames, plus one frame of slack */
+    const uint32_t max_samples = (uint32_t)(srv.max_step + 1) * ((SERVER_SAMPLE_RATE / SERVER_FRAME_RATE) + 1);
+    srv.audio_ring_size = 1;
+    while (srv.audio_ring_size < max_samples) {
+        srv.audio_ring_size <<= 1;
+    }
+    srv.slot_size = sizeof(server_shm_slot_t) + srv.pixels_size + srv.audio_ring_size * sizeof(float);
+    srv.shm_size = sizeof(server_shm_header_t) + (size_t)srv.num_instances * srv.slot_size;
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (0 != ftruncate(fd, (off_t)srv.shm_size)) {
+        close(fd);
+        return false;
+    }
+    void* ptr = mmap(0, srv.shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    srv.shm = (uint8_t*) ptr;
+    *(server_shm_header_t*)srv.shm = (server_shm_header_t) {
+        .magic = SERVER_SHM_MAGIC,
+        .num_instances = (uint32_t) srv.num_instances,
+        .header_size = sizeof(server_shm_header_t),
+        .slot_size = (uint32_t) srv.slot_size,
+        .framebuffer_size = (uint32_t) srv.pixels_size,
+        .audio_ring_size = srv.audio_ring_size
+    };
+    for (int i = 0; i < srv.num_instances; i++) {
+        update_slot(i);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const char* socket_path = arg_value(argc, argv, "socket");
+    const char* shm_name = arg_value(argc, argv, "shm");
+    const char* system_name = arg_value(argc, argv, "system");
+    const char* type = arg_value(argc, argv, "type");
+    const char* instances = arg_value(argc, argv, "instances");
+    const char* max_step = arg_value(argc, argv, "max_step");
+    if (!socket_path || !shm_name || !system_name) {
+        fprintf(stderr, "usage: runner-server socket=path shm=/name system=name [type=model] [instances=n] [max_step=frames]\n");
+        return 10;
+    }
+    srv.system = RUNNER_NUM_SYSTEMS;
+    for (size_t i = 0; i < sizeof(server_systems) / sizeof(server_systems[0]); i++) {
+        if (0 == strcmp(system_name, server_systems[i].name)) {
+            srv.system = server_systems[i].system;
+        }
+    }
+    srv.num_instances = instances ? atoi(instances) : 1;
+    if ((srv.system == RUNNER_NUM_SYSTEMS) || (srv.num_instances < 1) || (srv.num_instances > SERVER_MAX_INSTANCES)) {
+        fprintf(stderr, "runner-server: unknown system or invalid number of instances\n");
+        return 10;
+    }
+    srv.max_step = max_step ? atoi(max_step) : SERVER_DEFAULT_MAX_STEP;
+    if ((srv.max_step < 1) || (srv.max_step > SERVER_MAX_STEP)) {
+        fprintf(stderr, "runner-server: max_step must be 1..%d\n", SERVER_MAX_STEP);
+        return 10;
+    }
+    for (int i = 0; i < srv.num_instances; i++) {
+        srv.instances[i] = runner_create(&(runner_desc_t){
+            .system = srv.system,
+            .type = type,
+            .audio_sample_rate = SERVER_SAMPLE_RATE
+        });
+        if (!srv.instances[i]) {
+            fprintf(stderr, "runner-server: failed to create instance (unknown type?)\n");
+            return 10;
+        }
+    }
+    srv.snapshot_size = runner_snapshot_size(srv.instances[0]);
+    srv.buf_size = srv.snapshot_size;
+    if (srv.buf_size < (SERVER_MAX_INSTANCES * 64 * sizeof(server_input_t))) {
+        srv.buf_size = SERVER_MAX_INSTANCES * 64 * sizeof(server_input_t);
+    }
+    srv.buf = (uint8_t*) malloc(srv.buf_size);
+    if (!srv.buf) {
+        fprintf(stderr, "runner-server: out of memory\n");
+        return 10;
+    }
+    if (!init_shm(shm_name)) {
+        fprintf(stderr, "runner-server: failed to create shared memory '%s': %s\n", shm_name, strerror(errno));
+        return 10;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "runner-server: socket path too long\n");
+        return 10;
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if ((listen_fd < 0) || (0 != bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))) || (0 != listen(listen_fd, 1))) {
+        fprintf(stderr, "runner-server: failed to listen on '%s': %s\n", socket_path, strerror(errno));
+        return 10;
+    }
+    /* a client which disconnects mid-reply must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+    printf("runner-server: %d x %s on %s, shared memory %s (%d bytes)\n",
+        srv.num_instances, system_name, socket_path, shm_name, (int)srv.shm_size);
+    fflush(stdout);
+    for (;;) {
+        int fd = accept(listen_fd, 0, 0);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        server_cmd_t cmd;
+        while (read_all(fd, &cmd, sizeof(cmd)) && handle_cmd(fd, &cmd)) { }
+        close(fd);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    shm_unlink(shm_name);
+    for (int i = 0; i < srv.num_instances; i++) {
+        runner_destroy(srv.instances[i]);
+    }
+    free(srv.buf);
+    return 0;
+}
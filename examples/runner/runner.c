@@ -0,0 +1,1056 @@
+/*
+    runner.c -- implementation of the runner.h embedding API.
+
+    All chips and systems are compiled into this one file, the per-system
+    glue code is a table of small wrapper functions. Only one variant
+    of the Namco board can be compiled into a program (it's selected
+    with a preprocessor define), so the runner has Pacman but not Pengo.
+*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* for memfd_create() */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "runner.h"
+#if defined(__unix__) || defined(__APPLE__)
+#define RUNNER_USE_MMAP (1)
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#define CHIPS_IMPL
+#include "chips/z80.h"
+#include "chips/z80ctc.h"
+#include "chips/z80pio.h"
+#include "chips/m6502.h"
+#include "chips/m6522.h"
+#include "chips/m6526.h"
+#include "chips/m6561.h"
+#include "chips/m6569.h"
+#include "chips/m6581.h"
+#include "chips/mc6845.h"
+#include "chips/mc6847.h"
+#include "chips/i8255.h"
+#include "chips/ay38910.h"
+#include "chips/am40010.h"
+#include "chips/upd765.h"
+#include "chips/fdd.h"
+#include "chips/fdd_cpc.h"
+#include "chips/beeper.h"
+#include "chips/kbd.h"
+#include "chips/clk.h"
+#include "chips/mem.h"
+#include "systems/c1530.h"
+#include "systems/c1541.h"
+#include "systems/atom.h"
+#include "systems/bombjack.h"
+#include "systems/c64.h"
+#include "systems/cpc.h"
+#include "systems/kc85.h"
+#define NAMCO_PACMAN
+#include "systems/namco.h"
+#include "systems/vic20.h"
+#include "systems/z1013.h"
+#include "systems/z9001.h"
+#include "systems/zx.h"
+#include "atom-roms.h"
+#include "bombjack-roms.h"
+#include "c64-roms.h"
+#include "c1541-roms.h"
+#include "cpc-roms.h"
+#include "kc85-roms.h"
+#include "pacman-roms.h"
+#include "vic20-roms.h"
+#include "z1013-roms.h"
+#include "z9001-roms.h"
+#include "zx-roms.h"
+
+#define RUNNER_DEFAULT_SAMPLE_RATE (44100)
+#define RUNNER_AUDIO_RING_SIZE (8192)
+#define RUNNER_FRAME_USEC (16667)
+#define RUNNER_SNAPSHOT_MAGIC (0x4E534352)  /* 'RCSN' */
+#define RUNNER_ALIGN(x) (((x) + 15) & ~(size_t)15)
+
+/* the per-system glue functions */
+typedef struct {
+    size_t size;
+    int (*max_display_size)(void);
+    bool (*init)(runner_t* runner, const runner_desc_t* desc);
+    void (*discard)(void* sys);
+    void (*exec)(void* sys, uint32_t micro_seconds);
+    void (*key_down)(void* sys, int key_code);
+    void (*key_up)(void* sys, int key_code);
+    int (*display_width)(void* sys);
+    int (*display_height)(void* sys);
+    bool (*quickload)(void* sys, const uint8_t* ptr, int size);
+} runner_funcs_t;
+
+struct runner_t {
+    runner_system_t system;
+    int type;                       /* the system's model, part of the snapshot check */
+    const runner_funcs_t* funcs;
+    size_t alloc_size;
+    bool mapped;                    /* true for forks, which are private mappings of a runner_base_t */
+    void* sys;
+    uint32_t* pixels;
+    int pixels_size;
+    int sample_rate;
+    uint32_t audio_head;
+    uint32_t audio_tail;
+    float audio[RUNNER_AUDIO_RING_SIZE];
+    /* followed by the system struct and the framebuffer */
+};
+
+/* a frozen copy of an instance, shared by all its forks */
+struct runner_base_t {
+    runner_system_t system;
+    size_t alloc_size;
+    uintptr_t base;                 /* address of the instance the base was frozen from */
+    uintptr_t image;                /* address of the executable's anchor when frozen */
+    int num_pointers;
+    uint32_t* pointers;             /* offsets of the pointers into the instance */
+    int num_image_pointers;
+    uint32_t* image_pointers;       /* offsets of the pointers into the executable */
+    #if defined(RUNNER_USE_MMAP)
+    int fd;
+    size_t data_offset;             /* start of the instance data in the file */
+    #else
+    uint8_t* data;
+    #endif
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t system;
+    int32_t type;
+    uint32_t reserved;
+    uint64_t base;                  /* address of the instance the snapshot was taken from */
+    uint64_t alloc_size;
+} runner_snapshot_header_t;
+
+static void _runner_audio_cb(const float* samples, int num_samples, void* user_data) {
+    runner_t* r = (runner_t*) user_data;
+    for (int i = 0; i < num_samples; i++) {
+        r->audio[r->audio_head++ & (RUNNER_AUDIO_RING_SIZE - 1)] = samples[i];
+    }
+    /* drop the oldest samples if the host doesn't fetch them */
+    if ((r->audio_head - r->audio_tail) > RUNNER_AUDIO_RING_SIZE) {
+        r->audio_tail = r->audio_head - RUNNER_AUDIO_RING_SIZE;
+    }
+}
+
+static bool _runner_type(const char* type, const char* name, bool is_default) {
+    return type ? (0 == strcmp(type, name)) : is_default;
+}
+
+/* wrappers for the functions which have the same signature in all systems */
+#define _RUNNER_COMMON_FUNCS(sys) \
+    static void _runner_##sys##_discard(void* s) { sys##_discard((sys##_t*)s); } \
+    static void _runner_##sys##_exec(void* s, uint32_t us) { sys##_exec((sys##_t*)s, us); } \
+    static int _runner_##sys##_display_width(void* s) { return sys##_display_width((sys##_t*)s); } \
+    static int _runner_##sys##_display_height(void* s) { return sys##_display_height((sys##_t*)s); }
+#define _RUNNER_KEY_FUNCS(sys) \
+    static void _runner_##sys##_key_down(void* s, int key) { sys##_key_down((sys##_t*)s, key); } \
+    static void _runner_##sys##_key_up(void* s, int key) { sys##_key_up((sys##_t*)s, key); }
+#define _RUNNER_QUICKLOAD_FUNC(sys) \
+    static bool _runner_##sys##_quickload(void* s, const uint8_t* ptr, int size) { return sys##_quickload((sys##_t*)s, ptr, size); }
+
+/*=== Acorn Atom =============================================================*/
+_RUNNER_COMMON_FUNCS(atom)
+_RUNNER_KEY_FUNCS(atom)
+
+static bool _runner_atom_init(runner_t* r, const runner_desc_t* desc) {
+    if (desc->type) {
+        return false;
+    }
+    atom_init((atom_t*)r->sys, &(atom_desc_t){
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_abasic = dump_abasic_ic20,
+        .rom_abasic_size = sizeof(dump_abasic_ic20),
+        .rom_afloat = dump_afloat_ic21,
+        .rom_afloat_size = sizeof(dump_afloat_ic21),
+        .rom_dosrom = dump_dosrom_u15,
+        .rom_dosrom_size = sizeof(dump_dosrom_u15)
+    });
+    return true;
+}
+
+/*=== Bomb Jack arcade =======================================================*/
+_RUNNER_COMMON_FUNCS(bombjack)
+
+static bool _runner_bombjack_init(runner_t* r, const runner_desc_t* desc) {
+    if (desc->type) {
+        return false;
+    }
+    bombjack_init((bombjack_t*)r->sys, &(bombjack_desc_t){
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_main_0000_1FFF = dump_09_j01b_bin,     .rom_main_0000_1FFF_size = sizeof(dump_09_j01b_bin),
+        .rom_main_2000_3FFF = dump_10_l01b_bin,     .rom_main_2000_3FFF_size = sizeof(dump_10_l01b_bin),
+        .rom_main_4000_5FFF = dump_11_m01b_bin,     .rom_main_4000_5FFF_size = sizeof(dump_11_m01b_bin),
+        .rom_main_6000_7FFF = dump_12_n01b_bin,     .rom_main_6000_7FFF_size = sizeof(dump_12_n01b_bin),
+        .rom_main_C000_DFFF = dump_13_1r,           .rom_main_C000_DFFF_size = sizeof(dump_13_1r),
+        .rom_sound_0000_1FFF = dump_01_h03t_bin,    .rom_sound_0000_1FFF_size = sizeof(dump_01_h03t_bin),
+        .rom_chars_0000_0FFF = dump_03_e08t_bin,    .rom_chars_0000_0FFF_size = sizeof(dump_03_e08t_bin),
+        .rom_chars_1000_1FFF = dump_04_h08t_bin,    .rom_chars_1000_1FFF_size = sizeof(dump_04_h08t_bin),
+        .rom_chars_2000_2FFF = dump_05_k08t_bin,    .rom_chars_2000_2FFF_size = sizeof(dump_05_k08t_bin),
+        .rom_tiles_0000_1FFF = dump_06_l08t_bin,    .rom_tiles_0000_1FFF_size = sizeof(dump_06_l08t_bin),
+        .rom_tiles_2000_3FFF = dump_07_n08t_bin,    .rom_tiles_2000_3FFF_size = sizeof(dump_07_n08t_bin),
+        .rom_tiles_4000_5FFF = dump_08_r08t_bin,    .rom_tiles_4000_5FFF_size = sizeof(dump_08_r08t_bin),
+        .rom_sprites_0000_1FFF = dump_16_m07b_bin,  .rom_sprites_0000_1FFF_size = sizeof(dump_16_m07b_bin),
+        .rom_sprites_2000_3FFF = dump_15_l07b_bin,  .rom_sprites_2000_3FFF_size = sizeof(dump_15_l07b_bin),
+        .rom_sprites_4000_5FFF = dump_14_j07b_bin,  .rom_sprites_4000_5FFF_size = sizeof(dump_14_j07b_bin),
+        .rom_maps_0000_0FFF = dump_02_p04t_bin,     .rom_maps_0000_0FFF_size = sizeof(dump_02_p04t_bin)
+    });
+    return true;
+}
+
+static void _runner_bombjack_key(void* s, int key, bool down) {
+    bombjack_t* bj = (bombjack_t*) s;
+    uint8_t* port = &bj->mainboard.p1;
+    uint8_t mask;
+    switch (key) {
+        case 0x09:  mask = BOMBJACK_JOYSTICK_RIGHT; break;
+        case 0x08:  mask = BOMBJACK_JOYSTICK_LEFT; break;
+        case 0x0B:  mask = BOMBJACK_JOYSTICK_UP; break;
+        case 0x0A:  mask = BOMBJACK_JOYSTICK_DOWN; break;
+        case ' ':   mask = BOMBJACK_JOYSTICK_BUTTON; break;
+        case '1':   port = &bj->mainboard.sys; mask = BOMBJACK_SYS_P1_COIN; break;
+        default:    port = &bj->mainboard.sys; mask = BOMBJACK_SYS_P1_START; break;
+    }
+    if (down) {
+        *port |= mask;
+    }
+    else {
+        *port &= ~mask;
+    }
+}
+
+static void _runner_bombjack_key_down(void* s, int key) {
+    _runner_bombjack_key(s, key, true);
+}
+
+static void _runner_bombjack_key_up(void* s, int key) {
+    _runner_bombjack_key(s, key, false);
+}
+
+/*=== Commodore C64 ==========================================================*/
+_RUNNER_COMMON_FUNCS(c64)
+_RUNNER_KEY_FUNCS(c64)
+_RUNNER_QUICKLOAD_FUNC(c64)
+
+static bool _runner_c64_init(runner_t* r, const runner_desc_t* desc) {
+    if (desc->type) {
+        return false;
+    }
+    c64_init((c64_t*)r->sys, &(c64_desc_t){
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_char = dump_c64_char_bin,
+        .rom_char_size = sizeof(dump_c64_char_bin),
+        .rom_basic = dump_c64_basic_bin,
+        .rom_basic_size = sizeof(dump_c64_basic_bin),
+        .rom_kernal = dump_c64_kernalv3_bin,
+        .rom_kernal_size = sizeof(dump_c64_kernalv3_bin),
+        .c1541_rom_c000_dfff = dump_1541_c000_325302_01_bin,
+        .c1541_rom_c000_dfff_size = sizeof(dump_1541_c000_325302_01_bin),
+        .c1541_rom_e000_ffff = dump_1541_e000_901229_06aa_bin,
+        .c1541_rom_e000_ffff_size = sizeof(dump_1541_e000_901229_06aa_bin)
+    });
+    return true;
+}
+
+/*=== Amstrad CPC ============================================================*/
+_RUNNER_COMMON_FUNCS(cpc)
+_RUNNER_KEY_FUNCS(cpc)
+_RUNNER_QUICKLOAD_FUNC(cpc)
+
+static bool _runner_cpc_init(runner_t* r, const runner_desc_t* desc) {
+    cpc_type_t type;
+    if (_runner_type(desc->type, "cpc6128", true)) {
+        type = CPC_TYPE_6128;
+    }
+    else if (_runner_type(desc->type, "cpc464", false)) {
+        type = CPC_TYPE_464;
+    }
+    else if (_runner_type(desc->type, "kccompact", false)) {
+        type = CPC_TYPE_KCCOMPACT;
+    }
+    else {
+        return false;
+    }
+    r->type = (int)type;
+    cpc_init((cpc_t*)r->sys, &(cpc_desc_t){
+        .type = type,
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_464_os = dump_cpc464_os_bin,
+        .rom_464_os_size = sizeof(dump_cpc464_os_bin),
+        .rom_464_basic = dump_cpc464_basic_bin,
+        .rom_464_basic_size = sizeof(dump_cpc464_basic_bin),
+        .rom_6128_os = dump_cpc6128_os_bin,
+        .rom_6128_os_size = sizeof(dump_cpc6128_os_bin),
+        .rom_6128_basic = dump_cpc6128_basic_bin,
+        .rom_6128_basic_size = sizeof(dump_cpc6128_basic_bin),
+        .rom_6128_amsdos = dump_cpc6128_amsdos_bin,
+        .rom_6128_amsdos_size = sizeof(dump_cpc6128_amsdos_bin),
+        .rom_kcc_os = dump_kcc_os_bin,
+        .rom_kcc_os_size = sizeof(dump_kcc_os_bin),
+        .rom_kcc_basic = dump_kcc_bas_bin,
+        .rom_kcc_basic_size = sizeof(dump_kcc_bas_bin)
+    });
+    return true;
+}
+
+/*=== KC85/2, /3 and /4 ======================================================*/
+_RUNNER_COMMON_FUNCS(kc85)
+_RUNNER_KEY_FUNCS(kc85)
+_RUNNER_QUICKLOAD_FUNC(kc85)
+
+static bool _runner_kc85_init(runner_t* r, const runner_desc_t* desc) {
+    kc85_type_t type;
+    if (_runner_type(desc->type, "kc85_2", true)) {
+        type = KC85_TYPE_2;
+    }
+    else if (_runner_type(desc->type, "kc85_3", false)) {
+        type = KC85_TYPE_3;
+    }
+    else if (_runner_type(desc->type, "kc85_4", false)) {
+        type = KC85_TYPE_4;
+    }
+    else {
+        return false;
+    }
+    r->type = (int)type;
+    kc85_init((kc85_t*)r->sys, &(kc85_desc_t){
+        .type = type,
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_caos22 = dump_caos22_852,
+        .rom_caos22_size = sizeof(dump_caos22_852),
+        .rom_caos31 = dump_caos31_853,
+        .rom_caos31_size = sizeof(dump_caos31_853),
+        .rom_caos42c = dump_caos42c_854,
+        .rom_caos42c_size = sizeof(dump_caos42c_854),
+        .rom_caos42e = dump_caos42e_854,
+        .rom_caos42e_size = sizeof(dump_caos42e_854),
+        .rom_kcbasic = dump_basic_c0_853,
+        .rom_kcbasic_size = sizeof(dump_basic_c0_853)
+    });
+    return true;
+}
+
+/*=== Pacman arcade ==========================================================*/
+_RUNNER_COMMON_FUNCS(namco)
+
+static bool _runner_pacman_init(runner_t* r, const runner_desc_t* desc) {
+    if (desc->type) {
+        return false;
+    }
+    namco_init((namco_t*)r->sys, &(namco_desc_t){
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_cpu_0000_0FFF = dump_pacman_6e, .rom_cpu_0000_0FFF_size = sizeof(dump_pacman_6e),
+        .rom_cpu_1000_1FFF = dump_pacman_6f, .rom_cpu_1000_1FFF_size = sizeof(dump_pacman_6f),
+        .rom_cpu_2000_2FFF = dump_pacman_6h, .rom_cpu_2000_2FFF_size = sizeof(dump_pacman_6h),
+        .rom_cpu_3000_3FFF = dump_pacman_6j, .rom_cpu_3000_3FFF_size = sizeof(dump_pacman_6j),
+        .rom_gfx_0000_0FFF = dump_pacman_5e, .rom_gfx_0000_0FFF_size = sizeof(dump_pacman_5e),
+        .rom_gfx_1000_1FFF = dump_pacman_5f, .rom_gfx_1000_1FFF_size = sizeof(dump_pacman_5f),
+        .rom_prom_0000_001F = dump_82s123_7f, .rom_prom_0000_001F_size = sizeof(dump_82s123_7f),
+        .rom_prom_0020_011F = dump_82s126_4a, .rom_prom_0020_011F_size = sizeof(dump_82s126_4a),
+        .rom_sound_0000_00FF = dump_82s126_1m, .rom_sound_0000_00FF_size = sizeof(dump_82s126_1m),
+        .rom_sound_0100_01FF = dump_82s126_3m, .rom_sound_0100_01FF_size = sizeof(dump_82s126_3m)
+    });
+    return true;
+}
+
+static void _runner_namco_key(void* s, int key, bool down) {
+    namco_t* sys = (namco_t*) s;
+    uint32_t mask;
+    switch (key) {
+        case 0x09:  mask = NAMCO_INPUT_P1_RIGHT; break;
+        case 0x08:  mask = NAMCO_INPUT_P1_LEFT; break;
+        case 0x0B:  mask = NAMCO_INPUT_P1_UP; break;
+        case 0x0A:  mask = NAMCO_INPUT_P1_DOWN; break;
+        case '1':   mask = NAMCO_INPUT_P1_COIN; break;
+        case '2':   mask = NAMCO_INPUT_P2_COIN; break;
+        default:    mask = NAMCO_INPUT_P1_START; break;
+    }
+    if (down) {
+        namco_input_set(sys, mask);
+    }
+    else {
+        namco_input_clear(sys, mask);
+    }
+}
+
+static void _runner_namco_key_down(void* s, int key) {
+    _runner_namco_key(s, key, true);
+}
+
+static void _runner_namco_key_up(void* s, int key) {
+    _runner_namco_key(s, key, false);
+}
+
+/*=== Commodore VIC-20 =======================================================*/
+_RUNNER_COMMON_FUNCS(vic20)
+_RUNNER_KEY_FUNCS(vic20)
+_RUNNER_QUICKLOAD_FUNC(vic20)
+
+static bool _runner_vic20_init(runner_t* r, const runner_desc_t* desc) {
+    vic20_memory_config_t mem_config;
+    if (!desc->type) {
+        mem_config = VIC20_MEMCONFIG_STANDARD;
+    }
+    else if (_runner_type(desc->type, "ram8k", false)) {
+        mem_config = VIC20_MEMCONFIG_8K;
+    }
+    else if (_runner_type(desc->type, "ram16k", false)) {
+        mem_config = VIC20_MEMCONFIG_16K;
+    }
+    else if (_runner_type(desc->type, "ram24k", false)) {
+        mem_config = VIC20_MEMCONFIG_24K;
+    }
+    else if (_runner_type(desc->type, "ram32k", false)) {
+        mem_config = VIC20_MEMCONFIG_32K;
+    }
+    else if (_runner_type(desc->type, "maxram", false)) {
+        mem_config = VIC20_MEMCONFIG_MAX;
+    }
+    else {
+        return false;
+    }
+    r->type = (int)mem_config;
+    vic20_init((vic20_t*)r->sys, &(vic20_desc_t){
+        .mem_config = mem_config,
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .audio_volume = 0.3f,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_char = dump_vic20_characters_901460_03_bin,
+        .rom_char_size = sizeof(dump_vic20_characters_901460_03_bin),
+        .rom_basic = dump_vic20_basic_901486_01_bin,
+        .rom_basic_size = sizeof(dump_vic20_basic_901486_01_bin),
+        .rom_kernal = dump_vic20_kernal_901486_07_bin,
+        .rom_kernal_size = sizeof(dump_vic20_kernal_901486_07_bin)
+    });
+    return true;
+}
+
+/*=== Robotron Z1013 =========================================================*/
+_RUNNER_COMMON_FUNCS(z1013)
+_RUNNER_KEY_FUNCS(z1013)
+_RUNNER_QUICKLOAD_FUNC(z1013)
+
+static bool _runner_z1013_init(runner_t* r, const runner_desc_t* desc) {
+    z1013_type_t type;
+    if (_runner_type(desc->type, "z1013_64", true)) {
+        type = Z1013_TYPE_64;
+    }
+    else if (_runner_type(desc->type, "z1013_16", false)) {
+        type = Z1013_TYPE_16;
+    }
+    else if (_runner_type(desc->type, "z1013_01", false)) {
+        type = Z1013_TYPE_01;
+    }
+    else {
+        return false;
+    }
+    r->type = (int)type;
+    /* the Z1013 has no audio output */
+    z1013_init((z1013_t*)r->sys, &(z1013_desc_t){
+        .type = type,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_mon_a2 = dump_z1013_mon_a2_bin,
+        .rom_mon_a2_size = sizeof(dump_z1013_mon_a2_bin),
+        .rom_mon202 = dump_z1013_mon202_bin,
+        .rom_mon202_size = sizeof(dump_z1013_mon202_bin),
+        .rom_font = dump_z1013_font_bin,
+        .rom_font_size = sizeof(dump_z1013_font_bin)
+    });
+    return true;
+}
+
+/*=== Robotron Z9001 and KC87 ================================================*/
+_RUNNER_COMMON_FUNCS(z9001)
+_RUNNER_KEY_FUNCS(z9001)
+_RUNNER_QUICKLOAD_FUNC(z9001)
+
+static bool _runner_z9001_init(runner_t* r, const runner_desc_t* desc) {
+    z9001_type_t type;
+    if (_runner_type(desc->type, "z9001", true)) {
+        type = Z9001_TYPE_Z9001;
+    }
+    else if (_runner_type(desc->type, "kc87", false)) {
+        type = Z9001_TYPE_KC87;
+    }
+    else {
+        return false;
+    }
+    r->type = (int)type;
+    z9001_init((z9001_t*)r->sys, &(z9001_desc_t){
+        .type = type,
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_z9001_os_1 = dump_z9001_os12_1_bin,
+        .rom_z9001_os_1_size = sizeof(dump_z9001_os12_1_bin),
+        .rom_z9001_os_2 = dump_z9001_os12_2_bin,
+        .rom_z9001_os_2_size = sizeof(dump_z9001_os12_2_bin),
+        .rom_z9001_basic = dump_z9001_basic_507_511_bin,
+        .rom_z9001_basic_size = sizeof(dump_z9001_basic_507_511_bin),
+        .rom_z9001_font = dump_z9001_font_bin,
+        .rom_z9001_font_size = sizeof(dump_z9001_font_bin),
+        .rom_kc87_os = dump_kc87_os_2_bin,
+        .rom_kc87_os_size = sizeof(dump_kc87_os_2_bin),
+        .rom_kc87_basic = dump_z9001_basic_bin,
+        .rom_kc87_basic_size = sizeof(dump_z9001_basic_bin),
+        .rom_kc87_font = dump_kc87_font_2_bin,
+        .rom_kc87_font_size = sizeof(dump_kc87_font_2_bin)
+    });
+    return true;
+}
+
+/*=== ZX Spectrum 48K and 128 ================================================*/
+_RUNNER_COMMON_FUNCS(zx)
+_RUNNER_KEY_FUNCS(zx)
+_RUNNER_QUICKLOAD_FUNC(zx)
+
+static bool _runner_zx_init(runner_t* r, const runner_desc_t* desc) {
+    zx_type_t type;
+    if (_runner_type(desc->type, "zx128", true)) {
+        type = ZX_TYPE_128;
+    }
+    else if (_runner_type(desc->type, "zx48k", false)) {
+        type = ZX_TYPE_48K;
+    }
+    else {
+        return false;
+    }
+    r->type = (int)type;
+    zx_init((zx_t*)r->sys, &(zx_desc_t){
+        .type = type,
+        .audio_cb = _runner_audio_cb,
+        .audio_sample_rate = r->sample_rate,
+        .user_data = r,
+        .pixel_buffer = r->pixels,
+        .pixel_buffer_size = r->pixels_size,
+        .rom_zx48k = dump_amstrad_zx48k_bin,
+        .rom_zx48k_size = sizeof(dump_amstrad_zx48k_bin),
+        .rom_zx128_0 = dump_amstrad_zx128k_0_bin,
+        .rom_zx128_0_size = sizeof(dump_amstrad_zx128k_0_bin),
+        .rom_zx128_1 = dump_amstrad_zx128k_1_bin,
+        .rom_zx128_1_size = sizeof(dump_amstrad_zx128k_1_bin)
+    });
+    return true;
+}
+
+/*=== system table ===========================================================*/
+#define _RUNNER_FUNCS(sys, init_func, quickload_func) { \
+    .size = sizeof(sys##_t), \
+    .max_display_size = sys##_max_display_size, \
+    .init = init_func, \
+    .discard = _runner_##sys##_discard, \
+    .exec = _runner_##sys##_exec, \
+    .key_down = _runner_##sys##_key_down, \
+    .key_up = _runner_##sys##_key_up, \
+    .display_width = _runner_##sys##_display_width, \
+    .display_height = _runner_##sys##_display_height, \
+    .quickload = quickload_func }
+
+static const runner_funcs_t _runner_funcs[RUNNER_NUM_SYSTEMS] = {
+    [RUNNER_SYSTEM_ATOM]        = _RUNNER_FUNCS(atom, _runner_atom_init, 0),
+    [RUNNER_SYSTEM_BOMBJACK]    = _RUNNER_FUNCS(bombjack, _runner_bombjack_init, 0),
+    [RUNNER_SYSTEM_C64]         = _RUNNER_FUNCS(c64, _runner_c64_init, _runner_c64_quickload),
+    [RUNNER_SYSTEM_CPC]         = _RUNNER_FUNCS(cpc, _runner_cpc_init, _runner_cpc_quickload),
+    [RUNNER_SYSTEM_KC85]        = _RUNNER_FUNCS(kc85, _runner_kc85_init, _runner_kc85_quickload),
+    [RUNNER_SYSTEM_PACMAN]      = _RUNNER_FUNCS(namco, _runner_pacman_init, 0),
+    [RUNNER_SYSTEM_VIC20]       = _RUNNER_FUNCS(vic20, _runner_vic20_init, _runner_vic20_quickload),
+    [RUNNER_SYSTEM_Z1013]       = _RUNNER_FUNCS(z1013, _runner_z1013_init, _runner_z1013_quickload),
+    [RUNNER_SYSTEM_Z9001]       = _RUNNER_FUNCS(z9001, _runner_z9001_init, _runner_z9001_quickload),
+    [RUNNER_SYSTEM_ZX]          = _RUNNER_FUNCS(zx, _runner_zx_init, _runner_zx_quickload),
+};
+
+/*=== public API =============================================================*/
+runner_t* runner_create(const runner_desc_t* desc) {
+    if (!desc || (desc->system < 0) || (desc->system >= RUNNER_NUM_SYSTEMS)) {
+        return 0;
+    }
+    const runner_funcs_t* funcs = &_runner_funcs[desc->system];
+    const size_t sys_offset = RUNNER_ALIGN(sizeof(runner_t));
+    const size_t pixels_offset = sys_offset + RUNNER_ALIGN(funcs->size);
+    /* the systems check the framebuffer against their max display size (debug visualization modes) */
+    const int pixels_size = funcs->max_display_size();
+    const size_t alloc_size = pixels_offset + (size_t)pixels_size;
+    uint8_t* ptr = (uint8_t*) calloc(1, alloc_size);
+    if (!ptr) {
+        return 0;
+    }
+    runner_t* r = (runner_t*) ptr;
+    r->system = desc->system;
+    r->funcs = funcs;
+    r->alloc_size = alloc_size;
+    r->sys = ptr + sys_offset;
+    r->pixels = (uint32_t*) (ptr + pixels_offset);
+    r->pixels_size = pixels_size;
+    r->sample_rate = (desc->audio_sample_rate > 0) ? desc->audio_sample_rate : RUNNER_DEFAULT_SAMPLE_RATE;
+    if (!funcs->init(r, desc)) {
+        free(ptr);
+        return 0;
+    }
+    return r;
+}
+
+void runner_destroy(runner_t* r) {
+    if (r) {
+        r->funcs->discard(r->sys);
+        #if defined(RUNNER_USE_MMAP)
+        if (r->mapped) {
+            munmap(r, r->alloc_size);
+            return;
+        }
+        #endif
+        free(r);
+    }
+}
+
+runner_system_t runner_system(const runner_t* r) {
+    return r->system;
+}
+
+void runner_exec(runner_t* r, uint32_t micro_seconds) {
+    r->funcs->exec(r->sys, micro_seconds);
+}
+
+void runner_exec_frames(runner_t* r, int num_frames) {
+    for (int i = 0; i < num_frames; i++) {
+        r->funcs->exec(r->sys, RUNNER_FRAME_USEC);
+    }
+}
+
+void runner_key_down(runner_t* r, int key_code) {
+    r->funcs->key_down(r->sys, key_code);
+}
+
+void runner_key_up(runner_t* r, int key_code) {
+    r->funcs->key_up(r->sys, key_code);
+}
+
+bool runner_quickload(runner_t* r, const void* ptr, int size) {
+    if (!r->funcs->quickload || !ptr || (size <= 0)) {
+        return false;
+    }
+    return r->funcs->quickload(r->sys, (const uint8_t*)ptr, size);
+}
+
+const uint32_t* runner_framebuffer(const runner_t* r, int* out_width, int* out_height) {
+    if (out_width) {
+        *out_width = r->funcs->display_width(r->sys);
+    }
+    if (out_height) {
+        *out_height = r->funcs->display_height(r->sys);
+    }
+    return r->pixels;
+}
+
+int runner_max_framebuffer_size(const runner_t* r) {
+    return r->pixels_size;
+}
+
+int runner_audio(runner_t* r, float* dst, int max_samples) {
+    int num = 0;
+    while ((num < max_samples) && (r->audio_tail != r->audio_head)) {
+        dst[num++] = r->audio[r->audio_tail++ & (RUNNER_AUDIO_RING_SIZE - 1)];
+    }
+    return num;
+}
+
+/* the snapshot is the header, followed by the system struct and framebuffer */
+size_t runner_snapshot_size(const runner_t* r) {
+    return sizeof(runner_snapshot_header_t) + (r->alloc_size - RUNNER_ALIGN(sizeof(runner_t)));
+}
+
+bool runner_snapshot(const runner_t* r, void* dst, size_t size) {
+    if (size < runner_snapshot_size(r)) {
+        return false;
+    }
+    const runner_snapshot_header_t hdr = {
+        .magic = RUNNER_SNAPSHOT_MAGIC,
+        .system = (uint32_t) r->system,
+        .type = r->type,
+        .base = (uint64_t)(uintptr_t) r,
+        .alloc_size = r->alloc_size
+    };
+    memcpy(dst, &hdr, sizeof(hdr));
+    memcpy((uint8_t*)dst + sizeof(hdr), r->sys, r->alloc_size - RUNNER_ALIGN(sizeof(runner_t)));
+    return true;
+}
+
+bool runner_restore(runner_t* r, const void* src, size_t size) {
+    runner_snapshot_header_t hdr;
+    if (size < runner_snapshot_size(r)) {
+        return false;
+    }
+    memcpy(&hdr, src, sizeof(hdr));
+    if ((hdr.magic != RUNNER_SNAPSHOT_MAGIC) ||
+        (hdr.system != (uint32_t)r->system) ||
+        (hdr.type != r->type) ||
+        (hdr.alloc_size != r->alloc_size))
+    {
+        return false;
+    }
+    const size_t state_size = r->alloc_size - RUNNER_ALIGN(sizeof(runner_t));
+    memcpy(r->sys, (const uint8_t*)src + sizeof(hdr), state_size);
+    /* pointers into the source instance (memory pages, framebuffer, callback
+       user data) must be moved to this instance, pointers to ROMs and
+       functions are the same for all instances
+    */
+    const uintptr_t old_start = (uintptr_t) hdr.base;
+    const uintptr_t old_end = old_start + r->alloc_size;
+    if (old_start != (uintptr_t)r) {
+        uint8_t* p = (uint8_t*) r->sys;
+        for (size_t i = 0; i + sizeof(uintptr_t) <= state_size; i += sizeof(uintptr_t)) {
+            uintptr_t val;
+            memcpy(&val, p + i, sizeof(val));
+            if ((val >= old_start) && (val < old_end)) {
+                val = val - old_start + (uintptr_t)r;
+                memcpy(p + i, &val, sizeof(val));
+            }
+        }
+    }
+    return true;
+}
+
+/* Forking: the instance is written once into an anonymous file, and each
+   fork is a private mapping of that file, so the pages are shared until
+   a fork writes to them (on the first frame that's the CPU and chip
+   state, the framebuffer and the RAM pages the program actually writes).
+   The offsets of all pointers into the instance are recorded when
+   freezing, so a fork only touches the pages with pointers to patch
+   them, instead of scanning the whole instance like runner_restore().
+
+   The systems copy their ROM images into the system struct, those pages
+   are never written, so all forks of a base share one copy of the ROMs.
+   A base can be saved to a file, and other processes of the same
+   executable can map that file, so that even across processes only one
+   copy of the ROMs (and of all unmodified RAM pages) is resident. For
+   this, pointers into the executable (functions, static data) are
+   recorded too, and moved by the difference between the load addresses.
+*/
+#define RUNNER_BASE_MAGIC (0x45534252)  /* 'RBSE' */
+#define RUNNER_BASE_VERSION (1)
+#define RUNNER_IMAGE_RANGE (256 * 1024 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t system;
+    uint32_t num_pointers;
+    uint32_t num_image_pointers;
+    uint32_t data_offset;           /* page aligned start of the instance data */
+    uint64_t alloc_size;
+    uint64_t layout;                /* executable layout, must match in the loading process */
+    uint64_t base;
+    uint64_t image;
+} runner_base_file_header_t;
+
+/* the anchor for pointers into the executable */
+static uintptr_t _runner_image_anchor(void) {
+    return (uintptr_t) &_runner_funcs[0];
+}
+
+static uint64_t _runner_layout(void) {
+    return (uint64_t)(_runner_image_anchor() - (uintptr_t)runner_create);
+}
+
+#if defined(RUNNER_USE_MMAP)
+static int _runner_anon_file(void) {
+    #if defined(__linux__)
+    return memfd_create("chips-runner", 0);
+    #else
+    char name[64];
+    static int counter = 0;
+    snprintf(name, sizeof(name), "/chips-runner-%d-%d", (int)getpid(), counter++);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+    return fd;
+    #endif
+}
+
+static bool _runner_pwrite(int fd, const void* ptr, size_t size, size_t offset) {
+    const uint8_t* p = (const uint8_t*) ptr;
+    while (size > 0) {
+        const ssize_t n = pwrite(fd, p, size, (off_t)offset);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += (size_t)n;
+    }
+    return true;
+}
+
+static bool _runner_pread(int fd, void* ptr, size_t size, size_t offset) {
+    uint8_t* p = (uint8_t*) ptr;
+    while (size > 0) {
+        const ssize_t n = pread(fd, p, size, (off_t)offset);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += (size_t)n;
+    }
+    return true;
+}
+#endif
+
+static bool _runner_push_offset(uint32_t** items, int* num, int* capacity, size_t offset) {
+    if (*num == *capacity) {
+        *capacity = *capacity ? (*capacity * 2) : 256;
+        uint32_t* new_items = (uint32_t*) realloc(*items, (size_t)*capacity * sizeof(uint32_t));
+        if (!new_items) {
+            return false;
+        }
+        *items = new_items;
+    }
+    (*items)[(*num)++] = (uint32_t) offset;
+    return true;
+}
+
+runner_base_t* runner_freeze(const runner_t* r) {
+    runner_base_t* base = (runner_base_t*) calloc(1, sizeof(runner_base_t));
+    if (!base) {
+        return 0;
+    }
+    #if defined(RUNNER_USE_MMAP)
+    base->fd = -1;
+    #endif
+    base->system = r->system;
+    base->alloc_size = r->alloc_size;
+    base->base = (uintptr_t) r;
+    base->image = _runner_image_anchor();
+    const uintptr_t start = (uintptr_t) r;
+    const uintptr_t end = start + r->alloc_size;
+    const uintptr_t image_start = base->image - RUNNER_IMAGE_RANGE;
+    const uintptr_t image_end = base->image + RUNNER_IMAGE_RANGE;
+    const uint8_t* p = (const uint8_t*) r;
+    int capacity = 0, image_capacity = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && (i + sizeof(uintptr_t) <= r->alloc_size); i += sizeof(uintptr_t)) {
+        uintptr_t val;
+        memcpy(&val, p + i, sizeof(val));
+        if ((val >= start) && (val < end)) {
+            ok = _runner_push_offset(&base->pointers, &base->num_pointers, &capacity, i);
+        }
+        else if ((val >= image_start) && (val < image_end)) {
+            ok = _runner_push_offset(&base->image_pointers, &base->num_image_pointers, &image_capacity, i);
+        }
+    }
+    #if defined(RUNNER_USE_MMAP)
+    if (ok) {
+        base->fd = _runner_anon_file();
+        ok = (base->fd >= 0) && (0 == ftruncate(base->fd, (off_t)r->alloc_size)) && _runner_pwrite(base->fd, p, r->alloc_size, 0);
+    }
+    #else
+    if (ok) {
+        base->data = (uint8_t*) malloc(r->alloc_size);
+        ok = (0 != base->data);
+        if (ok) {
+            memcpy(base->data, r, r->alloc_size);
+        }
+    }
+    #endif
+    if (!ok) {
+        runner_base_destroy(base);
+        return 0;
+    }
+    return base;
+}
+
+void runner_base_destroy(runner_base_t* base) {
+    if (base) {
+        #if defined(RUNNER_USE_MMAP)
+        if (base->fd >= 0) {
+            close(base->fd);
+        }
+        #else
+        free(base->data);
+        #endif
+        free(base->pointers);
+        free(base->image_pointers);
+        free(base);
+    }
+}
+
+bool runner_base_save(const runner_base_t* base, const char* path) {
+    #if defined(RUNNER_USE_MMAP)
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t offsets_size = ((size_t)base->num_pointers + (size_t)base->num_image_pointers) * sizeof(uint32_t);
+    const size_t data_offset = ((sizeof(runner_base_file_header_t) + offsets_size + page_size - 1) / page_size) * page_size;
+    const runner_base_file_header_t hdr = {
+        .magic = RUNNER_BASE_MAGIC,
+        .version = RUNNER_BASE_VERSION,
+        .system = (uint32_t) base->system,
+        .num_pointers = (uint32_t) base->num_pointers,
+        .num_image_pointers = (uint32_t) base->num_image_pointers,
+        .data_offset = (uint32_t) data_offset,
+        .alloc_size = base->alloc_size,
+        .layout = _runner_layout(),
+        .base = base->base,
+        .image = base->image
+    };
+    uint8_t* data = (uint8_t*) malloc(base->alloc_size);
+    if (!data) {
+        return false;
+    }
+    bool ok = _runner_pread(base->fd, data, base->alloc_size, base->data_offset);
+    /* write to a temporary file and rename, processes may be mapping the old file */
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = ok ? open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, 0644) : -1;
+    ok = (fd >= 0);
+    size_t pos = 0;
+    ok = ok && _runner_pwrite(fd, &hdr, sizeof(hdr), pos);
+    pos += sizeof(hdr);
+    ok = ok && _runner_pwrite(fd, base->pointers, (size_t)base->num_pointers * sizeof(uint32_t), pos);
+    pos += (size_t)base->num_pointers * sizeof(uint32_t);
+    ok = ok && _runner_pwrite(fd, base->image_pointers, (size_t)base->num_image_pointers * sizeof(uint32_t), pos);
+    ok = ok && _runner_pwrite(fd, data, base->alloc_size, data_offset);
+    if (fd >= 0) {
+        ok &= (0 == close(fd));
+    }
+    ok = ok && (0 == rename(tmp_path, path));
+    if (!ok) {
+        unlink(tmp_path);
+    }
+    free(data);
+    return ok;
+    #else
+    (void)base; (void)path;
+    return false;
+    #endif
+}
+
+runner_base_t* runner_base_load(const char* path) {
+    #if defined(RUNNER_USE_MMAP)
+    runner_base_file_header_t hdr;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    if ((0 != fstat(fd, &st)) ||
+        !_runner_pread(fd, &hdr, sizeof(hdr), 0) ||
+        (hdr.magic != RUNNER_BASE_MAGIC) ||
+        (hdr.version != RUNNER_BASE_VERSION) ||
+        (hdr.system >= RUNNER_NUM_SYSTEMS) ||
+        (hdr.layout != _runner_layout()) ||
+        ((hdr.data_offset % page_size) != 0) ||
+        ((uint64_t)st.st_size < ((uint64_t)hdr.data_offset + hdr.alloc_size)) ||
+        ((sizeof(hdr) + ((uint64_t)hdr.num_pointers + hdr.num_image_pointers) * sizeof(uint32_t)) > hdr.data_offset))
+    {
+        close(fd);
+        return 0;
+    }
+    runner_base_t* base = (runner_base_t*) calloc(1, sizeof(runner_base_t));
+    if (!base) {
+        close(fd);
+        return 0;
+    }
+    base->fd = fd;
+    base->system = (runner_system_t) hdr.system;
+    base->alloc_size = (size_t) hdr.alloc_size;
+    base->base = (uintptr_t) hdr.base;
+    base->image = (uintptr_t) hdr.image;
+    base->data_offset = hdr.data_offset;
+    base->num_pointers = (int) hdr.num_pointers;
+    base->num_image_pointers = (int) hdr.num_image_pointers;
+    base->pointers = (uint32_t*) malloc((hdr.num_pointers + 1) * sizeof(uint32_t));
+    base->image_pointers = (uint32_t*) malloc((hdr.num_image_pointers + 1) * sizeof(uint32_t));
+    bool ok = base->pointers && base->image_pointers &&
+        _runner_pread(fd, base->pointers, hdr.num_pointers * sizeof(uint32_t), sizeof(hdr)) &&
+        _runner_pread(fd, base->image_pointers, hdr.num_image_pointers * sizeof(uint32_t), sizeof(hdr) + hdr.num_pointers * sizeof(uint32_t));
+    for (int i = 0; ok && (i < base->num_pointers); i++) {
+        ok = (base->pointers[i] + sizeof(uintptr_t)) <= base->alloc_size;
+    }
+    for (int i = 0; ok && (i < base->num_image_pointers); i++) {
+        ok = (base->image_pointers[i] + sizeof(uintptr_t)) <= base->alloc_size;
+    }
+    if (!ok) {
+        runner_base_destroy(base);
+        return 0;
+    }
+    return base;
+    #else
+    (void)path;
+    return 0;
+    #endif
+}
+
+static void _runner_move_pointers(uint8_t* p, const uint32_t* offsets, int num, uintptr_t old_start, uintptr_t new_start) {
+    if (old_start == new_start) {
+        return;
+    }
+    for (int i = 0; i < num; i++) {
+        uintptr_t val;
+        memcpy(&val, p + offsets[i], sizeof(val));
+        val = val - old_start + new_start;
+        memcpy(p + offsets[i], &val, sizeof(val));
+    }
+}
+
+runner_t* runner_fork(const runner_base_t* base) {
+    #if defined(RUNNER_USE_MMAP)
+    void* ptr = mmap(0, base->alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, base->fd, (off_t)base->data_offset);
+    if (ptr == MAP_FAILED) {
+        return 0;
+    }
+    #else
+    void* ptr = malloc(base->alloc_size);
+    if (!ptr) {
+        return 0;
+    }
+    memcpy(ptr, base->data, base->alloc_size);
+    #endif
+    uint8_t* p = (uint8_t*) ptr;
+    _runner_move_pointers(p, base->pointers, base->num_pointers, base->base, (uintptr_t)p);
+    _runner_move_pointers(p, base->image_pointers, base->num_image_pointers, base->image, _runner_image_anchor());
+    runner_t* r = (runner_t*) ptr;
+    #if defined(RUNNER_USE_MMAP)
+    r->mapped = true;
+    #else
+    r->mapped = false;
+    #endif
+    return r;
+}
@@ -0,0 +1,123 @@
+#pragma once
+/*
+    runner.h -- emulator instances behind one C API, for embedding
+    the emulators into test harnesses and other host programs.
+
+    There's no dependency on sokol or any window system, and no global
+    state: each runner_t instance is a single allocation that contains
+    the emulated system, its framebuffer and an audio sample ring, so
+    a host program can create any number of instances and drive them
+    from any thread (but each instance only from one thread at a time).
+
+    Keyboard input uses the key codes of the emulated system (the same
+    codes the example frontends send in their app_input() functions,
+    mostly ASCII, 0x08..0x0B are cursor left/right/down/up, 0x0D is
+    Enter). The arcade machines map cursor keys to the player 1
+    joystick, space to the fire button, '1' and '2' to the coin slots
+    and any other key to the player 1 start button.
+
+    The LC-80 is not supported. Its only output is the 7-segment LED
+    display, which the debugger UI draws from the system state, and
+    there's no keyboard mapping for its hex keypad yet (the lc80 example
+    doesn't forward key input either). Once the keypad mapping exists,
+    it can be added as a system with a 0x0 framebuffer.
+
+    Snapshots are plain memory blocks of runner_snapshot_size() bytes,
+    and can be restored into any instance of the same system and type
+    in the same process.
+
+    For tree searches, runner_freeze() turns the current state of an
+    instance into a read-only base, and runner_fork() creates new
+    instances from a base. On POSIX systems forks share the memory
+    pages of the base copy-on-write, so a fork only costs the pages
+    it writes to, not the whole system state. The base must outlive
+    its forks.
+
+    The systems keep a copy of their ROMs in the system struct. Those
+    pages are never written, so all forks of a base share one copy.
+    runner_base_save() writes a base to a file, and processes of the
+    same executable can runner_base_load() it and fork from it, then
+    the kernel's page cache holds one copy of the ROMs and unmodified
+    RAM pages for all processes (POSIX only).
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    RUNNER_SYSTEM_ATOM,
+    RUNNER_SYSTEM_BOMBJACK,
+    RUNNER_SYSTEM_C64,
+    RUNNER_SYSTEM_CPC,
+    RUNNER_SYSTEM_KC85,
+    RUNNER_SYSTEM_PACMAN,
+    RUNNER_SYSTEM_VIC20,
+    RUNNER_SYSTEM_Z1013,
+    RUNNER_SYSTEM_Z9001,
+    RUNNER_SYSTEM_ZX,
+    RUNNER_NUM_SYSTEMS
+} runner_system_t;
+
+typedef struct {
+    runner_system_t system;
+    /* optional model, same as the frontend's type= (or exp= for the vic20) argument:
+        cpc: "cpc464", "cpc6128" (default), "kccompact"
+        kc85: "kc85_2" (default), "kc85_3", "kc85_4"
+        vic20: "ram8k", "ram16k", "ram24k", "ram32k", "maxram"
+        z1013: "z1013_01", "z1013_16", "z1013_64" (default)
+        z9001: "z9001" (default), "kc87"
+        zx: "zx48k", "zx128" (default)
+    */
+    const char* type;
+    int audio_sample_rate;          /* default: 44100 */
+} runner_desc_t;
+
+typedef struct runner_t runner_t;
+typedef struct runner_base_t runner_base_t;
+
+/* create an emulator instance, returns 0 if the system or type is unknown */
+runner_t* runner_create(const runner_desc_t* desc);
+/* destroy an emulator instance */
+void runner_destroy(runner_t* runner);
+/* get the system of an instance */
+runner_system_t runner_system(const runner_t* runner);
+/* run the emulation for a number of microseconds */
+void runner_exec(runner_t* runner, uint32_t micro_seconds);
+/* run the emulation for a number of 60 Hz frames */
+void runner_exec_frames(runner_t* runner, int num_frames);
+/* press a key */
+void runner_key_down(runner_t* runner, int key_code);
+/* release a key */
+void runner_key_up(runner_t* runner, int key_code);
+/* load a program file (.prg, .sna, .z80, .kcc, ...), returns false if not supported by the system */
+bool runner_quickload(runner_t* runner, const void* ptr, int size);
+/* get the RGBA8 framebuffer, and its width and height in pixels */
+const uint32_t* runner_framebuffer(const runner_t* runner, int* out_width, int* out_height);
+/* get the framebuffer size in bytes, the display can be larger than the std display (debug visualization) */
+int runner_max_framebuffer_size(const runner_t* runner);
+/* copy up to 'max_samples' generated audio samples (mono) to 'dst', returns number of samples */
+int runner_audio(runner_t* runner, float* dst, int max_samples);
+/* size of a snapshot in bytes */
+size_t runner_snapshot_size(const runner_t* runner);
+/* write a snapshot to 'dst', returns false if 'size' is too small */
+bool runner_snapshot(const runner_t* runner, void* dst, size_t size);
+/* restore a snapshot, returns false if the snapshot belongs to a different system or type */
+bool runner_restore(runner_t* runner, const void* src, size_t size);
+/* create a fork base from the current state of an instance */
+runner_base_t* runner_freeze(const runner_t* runner);
+/* destroy a fork base (after all its forks have been destroyed) */
+void runner_base_destroy(runner_base_t* base);
+/* save a fork base to a file, for sharing it with other processes */
+bool runner_base_save(const runner_base_t* base, const char* path);
+/* load a fork base from a file, returns 0 if the file is invalid or from another executable */
+runner_base_t* runner_base_load(const char* path);
+/* create a new instance from a fork base, destroy with runner_destroy() */
+runner_t* runner_fork(const runner_base_t* base);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -83,6 +83,7 @@ void atomui_exec(uint32_t frame_time_us) {
     uint64_t start = stm_now();
     ui_atom_exec(&ui_atom, frame_time_us);
     exec_time = ui_atom.dbg.dbg.stopped ? 0.0 : stm_ms(stm_since(start));
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -86,6 +86,7 @@ void app_init(void) {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = atom_max_display_size(),
         .top_offset = ui_extra_height
     });
     keybuf_init(10);
@@ -94,11 +95,12 @@ void app_init(void) {
     fs_init();
     if (sargs_exists("file")) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
     atom_joystick_type_t joy_type = ATOM_JOYSTICKTYPE_NONE;
     if (sargs_exists("joystick")) {
         if (sargs_equals("joystick", "mmc") || sargs_equals("joystick", "yes")) {
@@ -110,6 +112,22 @@ void app_init(void) {
     #ifdef CHIPS_USE_UI
     atomui_init(&atom);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "atom",
+        .anchor = &atom,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&atom, sizeof(atom), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(atom.ram, sizeof(atom.ram));
+    reloc_exclude(atom.rom_abasic, sizeof(atom.rom_abasic));
+    reloc_exclude(atom.rom_afloat, sizeof(atom.rom_afloat));
+    reloc_exclude(atom.rom_dosrom, sizeof(atom.rom_dosrom));
+    savestate_add_region(gfx_framebuffer(), atom_display_width(&atom) * atom_display_height(&atom) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
     /* keyboard input to send to emulator */
     if (!delay_input) {
         if (sargs_exists("input")) {
@@ -128,14 +146,14 @@ void app_frame() {
     #endif
     gfx_draw(atom_display_width(&atom), atom_display_height(&atom));
     const uint32_t load_delay_frames = 48;
-    if (fs_ptr() && clock_frame_count_60hz() > load_delay_frames) {
+    if (fs_ptr(FS_SLOT_IMAGE) && clock_frame_count_60hz() > load_delay_frames) {
         bool load_success = false;
-        if (fs_ext("txt") || fs_ext("bas")) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
-        if (fs_ext("tap")) {
-            load_success = atom_insert_tape(&atom, fs_ptr(), fs_size());
+        if (fs_ext(FS_SLOT_IMAGE, "tap")) {
+            load_success = atom_insert_tape(&atom, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
@@ -148,7 +166,11 @@ void app_frame() {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
     if (0 != (key_code = keybuf_get(frame_time))) {
@@ -165,6 +187,17 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     int c = 0;
     switch (event->type) {
         case SAPP_EVENTTYPE_CHAR:
@@ -217,9 +250,13 @@ void app_input(const sapp_event* event) {
 /* application cleanup callback */
 void app_cleanup(void) {
     atom_discard(&atom);
+    savestate_shutdown();
     #ifdef CHIPS_USE_UI
     atomui_discard();
     #endif
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
     sargs_shutdown();
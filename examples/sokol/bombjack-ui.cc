@@ -82,6 +82,7 @@ void bombjackui_exec(bombjack_t* bj, uint32_t frame_time_us) {
     }
     bombjack_decode_video(bj);
     exec_time = stm_ms(stm_since(start));
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } // extern "C"
@@ -60,6 +60,7 @@ static void app_init(void) {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = bombjack_max_display_size(),
         .top_offset = ui_extra_height,
         .aspect_x = 4,
         .aspect_y = 5,
@@ -92,6 +93,20 @@ static void app_init(void) {
     #ifdef CHIPS_USE_UI
     bombjackui_init(&bj);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "bombjack",
+        .anchor = &bj,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&bj, sizeof(bj), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(bj.main_ram, sizeof(bj.main_ram));
+    reloc_exclude(bj.sound_ram, sizeof(bj.sound_ram));
+    savestate_add_region(gfx_framebuffer(), bombjack_display_width(&bj) * bombjack_display_height(&bj) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
 }
 
 /* per-frame callback */
@@ -101,7 +116,9 @@ static void app_frame(void) {
     #else
         bombjack_exec(&bj, clock_frame_time());
     #endif
+    const uint64_t decode_start = stm_now();
     bombjack_decode_video(&bj);
+    prof_push(PROF_DECODE, (float)stm_ms(stm_since(decode_start)));
     gfx_draw(bombjack_display_width(&bj), bombjack_display_height(&bj));
 }
 
@@ -113,6 +130,17 @@ static void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     switch (event->type) {
         case SAPP_EVENTTYPE_KEY_DOWN:
             switch (event->key_code) {
@@ -154,6 +182,7 @@ static void app_cleanup(void) {
     bombjackui_discard();
     #endif
     bombjack_discard(&bj);
+    savestate_shutdown();
     saudio_shutdown();
     gfx_shutdown();
 }
@@ -84,6 +84,7 @@ void c64ui_exec(uint32_t frame_time_us) {
     uint64_t start = stm_now();
     ui_c64_exec(&ui_c64, frame_time_us);
     exec_time = ui_c64.dbg.dbg.stopped ? 0.0 : stm_ms(stm_since(start));
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -31,6 +31,20 @@ static const int ui_extra_height = 0;
 
 c64_t c64;
 
+/* frames until the C64 is at the READY prompt and media files can be loaded */
+static const uint32_t load_delay_frames = 180;
+
+/* true while the rewind hotkey is held down */
+static bool rewinding;
+
+/* KERNAL keyboard buffer, used for turbo typing */
+#define KERNAL_KEYD (0x0277)    /* keyboard buffer */
+#define KERNAL_NDX (0x00C6)     /* number of keys in the buffer */
+#define KERNAL_XMAX (0x0289)    /* buffer size, zero until the KERNAL is initialized */
+#define KERNAL_KEYD_SIZE (10)
+/* frames to wait for the keyboard scan after a turbo-typed key went through the key matrix */
+static int turbo_hold_frames;
+
 /* sokol-app entry, configure application callbacks and window */
 void app_init(void);
 void app_frame(void);
@@ -58,7 +72,10 @@ sapp_desc sokol_main(int argc, char* argv[]) {
 /* audio-streaming callback */
 static void push_audio(const float* samples, int num_samples, void* user_data) {
     (void)user_data;
-    saudio_push(samples, num_samples);
+    capture_audio(samples, num_samples);
+    if (!warp_active()) {
+        saudio_push(samples, num_samples);
+    }
 }
 
 /* get c64_desc_t struct based on joystick type */
@@ -84,27 +101,149 @@ c64_desc_t c64_desc(c64_joystick_type_t joy_type, bool c1530_enabled, bool c1541
     };
 }
 
+/* convert a key code to PETSCII (letters have inverted case like the key mapping), 0 if there's no equivalent */
+static uint8_t ascii_to_petscii(int c) {
+    if (((c >= 0x20) && (c < 0x60)) || (c == 0x0D)) {
+        return (uint8_t) c;
+    }
+    else if ((c >= 'a') && (c <= 'z')) {
+        /* shifted letters */
+        return (uint8_t) (c + 0x60);
+    }
+    else {
+        return 0;
+    }
+}
+
+/* apply a live or replayed input event to the emulator */
+static void apply_event(const journal_event_t* ev) {
+    switch (ev->type) {
+        case JOURNAL_EVENT_KEY_DOWN:
+            c64_key_down(&c64, ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_UP:
+            c64_key_up(&c64, ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_TYPED:
+            {
+                /* FIXME: this is ugly */
+                c64_joystick_type_t joy_type = c64.joystick_type;
+                c64.joystick_type = C64_JOYSTICKTYPE_NONE;
+                c64_key_down(&c64, ev->key);
+                c64_key_up(&c64, ev->key);
+                c64.joystick_type = joy_type;
+            }
+            break;
+        case JOURNAL_EVENT_KEY_INJECTED:
+            {
+                const uint8_t num = mem_rd(&c64.mem_cpu, KERNAL_NDX);
+                if (num < KERNAL_KEYD_SIZE) {
+                    mem_wr(&c64.mem_cpu, KERNAL_KEYD + num, ascii_to_petscii(ev->key));
+                    mem_wr(&c64.mem_cpu, KERNAL_NDX, num + 1);
+                }
+            }
+            break;
+        case JOURNAL_EVENT_MEDIA:
+            {
+                char name[32];
+                snprintf(name, sizeof(name), "journal.%s", ev->ext);
+                fs_load_mem((fs_slot_t)ev->slot, name, ev->data, ev->size);
+            }
+            break;
+    }
+}
+
+/* record an input event into the journal and apply it */
+static void input_event(journal_event_type_t type, int key) {
+    const journal_event_t ev = { .type = type, .key = key };
+    journal_record(&ev);
+    apply_event(&ev);
+}
+
+/* keybuf turbo mode callback, puts keys into the KERNAL keyboard buffer as soon as there's room */
+static bool type_key(uint8_t key) {
+    if (turbo_hold_frames > 0) {
+        turbo_hold_frames--;
+        return false;
+    }
+    const uint8_t num = mem_rd(&c64.mem_cpu, KERNAL_NDX);
+    if (ascii_to_petscii(key) != 0) {
+        uint8_t xmax = mem_rd(&c64.mem_cpu, KERNAL_XMAX);
+        if (xmax > KERNAL_KEYD_SIZE) {
+            xmax = KERNAL_KEYD_SIZE;
+        }
+        if (num >= xmax) {
+            return false;
+        }
+        input_event(JOURNAL_EVENT_KEY_INJECTED, key);
+    }
+    else {
+        /* cursor and function keys go through the key matrix, once the buffer
+           is empty, and the next keys must wait until the key was scanned
+        */
+        if (num != 0) {
+            return false;
+        }
+        input_event(JOURNAL_EVENT_KEY_TYPED, key);
+        turbo_hold_frames = 3;
+    }
+    return true;
+}
+
+/* record a loaded media file into the journal before it is inserted */
+static void record_media(fs_slot_t slot) {
+    journal_record(&(journal_event_t){
+        .type = JOURNAL_EVENT_MEDIA,
+        .slot = slot,
+        .ext = fs_ext_str(slot),
+        .data = fs_ptr(slot),
+        .size = fs_size(slot)
+    });
+}
+
 /* one-time application init */
 void app_init(void) {
     gfx_init(&(gfx_desc_t){
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = c64_max_display_size(),
         .top_offset = ui_extra_height
     });
     keybuf_init(5);
+    if (sargs_equals("typing", "turbo")) {
+        keybuf_set_turbo(type_key);
+    }
     clock_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
+    /* capture video and/or audio into Y4M and WAV files */
+    if (sargs_exists("capture_video") || sargs_exists("capture_audio")) {
+        if (!capture_init(&(capture_desc_t){
+            .video_path = sargs_exists("capture_video") ? sargs_value("capture_video") : 0,
+            .audio_path = sargs_exists("capture_audio") ? sargs_value("capture_audio") : 0,
+            .audio_sample_rate = saudio_sample_rate()
+        })) {
+            gfx_flash_error();
+        }
+    }
     fs_init();
+    /* record input into a journal, or replay a journal (media files are part of the journal) */
+    journal_init(&(journal_desc_t){
+        .record_path = sargs_exists("record") ? sargs_value("record") : 0,
+        .replay_path = sargs_exists("replay") ? sargs_value("replay") : 0,
+        .unthrottled = sargs_equals("replay_speed", "max"),
+        .event_cb = apply_event,
+    });
     bool delay_input = false;
-    if (sargs_exists("file")) {
+    if (sargs_exists("file") && !journal_replaying()) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
-    if (sargs_exists("prg")) {
-        if (!fs_load_base64("url.prg", sargs_value("prg"))) {
+    if (sargs_exists("prg") && !journal_replaying()) {
+        if (!fs_load_base64(FS_SLOT_IMAGE, "url.prg", sargs_value("prg"))) {
             gfx_flash_error();
         }
     }
@@ -127,6 +266,69 @@ void app_init(void) {
     #ifdef CHIPS_USE_UI
     c64ui_init(&c64);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "c64",
+        .anchor = &c64,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&c64, sizeof(c64), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(c64.color_ram, sizeof(c64.color_ram));
+    reloc_exclude(c64.ram, sizeof(c64.ram));
+    reloc_exclude(c64.rom_char, sizeof(c64.rom_char));
+    reloc_exclude(c64.rom_basic, sizeof(c64.rom_basic));
+    reloc_exclude(c64.rom_kernal, sizeof(c64.rom_kernal));
+    savestate_add_region(gfx_framebuffer(), c64_display_width(&c64) * c64_display_height(&c64) * sizeof(uint32_t), false);
+    /* restore the booted system from a cache file, or create the cache file after booting */
+    if (sargs_exists("bootcache") && !journal_recording() && !journal_replaying()) {
+        bootcache_init(&(bootcache_desc_t){
+            .dir = sargs_value("bootcache"),
+            .system = "c64",
+            .anchor = &c64,
+            .boot_frames = load_delay_frames
+        });
+        const int config[3] = { (int)joy_type, c1530_enabled, c1541_enabled };
+        bootcache_add_key(config, sizeof(config));
+        bootcache_add_key(dump_c64_char_bin, sizeof(dump_c64_char_bin));
+        bootcache_add_key(dump_c64_basic_bin, sizeof(dump_c64_basic_bin));
+        bootcache_add_key(dump_c64_kernalv3_bin, sizeof(dump_c64_kernalv3_bin));
+        bootcache_add_key(dump_1541_c000_325302_01_bin, sizeof(dump_1541_c000_325302_01_bin));
+        bootcache_add_key(dump_1541_e000_901229_06aa_bin, sizeof(dump_1541_e000_901229_06aa_bin));
+        bootcache_add_region(&c64, sizeof(c64), true);
+        bootcache_add_region(gfx_framebuffer(), c64_display_width(&c64) * c64_display_height(&c64) * sizeof(uint32_t), false);
+        bootcache_restore();
+    }
+    if (sargs_exists("state") && !journal_recording() && !journal_replaying()) {
+        savestate_load();
+    }
+    if (sargs_exists("rewind")) {
+        /* optional memory cap in MBytes, e.g. rewind=32 */
+        const int mbytes = atoi(sargs_value("rewind"));
+        const uint64_t max_bytes = (uint64_t)((mbytes > 0) ? mbytes : 0) * 1024 * 1024;
+        rewind_init(&(rewind_desc_t){ .max_bytes = (uint32_t)((max_bytes < REWIND_MAX_RING_SIZE) ? max_bytes : REWIND_MAX_RING_SIZE) });
+        rewind_add_region(&c64, sizeof(c64));
+        rewind_add_region(gfx_framebuffer(), c64_display_width(&c64) * c64_display_height(&c64) * sizeof(uint32_t));
+    }
+    /* per-frame state hashes, e.g. to compare a journal replay against a recorded run */
+    if (sargs_exists("hash_record") || sargs_exists("hash_compare")) {
+        if (statehash_init(&(statehash_desc_t){
+            .record_path = sargs_exists("hash_record") ? sargs_value("hash_record") : 0,
+            .compare_path = sargs_exists("hash_compare") ? sargs_value("hash_compare") : 0,
+        })) {
+            /* the system struct contains pointers into the framebuffer, itself and other statics (same order as savestate.h) */
+            reloc_add_range(gfx_framebuffer(), (size_t)gfx_framebuffer_size());
+            reloc_add_image(&c64);
+            const size_t ram_end = offsetof(c64_t, ram) + sizeof(c64.ram);
+            statehash_add_region("c64", &c64, offsetof(c64_t, ram), true);
+            statehash_add_region("c64", (uint8_t*)&c64 + ram_end, sizeof(c64) - ram_end, true);
+            statehash_add_region("ram", c64.ram, sizeof(c64.ram), false);
+            statehash_add_region("fb", gfx_framebuffer(), c64_display_width(&c64) * c64_display_height(&c64) * sizeof(uint32_t), false);
+        }
+        else {
+            gfx_flash_error();
+        }
+    }
     if (!delay_input) {
         if (sargs_exists("input")) {
             keybuf_put(sargs_value("input"));
@@ -134,43 +336,46 @@ void app_init(void) {
     }
 }
 
-/* per frame stuff, tick the emulator, handle input, decode and draw emulator display */
-void app_frame(void) {
-    const uint32_t frame_time = clock_frame_time();
+/* run one emulator frame, this is shared between live and replayed frames */
+static void emu_frame(uint32_t frame_time) {
     #ifdef CHIPS_USE_UI
         c64ui_exec(frame_time);
     #else
         c64_exec(&c64, frame_time);
     #endif
-    gfx_draw(c64_display_width(&c64), c64_display_height(&c64));
-    const uint32_t load_delay_frames = 180;
-    if (fs_ptr() && clock_frame_count_60hz() > load_delay_frames) {
+    rewind_capture();
+    capture_frame(gfx_framebuffer(), c64_display_width(&c64), c64_display_height(&c64));
+    statehash_frame();
+    bootcache_frame(frame_time);
+    journal_replay_events();
+    if (fs_ptr(FS_SLOT_IMAGE) && (journal_replaying() || bootcache_booted() || (clock_frame_count_60hz() > load_delay_frames))) {
+        record_media(FS_SLOT_IMAGE);
         bool load_success = false;
-        if (fs_ext("txt") || fs_ext("bas")) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("tap")) {
-            load_success = c64_insert_tape(&c64, fs_ptr(), fs_size());
+        else if (fs_ext(FS_SLOT_IMAGE, "tap")) {
+            load_success = c64_insert_tape(&c64, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("bin") || fs_ext("prg") || fs_ext("")) {
-            load_success = c64_quickload(&c64, fs_ptr(), fs_size());
+        else if (fs_ext(FS_SLOT_IMAGE, "bin") || fs_ext(FS_SLOT_IMAGE, "prg") || fs_ext(FS_SLOT_IMAGE, "")) {
+            load_success = c64_quickload(&c64, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
                 gfx_flash_success();
             }
-            if (fs_ext("tap")) {
+            if (fs_ext(FS_SLOT_IMAGE, "tap")) {
                 c64_tape_play(&c64);
             }
             if (!sargs_exists("debug")) {
                 if (sargs_exists("input")) {
                     keybuf_put(sargs_value("input"));
                 }
-                else if (fs_ext("tap")) {
+                else if (fs_ext(FS_SLOT_IMAGE, "tap")) {
                     keybuf_put("LOAD\n");
                 }
-                else if (fs_ext("prg")) {
+                else if (fs_ext(FS_SLOT_IMAGE, "prg")) {
                     keybuf_put("RUN\n");
                 }
             }
@@ -178,19 +383,48 @@ void app_frame(void) {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
-    if (0 != (key_code = keybuf_get(frame_time))) {
-        /* FIXME: this is ugly */
-        c64_joystick_type_t joy_type = c64.joystick_type;
-        c64.joystick_type = C64_JOYSTICKTYPE_NONE;
-        c64_key_down(&c64, key_code);
-        c64_key_up(&c64, key_code);
-        c64.joystick_type = joy_type;
+    if (!journal_replaying() && (0 != (key_code = keybuf_get(frame_time)))) {
+        input_event(JOURNAL_EVENT_KEY_TYPED, key_code);
     }
 }
 
+/* per frame stuff, tick the emulator, handle input, decode and draw emulator display */
+void app_frame(void) {
+    uint32_t frame_time = clock_frame_time();
+    if (rewinding && rewind_step_back()) {
+        /* while rewinding, the emulator isn't ticked, only the restored frame is displayed */
+        gfx_draw(c64_display_width(&c64), c64_display_height(&c64));
+        return;
+    }
+    /* warp while the tape motor is running */
+    warp_set_auto(0 == (c64.cas_port & C64_CASPORT_MOTOR));
+    /* in warp or unthrottled replay mode, run as many frames as fit into one host frame */
+    const uint64_t start = stm_now();
+    if (journal_replaying()) {
+        while (journal_replay_frame(&frame_time)) {
+            emu_frame(frame_time);
+            const bool unthrottled = journal_unthrottled() && (stm_ms(stm_since(start)) < 14.0);
+            if (!warp_continue(start, frame_time) && !unthrottled) {
+                break;
+            }
+        }
+    }
+    else {
+        do {
+            journal_record_frame(frame_time);
+            emu_frame(frame_time);
+        } while (warp_continue(start, frame_time));
+    }
+    gfx_draw(c64_display_width(&c64), c64_display_height(&c64));
+}
+
 /* keyboard input handling */
 void app_input(const sapp_event* event) {
     #ifdef CHIPS_USE_UI
@@ -199,6 +433,42 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press the End key to toggle warp mode */
+    if ((event->key_code == SAPP_KEYCODE_END) && (event->type == SAPP_EVENTTYPE_KEY_DOWN)) {
+        warp_toggle();
+        return;
+    }
+    if (journal_replaying()) {
+        /* live input would break the replay */
+        return;
+    }
+    /* press Page Up to save the system state, and Page Down to load it (not while recording, this would break the journal) */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && (event->key_code == SAPP_KEYCODE_PAGE_UP)) {
+        if (savestate_save()) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && (event->key_code == SAPP_KEYCODE_PAGE_DOWN) && !journal_recording()) {
+        if (savestate_load()) {
+            rewind_reset();
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
+    /* hold the Home key to step backward in time (not while recording, this would break the journal) */
+    if ((event->key_code == SAPP_KEYCODE_HOME) && rewind_enabled() && !journal_recording()) {
+        if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) || (event->type == SAPP_EVENTTYPE_KEY_UP)) {
+            rewinding = (event->type == SAPP_EVENTTYPE_KEY_DOWN);
+            return;
+        }
+    }
     const bool shift = event->modifiers & SAPP_MODIFIER_SHIFT;
     switch (event->type) {
         int c;
@@ -212,8 +482,8 @@ void app_input(const sapp_event* event) {
                 else if (islower(c)) {
                     c = toupper(c);
                 }
-                c64_key_down(&c64, c);
-                c64_key_up(&c64, c);
+                input_event(JOURNAL_EVENT_KEY_DOWN, c);
+                input_event(JOURNAL_EVENT_KEY_UP, c);
             }
             break;
         case SAPP_EVENTTYPE_KEY_DOWN:
@@ -239,10 +509,10 @@ void app_input(const sapp_event* event) {
             }
             if (c) {
                 if (event->type == SAPP_EVENTTYPE_KEY_DOWN) {
-                    c64_key_down(&c64, c);
+                    input_event(JOURNAL_EVENT_KEY_DOWN, c);
                 }
                 else {
-                    c64_key_up(&c64, c);
+                    input_event(JOURNAL_EVENT_KEY_UP, c);
                 }
             }
             break;
@@ -260,6 +530,20 @@ void app_cleanup(void) {
     c64ui_discard();
     #endif
     c64_discard(&c64);
+    savestate_shutdown();
+    rewind_print_stats();
+    rewind_shutdown();
+    statehash_print_stats();
+    statehash_shutdown();
+    bootcache_shutdown();
+    journal_shutdown();
+    if (capture_active()) {
+        capture_shutdown();
+        capture_print_stats();
+    }
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
 }
@@ -36,6 +36,8 @@
 #include "ui/ui_kbd.h"
 #include "ui/ui_fdd.h"
 #include "ui/ui_cpc.h"
+#include "tracez80.h"
+#include "heatz80.h"
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wmissing-field-initializers"
 #endif
@@ -76,23 +78,35 @@ void cpcui_init(cpc_t* cpc) {
     desc.dbg_keys.toggle_breakpoint_keycode = SAPP_KEYCODE_F9;
     desc.dbg_keys.toggle_breakpoint_name = "F9";
     ui_cpc_init(&ui_cpc, &desc);
+    /* execution history for the debugger (disable with trace=0) */
+    if (!sargs_equals("trace", "0")) {
+        trace_init(&tracez80_desc);
+    }
+    heatmap_init();
 }
 
 void cpcui_discard(void) {
     ui_cpc_discard(&ui_cpc);
+    trace_shutdown();
+    heatmap_shutdown();
     ui_discard();
 }
 
 void cpcui_exec(cpc_t* cpc, uint32_t frame_time_us) {
     if (ui_cpc_before_exec(&ui_cpc)) {
+        tracez80_attach(&cpc->cpu, &cpc->mem);
+        heatz80_attach(&cpc->cpu);
         uint64_t start = stm_now();
         cpc_exec(cpc, frame_time_us);
+        heatz80_detach(&cpc->cpu);
+        tracez80_detach(&cpc->cpu);
         exec_time = stm_ms(stm_since(start));
         ui_cpc_after_exec(&ui_cpc);
     }
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -18,6 +18,7 @@
 #include "chips/fdd_cpc.h"
 #include "systems/cpc.h"
 #include "cpc-roms.h"
+#include "guestprofz80.h"
 
 /* imports from cpc-ui.cc */
 #ifdef CHIPS_USE_UI
@@ -33,6 +34,12 @@ static const int ui_extra_height = 0;
 
 static cpc_t cpc;
 
+/* frames until the CPC is at the READY prompt and media files can be loaded */
+static const uint32_t load_delay_frames = 120;
+
+/* true while the rewind hotkey is held down */
+static bool rewinding;
+
 /* sokol-app entry, configure application callbacks and window */
 static void app_init(void);
 static void app_frame(void);
@@ -56,7 +63,10 @@ sapp_desc sokol_main(int argc, char* argv[]) {
 /* audio-streaming callback */
 static void push_audio(const float* samples, int num_samples, void* user_data) {
     (void)user_data;
-    saudio_push(samples, num_samples);
+    capture_audio(samples, num_samples);
+    if (!warp_active()) {
+        saudio_push(samples, num_samples);
+    }
 }
 
 /* get cpc_desc_t struct based on model and joystick type */
@@ -85,23 +95,94 @@ cpc_desc_t cpc_desc(cpc_type_t type, cpc_joystick_type_t joy_type) {
     };
 }
 
+/* apply a live or replayed input event to the emulator */
+static void apply_event(const journal_event_t* ev) {
+    switch (ev->type) {
+        case JOURNAL_EVENT_KEY_DOWN:
+            cpc_key_down(&cpc, ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_UP:
+            cpc_key_up(&cpc, ev->key);
+            break;
+        case JOURNAL_EVENT_KEY_TYPED:
+            cpc_key_down(&cpc, ev->key);
+            cpc_key_up(&cpc, ev->key);
+            break;
+        case JOURNAL_EVENT_MEDIA:
+            {
+                char name[32];
+                snprintf(name, sizeof(name), "journal.%s", ev->ext);
+                fs_load_mem((fs_slot_t)ev->slot, name, ev->data, ev->size);
+            }
+            break;
+    }
+}
+
+/* record an input event into the journal and apply it */
+static void input_event(journal_event_type_t type, int key) {
+    const journal_event_t ev = { .type = type, .key = key };
+    journal_record(&ev);
+    apply_event(&ev);
+}
+
+/* record a loaded media file into the journal before it is inserted */
+static void record_media(fs_slot_t slot) {
+    journal_record(&(journal_event_t){
+        .type = JOURNAL_EVENT_MEDIA,
+        .slot = slot,
+        .ext = fs_ext_str(slot),
+        .data = fs_ptr(slot),
+        .size = fs_size(slot)
+    });
+}
+
 /* one-time application init */
 void app_init(void) {
     gfx_init(&(gfx_desc_t){
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = cpc_max_display_size(),
         .top_offset = ui_extra_height,
         .aspect_y = 2
     });
     keybuf_init(7);
     clock_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
+    /* capture video and/or audio into Y4M and WAV files */
+    if (sargs_exists("capture_video") || sargs_exists("capture_audio")) {
+        if (!capture_init(&(capture_desc_t){
+            .video_path = sargs_exists("capture_video") ? sargs_value("capture_video") : 0,
+            .audio_path = sargs_exists("capture_audio") ? sargs_value("capture_audio") : 0,
+            .audio_sample_rate = saudio_sample_rate()
+        })) {
+            gfx_flash_error();
+        }
+    }
+    /* profile the guest code, and write the call stacks for flamegraph tools at exit */
+    guestprof_init(sargs_exists("guestprof") ? sargs_value("guestprof") : 0);
+    if (sargs_exists("guestprof")) {
+        guestprof_enable(true);
+    }
     fs_init();
+    /* record input into a journal, or replay a journal (media files are part of the journal) */
+    journal_init(&(journal_desc_t){
+        .record_path = sargs_exists("record") ? sargs_value("record") : 0,
+        .replay_path = sargs_exists("replay") ? sargs_value("replay") : 0,
+        .unthrottled = sargs_equals("replay_speed", "max"),
+        .event_cb = apply_event,
+    });
     bool delay_input = false;
-    if (sargs_exists("file")) {
+    if (sargs_exists("file") && !journal_replaying()) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
+            gfx_flash_error();
+        }
+    }
+    /* an additional tape image, e.g. next to a disk image in file= */
+    if (sargs_exists("tape") && !journal_replaying()) {
+        if (!fs_load_file(FS_SLOT_TAPE, sargs_value("tape"))) {
             gfx_flash_error();
         }
     }
@@ -123,6 +204,67 @@ void app_init(void) {
     #ifdef CHIPS_USE_UI
     cpcui_init(&cpc);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "cpc",
+        .anchor = &cpc,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&cpc, sizeof(cpc), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(cpc.ram, sizeof(cpc.ram));
+    savestate_add_region(gfx_framebuffer(), cpc_display_width(&cpc) * cpc_display_height(&cpc) * sizeof(uint32_t), false);
+    /* restore the booted system from a cache file, or create the cache file after booting */
+    if (sargs_exists("bootcache") && !journal_recording() && !journal_replaying()) {
+        bootcache_init(&(bootcache_desc_t){
+            .dir = sargs_value("bootcache"),
+            .system = "cpc",
+            .anchor = &cpc,
+            .boot_frames = load_delay_frames
+        });
+        const int config[2] = { (int)type, (int)joy_type };
+        bootcache_add_key(config, sizeof(config));
+        bootcache_add_key(dump_cpc464_os_bin, sizeof(dump_cpc464_os_bin));
+        bootcache_add_key(dump_cpc464_basic_bin, sizeof(dump_cpc464_basic_bin));
+        bootcache_add_key(dump_cpc6128_os_bin, sizeof(dump_cpc6128_os_bin));
+        bootcache_add_key(dump_cpc6128_basic_bin, sizeof(dump_cpc6128_basic_bin));
+        bootcache_add_key(dump_cpc6128_amsdos_bin, sizeof(dump_cpc6128_amsdos_bin));
+        bootcache_add_key(dump_kcc_os_bin, sizeof(dump_kcc_os_bin));
+        bootcache_add_key(dump_kcc_bas_bin, sizeof(dump_kcc_bas_bin));
+        bootcache_add_region(&cpc, sizeof(cpc), true);
+        bootcache_add_region(gfx_framebuffer(), cpc_display_width(&cpc) * cpc_display_height(&cpc) * sizeof(uint32_t), false);
+        bootcache_restore();
+    }
+    if (sargs_exists("state") && !journal_recording() && !journal_replaying()) {
+        savestate_load();
+    }
+    if (sargs_exists("rewind")) {
+        /* optional memory cap in MBytes, e.g. rewind=32 */
+        const int mbytes = atoi(sargs_value("rewind"));
+        const uint64_t max_bytes = (uint64_t)((mbytes > 0) ? mbytes : 0) * 1024 * 1024;
+        rewind_init(&(rewind_desc_t){ .max_bytes = (uint32_t)((max_bytes < REWIND_MAX_RING_SIZE) ? max_bytes : REWIND_MAX_RING_SIZE) });
+        rewind_add_region(&cpc, sizeof(cpc));
+        rewind_add_region(gfx_framebuffer(), cpc_display_width(&cpc) * cpc_display_height(&cpc) * sizeof(uint32_t));
+    }
+    /* per-frame state hashes, e.g. to compare a journal replay against a recorded run */
+    if (sargs_exists("hash_record") || sargs_exists("hash_compare")) {
+        if (statehash_init(&(statehash_desc_t){
+            .record_path = sargs_exists("hash_record") ? sargs_value("hash_record") : 0,
+            .compare_path = sargs_exists("hash_compare") ? sargs_value("hash_compare") : 0,
+        })) {
+            /* the system struct contains pointers into the framebuffer, itself and other statics (same order as savestate.h) */
+            reloc_add_range(gfx_framebuffer(), (size_t)gfx_framebuffer_size());
+            reloc_add_image(&cpc);
+            const size_t ram_end = offsetof(cpc_t, ram) + sizeof(cpc.ram);
+            statehash_add_region("cpc", &cpc, offsetof(cpc_t, ram), true);
+            statehash_add_region("cpc", (uint8_t*)&cpc + ram_end, sizeof(cpc) - ram_end, true);
+            statehash_add_region("ram", cpc.ram, sizeof(cpc.ram), false);
+            statehash_add_region("fb", gfx_framebuffer(), cpc_display_width(&cpc) * cpc_display_height(&cpc) * sizeof(uint32_t), false);
+        }
+        else {
+            gfx_flash_error();
+        }
+    }
 
     /* keyboard input to send to emulator */
     if (!delay_input) {
@@ -132,30 +274,35 @@ void app_init(void) {
     }
 }
 
-/* per frame stuff, tick the emulator, handle input, decode and draw emulator display */
-void app_frame(void) {
-    const uint32_t frame_time = clock_frame_time();
+/* run one emulator frame, this is shared between live and replayed frames */
+static void emu_frame(uint32_t frame_time) {
+    guestprofz80_attach(&cpc.cpu, &cpc.mem);
     #if CHIPS_USE_UI
         cpcui_exec(&cpc, frame_time);
     #else
         cpc_exec(&cpc, frame_time);
     #endif
-    gfx_draw(cpc_display_width(&cpc), cpc_display_height(&cpc));
-    const uint32_t load_delay_frames = 120;
-    if (fs_ptr() && ((clock_frame_count_60hz() > load_delay_frames) || fs_ext("sna"))) {
+    guestprofz80_detach(&cpc.cpu);
+    rewind_capture();
+    capture_frame(gfx_framebuffer(), cpc_display_width(&cpc), cpc_display_height(&cpc));
+    statehash_frame();
+    bootcache_frame(frame_time);
+    journal_replay_events();
+    if (fs_ptr(FS_SLOT_IMAGE) && (journal_replaying() || bootcache_booted() || (clock_frame_count_60hz() > load_delay_frames) || fs_ext(FS_SLOT_IMAGE, "sna"))) {
+        record_media(FS_SLOT_IMAGE);
         bool load_success = false;
-        if (fs_ext("txt") || fs_ext("bas")) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("tap")) {
-            load_success = cpc_insert_tape(&cpc, fs_ptr(), fs_size());
+        else if (fs_ext(FS_SLOT_IMAGE, "tap")) {
+            load_success = cpc_insert_tape(&cpc, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("dsk")) {
-            load_success = cpc_insert_disc(&cpc, fs_ptr(), fs_size());
+        else if (fs_ext(FS_SLOT_IMAGE, "dsk")) {
+            load_success = cpc_insert_disc(&cpc, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("sna") || fs_ext("bin")) {
-            load_success = cpc_quickload(&cpc, fs_ptr(), fs_size());
+        else if (fs_ext(FS_SLOT_IMAGE, "sna") || fs_ext(FS_SLOT_IMAGE, "bin")) {
+            load_success = cpc_quickload(&cpc, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
@@ -168,13 +315,57 @@ void app_frame(void) {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    if (fs_ptr(FS_SLOT_TAPE) && (journal_replaying() || bootcache_booted() || (clock_frame_count_60hz() > load_delay_frames))) {
+        record_media(FS_SLOT_TAPE);
+        if (!cpc_insert_tape(&cpc, fs_ptr(FS_SLOT_TAPE), fs_size(FS_SLOT_TAPE))) {
+            gfx_flash_error();
+        }
+        fs_free(FS_SLOT_TAPE);
+    }
+    else if (fs_failed(FS_SLOT_TAPE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_TAPE);
     }
     uint8_t key_code;
-    if (0 != (key_code = keybuf_get(frame_time))) {
-        cpc_key_down(&cpc, key_code);
-        cpc_key_up(&cpc, key_code);
+    if (!journal_replaying() && (0 != (key_code = keybuf_get(frame_time)))) {
+        input_event(JOURNAL_EVENT_KEY_TYPED, key_code);
+    }
+}
+
+/* per frame stuff, tick the emulator, handle input, decode and draw emulator display */
+void app_frame(void) {
+    uint32_t frame_time = clock_frame_time();
+    if (rewinding && rewind_step_back()) {
+        /* while rewinding, the emulator isn't ticked, only the restored frame is displayed */
+        gfx_draw(cpc_display_width(&cpc), cpc_display_height(&cpc));
+        return;
+    }
+    /* warp while the floppy drive motor is on */
+    warp_set_auto(cpc.fdd.motor_on);
+    /* in warp or unthrottled replay mode, run as many frames as fit into one host frame */
+    const uint64_t start = stm_now();
+    if (journal_replaying()) {
+        while (journal_replay_frame(&frame_time)) {
+            emu_frame(frame_time);
+            const bool unthrottled = journal_unthrottled() && (stm_ms(stm_since(start)) < 14.0);
+            if (!warp_continue(start, frame_time) && !unthrottled) {
+                break;
+            }
+        }
+    }
+    else {
+        do {
+            journal_record_frame(frame_time);
+            emu_frame(frame_time);
+        } while (warp_continue(start, frame_time));
     }
+    gfx_draw(cpc_display_width(&cpc), cpc_display_height(&cpc));
 }
 
 /* keyboard input handling */
@@ -185,14 +376,50 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press the End key to toggle warp mode */
+    if ((event->key_code == SAPP_KEYCODE_END) && (event->type == SAPP_EVENTTYPE_KEY_DOWN)) {
+        warp_toggle();
+        return;
+    }
+    if (journal_replaying()) {
+        /* live input would break the replay */
+        return;
+    }
+    /* press Page Up to save the system state, and Page Down to load it (not while recording, this would break the journal) */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && (event->key_code == SAPP_KEYCODE_PAGE_UP)) {
+        if (savestate_save()) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && (event->key_code == SAPP_KEYCODE_PAGE_DOWN) && !journal_recording()) {
+        if (savestate_load()) {
+            rewind_reset();
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
+    /* hold the Home key to step backward in time (not while recording, this would break the journal) */
+    if ((event->key_code == SAPP_KEYCODE_HOME) && rewind_enabled() && !journal_recording()) {
+        if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) || (event->type == SAPP_EVENTTYPE_KEY_UP)) {
+            rewinding = (event->type == SAPP_EVENTTYPE_KEY_DOWN);
+            return;
+        }
+    }
     const bool shift = event->modifiers & SAPP_MODIFIER_SHIFT;
     switch (event->type) {
         int c;
         case SAPP_EVENTTYPE_CHAR:
             c = (int) event->char_code;
             if ((c > 0x20) && (c < 0x7F)) {
-                cpc_key_down(&cpc, c);
-                cpc_key_up(&cpc, c);
+                input_event(JOURNAL_EVENT_KEY_DOWN, c);
+                input_event(JOURNAL_EVENT_KEY_UP, c);
             }
             break;
         case SAPP_EVENTTYPE_KEY_DOWN:
@@ -223,10 +450,10 @@ void app_input(const sapp_event* event) {
             }
             if (c) {
                 if (event->type == SAPP_EVENTTYPE_KEY_DOWN) {
-                    cpc_key_down(&cpc, c);
+                    input_event(JOURNAL_EVENT_KEY_DOWN, c);
                 }
                 else {
-                    cpc_key_up(&cpc, c);
+                    input_event(JOURNAL_EVENT_KEY_UP, c);
                 }
             }
             break;
@@ -241,9 +468,28 @@ void app_input(const sapp_event* event) {
 /* application cleanup callback */
 void app_cleanup(void) {
     cpc_discard(&cpc);
+    if (sargs_exists("guestprof")) {
+        guestprof_write();
+        guestprof_print_stats();
+    }
+    guestprof_shutdown();
+    savestate_shutdown();
+    rewind_print_stats();
+    rewind_shutdown();
+    statehash_print_stats();
+    statehash_shutdown();
+    bootcache_shutdown();
+    journal_shutdown();
+    if (capture_active()) {
+        capture_shutdown();
+        capture_print_stats();
+    }
     #ifdef CHIPS_USE_UI
     cpcui_discard();
     #endif
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
     sargs_shutdown();
@@ -28,6 +28,8 @@
 #include "ui/ui_kc85sys.h"
 #include "ui/ui_audio.h"
 #include "ui/ui_kc85.h"
+#include "tracez80.h"
+#include "heatz80.h"
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wmissing-field-initializers"
@@ -69,22 +71,34 @@ void kc85ui_init(kc85_t* kc85) {
     desc.dbg_keys.toggle_breakpoint_keycode = SAPP_KEYCODE_F9;
     desc.dbg_keys.toggle_breakpoint_name = "F9";
     ui_kc85_init(&ui_kc85, &desc);
+    /* execution history for the debugger (disable with trace=0) */
+    if (!sargs_equals("trace", "0")) {
+        trace_init(&tracez80_desc);
+    }
+    heatmap_init();
 }
 
 void kc85ui_discard(void) {
     ui_kc85_discard(&ui_kc85);
+    trace_shutdown();
+    heatmap_shutdown();
 }
 
 void kc85ui_exec(kc85_t* kc85, uint32_t frame_time_us) {
     if (ui_kc85_before_exec(&ui_kc85)) {
+        tracez80_attach(&kc85->cpu, &kc85->mem);
+        heatz80_attach(&kc85->cpu);
         uint64_t start = stm_now();
         kc85_exec(kc85, frame_time_us);
+        heatz80_detach(&kc85->cpu);
+        tracez80_detach(&kc85->cpu);
         exec_time = stm_ms(stm_since(start));
         ui_kc85_after_exec(&ui_kc85);
     }
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -14,6 +14,7 @@
 #include "chips/mem.h"
 #include "systems/kc85.h"
 #include "kc85-roms.h"
+#include "guestprofz80.h"
 
 /* imports from kc85-ui.cc */
 #ifdef CHIPS_USE_UI
@@ -29,6 +30,11 @@ static const int ui_extra_height = 0;
 
 static kc85_t kc85;
 
+/* frames until the KC85 has booted and media files can be loaded */
+static uint32_t boot_frames(kc85_type_t type) {
+    return (type == KC85_TYPE_4) ? 180 : 480;
+}
+
 /* module to insert after ROM module image has been loaded */
 kc85_module_type_t delay_insert_module = KC85_MODULE_NONE;
 
@@ -55,7 +61,9 @@ sapp_desc sokol_main(int argc, char* argv[]) {
 /* audio-streaming callback */
 static void push_audio(const float* samples, int num_samples, void* user_data) {
     (void)user_data;
-    saudio_push(samples, num_samples);
+    if (!warp_active()) {
+        saudio_push(samples, num_samples);
+    }
 }
 
 /* a callback to patch some known problems in game snapshot files */
@@ -106,11 +114,18 @@ void app_init(void) {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = kc85_max_display_size(),
         .top_offset = ui_extra_height
     });
     keybuf_init(10);
     clock_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
+    /* profile the guest code, and write the call stacks for flamegraph tools at exit */
+    guestprof_init(sargs_exists("guestprof") ? sargs_value("guestprof") : 0);
+    if (sargs_exists("guestprof")) {
+        guestprof_enable(true);
+    }
     fs_init();
     /* specific KC85 model? */
     kc85_type_t type = KC85_TYPE_2;
@@ -128,17 +143,27 @@ void app_init(void) {
     #ifdef CHIPS_USE_UI
     kc85ui_init(&kc85);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "kc85",
+        .anchor = &kc85,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&kc85, sizeof(kc85), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(kc85.ram, sizeof(kc85.ram));
+    savestate_add_region(gfx_framebuffer(), kc85_display_width(&kc85) * kc85_display_height(&kc85) * sizeof(uint32_t), false);
 
     bool delay_input = false;
     /* snapshot file or rom-module image */
     if (sargs_exists("file")) {
         delay_input=true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
     else if (sargs_exists("mod_image")) {
-        if (!fs_load_file(sargs_value("mod_image"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("mod_image"))) {
             gfx_flash_error();
         }
     }
@@ -170,6 +195,28 @@ void app_init(void) {
             }
         }
     }
+    /* restore the booted system from a cache file, or create the cache file after booting */
+    if (sargs_exists("bootcache")) {
+        bootcache_init(&(bootcache_desc_t){
+            .dir = sargs_value("bootcache"),
+            .system = "kc85",
+            .anchor = &kc85,
+            .boot_frames = boot_frames(type)
+        });
+        bootcache_add_key(&type, sizeof(type));
+        bootcache_add_key(sargs_value("mod"), strlen(sargs_value("mod")));
+        bootcache_add_key(dump_caos22_852, sizeof(dump_caos22_852));
+        bootcache_add_key(dump_caos31_853, sizeof(dump_caos31_853));
+        bootcache_add_key(dump_caos42c_854, sizeof(dump_caos42c_854));
+        bootcache_add_key(dump_caos42e_854, sizeof(dump_caos42e_854));
+        bootcache_add_key(dump_basic_c0_853, sizeof(dump_basic_c0_853));
+        bootcache_add_region(&kc85, sizeof(kc85), true);
+        bootcache_add_region(gfx_framebuffer(), kc85_display_width(&kc85) * kc85_display_height(&kc85) * sizeof(uint32_t), false);
+        bootcache_restore();
+    }
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
     /* keyboard input to send to emulator */
     if (!delay_input) {
         if (sargs_exists("input")) {
@@ -180,27 +227,34 @@ void app_init(void) {
 
 void app_frame(void) {
     const uint32_t frame_time = clock_frame_time();
-    #if CHIPS_USE_UI
-        kc85ui_exec(&kc85, frame_time);
-    #else
-        kc85_exec(&kc85, frame_time);
-    #endif
+    /* in warp mode, run as many frames as fit into one host frame */
+    const uint64_t start = stm_now();
+    do {
+        guestprofz80_attach(&kc85.cpu, &kc85.mem);
+        #if CHIPS_USE_UI
+            kc85ui_exec(&kc85, frame_time);
+        #else
+            kc85_exec(&kc85, frame_time);
+        #endif
+        guestprofz80_detach(&kc85.cpu);
+        bootcache_frame(frame_time);
+    } while (warp_continue(start, frame_time));
     gfx_draw(kc85_display_width(&kc85), kc85_display_height(&kc85));
-    const uint32_t load_delay_frames = kc85.type == KC85_TYPE_4 ? 180 : 480;
-    if (fs_ptr() && clock_frame_count_60hz() > load_delay_frames) {
+    const uint32_t load_delay_frames = boot_frames(kc85.type);
+    if (fs_ptr(FS_SLOT_IMAGE) && (bootcache_booted() || (clock_frame_count_60hz() > load_delay_frames))) {
         bool load_success = false;
         if (sargs_exists("mod_image")) {
             /* insert the rom module */
             if (delay_insert_module != KC85_MODULE_NONE) {
-                load_success = kc85_insert_rom_module(&kc85, 0x08, delay_insert_module, fs_ptr(), fs_size());
+                load_success = kc85_insert_rom_module(&kc85, 0x08, delay_insert_module, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
             }
         }
-        else if (fs_ext("txt") || fs_ext("bas")) {
+        else if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
         else {
-            load_success = kc85_quickload(&kc85, fs_ptr(), fs_size());
+            load_success = kc85_quickload(&kc85, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
@@ -213,7 +267,11 @@ void app_frame(void) {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
     if (0 != (key_code = keybuf_get(frame_time))) {
@@ -229,6 +287,22 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
+    /* press the End key to toggle warp mode */
+    if ((event->key_code == SAPP_KEYCODE_END) && (event->type == SAPP_EVENTTYPE_KEY_DOWN)) {
+        warp_toggle();
+        return;
+    }
     const bool shift = event->modifiers & SAPP_MODIFIER_SHIFT;
     switch (event->type) {
         int c;
@@ -292,9 +366,19 @@ void app_input(const sapp_event* event) {
 
 void app_cleanup(void) {
     kc85_discard(&kc85);
+    if (sargs_exists("guestprof")) {
+        guestprof_write();
+        guestprof_print_stats();
+    }
+    guestprof_shutdown();
+    savestate_shutdown();
     #ifdef CHIPS_USE_UI
     kc85ui_discard();
     #endif
+    bootcache_shutdown();
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
     sargs_shutdown();
@@ -85,6 +85,7 @@ void lc80ui_exec(uint32_t frame_time_us) {
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
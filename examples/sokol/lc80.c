@@ -67,6 +67,7 @@ void app_init(void) {
     });
     clock_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
 
     lc80_desc_t desc = lc80_desc();
     lc80_init(&sys, &desc);
@@ -93,6 +94,9 @@ void app_input(const sapp_event* event) {
 void app_cleanup(void) {
     lc80_discard(&sys);
     lc80ui_discard();
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     sg_shutdown();
     sargs_shutdown();
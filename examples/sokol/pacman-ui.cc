@@ -70,6 +70,7 @@ void pacmanui_exec(namco_t* sys, uint32_t frame_time_us) {
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } // extern "C"
@@ -59,6 +59,7 @@ static void app_init(void) {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = namco_max_display_size(),
         .top_offset = ui_extra_height,
         .aspect_x = 2,
         .aspect_y = 3,
@@ -85,6 +86,21 @@ static void app_init(void) {
     #ifdef CHIPS_USE_UI
     pacmanui_init(&sys);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "pacman",
+        .anchor = &sys,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&sys, sizeof(sys), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(sys.video_ram, sizeof(sys.video_ram));
+    reloc_exclude(sys.color_ram, sizeof(sys.color_ram));
+    reloc_exclude(sys.main_ram, sizeof(sys.main_ram));
+    savestate_add_region(gfx_framebuffer(), namco_display_width(&sys) * namco_display_height(&sys) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
 }
 
 static void app_frame(void) {
@@ -93,7 +109,9 @@ static void app_frame(void) {
     #else
         namco_exec(&sys, clock_frame_time());
     #endif
+    const uint64_t decode_start = stm_now();
     namco_decode_video(&sys);
+    prof_push(PROF_DECODE, (float)stm_ms(stm_since(decode_start)));
     gfx_draw(namco_display_width(&sys), namco_display_height(&sys));
 }
 
@@ -104,6 +122,17 @@ static void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     switch (event->type) {
         case SAPP_EVENTTYPE_KEY_DOWN:
             switch (event->key_code) {
@@ -137,6 +166,7 @@ static void app_cleanup(void) {
     pacmanui_discard();
     #endif
     namco_discard(&sys);
+    savestate_shutdown();
     saudio_shutdown();
     gfx_shutdown();
 }
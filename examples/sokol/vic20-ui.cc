@@ -81,6 +81,7 @@ void vic20ui_exec(uint32_t frame_time_us) {
     uint64_t start = stm_now();
     ui_vic20_exec(&ui_vic20, frame_time_us);
     exec_time = ui_vic20.dbg.dbg.stopped ? 0.0 : stm_ms(stm_since(start));
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -77,34 +77,103 @@ vic20_desc_t vic20_desc(vic20_joystick_type_t joy_type, vic20_memory_config_t me
     };
 }
 
+/* KERNAL keyboard buffer, used for turbo typing */
+#define KERNAL_KEYD (0x0277)    /* keyboard buffer */
+#define KERNAL_NDX (0x00C6)     /* number of keys in the buffer */
+#define KERNAL_XMAX (0x0289)    /* buffer size, zero until the KERNAL is initialized */
+#define KERNAL_KEYD_SIZE (10)
+/* frames to wait for the keyboard scan after a turbo-typed key went through the key matrix */
+static int turbo_hold_frames;
+
+/* press and release a key from the keyboard buffer, bypassing the joystick mapping */
+static void press_key(uint8_t key) {
+    /* FIXME: this is ugly */
+    vic20_joystick_type_t joy_type = vic20.joystick_type;
+    vic20.joystick_type = VIC20_JOYSTICKTYPE_NONE;
+    vic20_key_down(&vic20, key);
+    vic20_key_up(&vic20, key);
+    vic20.joystick_type = joy_type;
+}
+
+/* convert a key code to PETSCII (letters have inverted case like the key mapping), 0 if there's no equivalent */
+static uint8_t ascii_to_petscii(int c) {
+    if (((c >= 0x20) && (c < 0x60)) || (c == 0x0D)) {
+        return (uint8_t) c;
+    }
+    else if ((c >= 'a') && (c <= 'z')) {
+        /* shifted letters */
+        return (uint8_t) (c + 0x60);
+    }
+    else {
+        return 0;
+    }
+}
+
+/* keybuf turbo mode callback, puts keys into the KERNAL keyboard buffer as soon as there's room */
+static bool type_key(uint8_t key) {
+    if (turbo_hold_frames > 0) {
+        turbo_hold_frames--;
+        return false;
+    }
+    const uint8_t num = mem_rd(&vic20.mem_cpu, KERNAL_NDX);
+    const uint8_t petscii = ascii_to_petscii(key);
+    if (petscii != 0) {
+        uint8_t xmax = mem_rd(&vic20.mem_cpu, KERNAL_XMAX);
+        if (xmax > KERNAL_KEYD_SIZE) {
+            xmax = KERNAL_KEYD_SIZE;
+        }
+        if (num >= xmax) {
+            return false;
+        }
+        mem_wr(&vic20.mem_cpu, KERNAL_KEYD + num, petscii);
+        mem_wr(&vic20.mem_cpu, KERNAL_NDX, num + 1);
+    }
+    else {
+        /* cursor and function keys go through the key matrix, once the buffer
+           is empty, and the next keys must wait until the key was scanned
+        */
+        if (num != 0) {
+            return false;
+        }
+        press_key(key);
+        turbo_hold_frames = 3;
+    }
+    return true;
+}
+
 /* one-time application init */
 void app_init(void) {
     gfx_init(&(gfx_desc_t){
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = vic20_max_display_size(),
         .top_offset = ui_extra_height,
         .aspect_x = 3,
         .aspect_y = 2
     });
     keybuf_init(5);
+    if (sargs_equals("typing", "turbo")) {
+        keybuf_set_turbo(type_key);
+    }
     clock_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
     fs_init();
     bool delay_input = false;
     if (sargs_exists("file")) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
     if (sargs_exists("rom")) {
-        if (!fs_load_file(sargs_value("rom"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("rom"))) {
             gfx_flash_error();
         }
     }
     if (sargs_exists("prg")) {
-        if (!fs_load_base64("url.prg", sargs_value("prg"))) {
+        if (!fs_load_base64(FS_SLOT_IMAGE, "url.prg", sargs_value("prg"))) {
             gfx_flash_error();
         }
     }
@@ -136,6 +205,26 @@ void app_init(void) {
     #ifdef CHIPS_USE_UI
     vic20ui_init(&vic20);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "vic20",
+        .anchor = &vic20,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&vic20, sizeof(vic20), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(vic20.color_ram, sizeof(vic20.color_ram));
+    reloc_exclude(vic20.ram0, sizeof(vic20.ram0));
+    reloc_exclude(vic20.ram_3k, sizeof(vic20.ram_3k));
+    reloc_exclude(vic20.ram1, sizeof(vic20.ram1));
+    reloc_exclude(vic20.ram_exp, sizeof(vic20.ram_exp));
+    reloc_exclude(vic20.rom_char, sizeof(vic20.rom_char));
+    reloc_exclude(vic20.rom_basic, sizeof(vic20.rom_basic));
+    reloc_exclude(vic20.rom_kernal, sizeof(vic20.rom_kernal));
+    savestate_add_region(gfx_framebuffer(), vic20_display_width(&vic20) * vic20_display_height(&vic20) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
     if (!delay_input) {
         if (sargs_exists("input")) {
             keybuf_put(sargs_value("input"));
@@ -153,38 +242,38 @@ void app_frame(void) {
     #endif
     gfx_draw(vic20_display_width(&vic20), vic20_display_height(&vic20));
     const uint32_t load_delay_frames = 180;
-    if (fs_ptr() && clock_frame_count_60hz() > load_delay_frames) {
+    if (fs_ptr(FS_SLOT_IMAGE) && clock_frame_count_60hz() > load_delay_frames) {
         bool load_success = false;
-        if (fs_ext("txt") || fs_ext("bas")) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("tap")) {
-            load_success = vic20_insert_tape(&vic20, fs_ptr(), fs_size());
+        else if (fs_ext(FS_SLOT_IMAGE, "tap")) {
+            load_success = vic20_insert_tape(&vic20, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
-        else if (fs_ext("bin") || fs_ext("prg") || fs_ext("")) {
+        else if (fs_ext(FS_SLOT_IMAGE, "bin") || fs_ext(FS_SLOT_IMAGE, "prg") || fs_ext(FS_SLOT_IMAGE, "")) {
             if (sargs_exists("rom")) {
-                load_success = vic20_insert_rom_cartridge(&vic20, fs_ptr(), fs_size());
+                load_success = vic20_insert_rom_cartridge(&vic20, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
             }
             else {
-                load_success = vic20_quickload(&vic20, fs_ptr(), fs_size());
+                load_success = vic20_quickload(&vic20, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
             }
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
                 gfx_flash_success();
             }
-            if (fs_ext("tap")) {
+            if (fs_ext(FS_SLOT_IMAGE, "tap")) {
                 vic20_tape_play(&vic20);
             }
             if (!sargs_exists("debug")) {
                 if (sargs_exists("input")) {
                     keybuf_put(sargs_value("input"));
                 }
-                else if (fs_ext("tap")) {
+                else if (fs_ext(FS_SLOT_IMAGE, "tap")) {
                     keybuf_put("LOAD\n");
                 }
-                else if (fs_ext("prg")) {
+                else if (fs_ext(FS_SLOT_IMAGE, "prg")) {
                     keybuf_put("RUN\n");
                 }
             }
@@ -192,16 +281,15 @@ void app_frame(void) {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
     if (0 != (key_code = keybuf_get(frame_time))) {
-        /* FIXME: this is ugly */
-        vic20_joystick_type_t joy_type = vic20.joystick_type;
-        vic20.joystick_type = VIC20_JOYSTICKTYPE_NONE;
-        vic20_key_down(&vic20, key_code);
-        vic20_key_up(&vic20, key_code);
-        vic20.joystick_type = joy_type;
+        press_key(key_code);
     }
 }
 
@@ -213,6 +301,17 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     const bool shift = event->modifiers & SAPP_MODIFIER_SHIFT;
     switch (event->type) {
         int c;
@@ -274,6 +373,10 @@ void app_cleanup(void) {
     vic20ui_discard();
     #endif
     vic20_discard(&vic20);
+    savestate_shutdown();
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
 }
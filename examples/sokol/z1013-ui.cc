@@ -79,6 +79,7 @@ void z1013ui_exec(z1013_t* z1013, uint32_t frame_time_us) {
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -68,6 +68,7 @@ void app_init(void) {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = z1013_max_display_size(),
         .top_offset = ui_extra_height
     });
     keybuf_init(6);
@@ -87,10 +88,23 @@ void app_init(void) {
     #ifdef CHIPS_USE_UI
     z1013ui_init(&z1013);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "z1013",
+        .anchor = &z1013,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&z1013, sizeof(z1013), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(z1013.ram, sizeof(z1013.ram));
+    savestate_add_region(gfx_framebuffer(), z1013_display_width(&z1013) * z1013_display_height(&z1013) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
     bool delay_input = false;
     if (sargs_exists("file")) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
@@ -111,14 +125,14 @@ void app_frame(void) {
     #endif
     gfx_draw(z1013_display_width(&z1013), z1013_display_height(&z1013));
     const uint32_t load_delay_frames = 20;
-    if (fs_ptr() && clock_frame_count_60hz() > load_delay_frames) {
+    if (fs_ptr(FS_SLOT_IMAGE) && clock_frame_count_60hz() > load_delay_frames) {
         bool load_success = false;
-        if (fs_ext("txt") || fs_ext("bas")) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
         else {
-            load_success = z1013_quickload(&z1013, fs_ptr(), fs_size());
+            load_success = z1013_quickload(&z1013, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
@@ -131,7 +145,11 @@ void app_frame(void) {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
     if (0 != (key_code = keybuf_get(frame_time))) {
@@ -148,6 +166,17 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     switch (event->type) {
         int c;
         case SAPP_EVENTTYPE_CHAR:
@@ -195,6 +224,7 @@ void app_input(const sapp_event* event) {
 /* application cleanup callback */
 void app_cleanup(void) {
     z1013_discard(&z1013);
+    savestate_shutdown();
     #ifdef CHIPS_USE_UI
     z1013ui_discard();
     #endif
@@ -84,6 +84,7 @@ void z9001ui_exec(z9001_t* z9001, uint32_t frame_time_us) {
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
@@ -89,12 +89,14 @@ void app_init() {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = z9001_max_display_size(),
         .top_offset = ui_extra_height
     });
     keybuf_init(12);
     clock_init();
     fs_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
     z9001_type_t type = Z9001_TYPE_Z9001;
     if (sargs_exists("type")) {
         if (sargs_equals("type", "kc87")) {
@@ -106,10 +108,23 @@ void app_init() {
     #ifdef CHIPS_USE_UI
     z9001ui_init(&z9001);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "z9001",
+        .anchor = &z9001,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&z9001, sizeof(z9001), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(z9001.ram, sizeof(z9001.ram));
+    savestate_add_region(gfx_framebuffer(), z9001_display_width(&z9001) * z9001_display_height(&z9001) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        savestate_load();
+    }
     bool delay_input = false;
     if (sargs_exists("file")) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
@@ -129,14 +144,14 @@ void app_frame() {
         z9001_exec(&z9001, frame_time);
     #endif
     gfx_draw(z9001_display_width(&z9001), z9001_display_height(&z9001));
-    if (fs_ptr() && clock_frame_count_60hz() > 20) {
+    if (fs_ptr(FS_SLOT_IMAGE) && clock_frame_count_60hz() > 20) {
         bool load_success = false;
-        if (fs_ext("txt") || (fs_ext("bas"))) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || (fs_ext(FS_SLOT_IMAGE, "bas"))) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
         }
         else {
-            load_success = z9001_quickload(&z9001, fs_ptr(), fs_size());
+            load_success = z9001_quickload(&z9001, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             gfx_flash_success();
@@ -147,7 +162,11 @@ void app_frame() {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
     if (0 != (key_code = keybuf_get(frame_time))) {
@@ -164,6 +183,17 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? savestate_save() : savestate_load();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     switch (event->type) {
         int c;
         case SAPP_EVENTTYPE_CHAR:
@@ -213,9 +243,13 @@ void app_input(const sapp_event* event) {
 /* application cleanup callback */
 void app_cleanup() {
     z9001_discard(&z9001);
+    savestate_shutdown();
     #ifdef CHIPS_USE_UI
     z9001ui_discard();
     #endif
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
     sargs_shutdown();
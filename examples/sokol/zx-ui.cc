@@ -26,6 +26,8 @@
 #include "ui/ui_ay38910.h"
 #include "ui/ui_audio.h"
 #include "ui/ui_zx.h"
+#include "tracez80.h"
+#include "heatz80.h"
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wmissing-field-initializers"
 #endif
@@ -66,22 +68,34 @@ void zxui_init(zx_t* zx) {
     desc.dbg_keys.toggle_breakpoint_keycode = SAPP_KEYCODE_F9;
     desc.dbg_keys.toggle_breakpoint_name = "F9";
     ui_zx_init(&ui_zx, &desc);
+    /* execution history for the debugger (disable with trace=0) */
+    if (!sargs_equals("trace", "0")) {
+        trace_init(&tracez80_desc);
+    }
+    heatmap_init();
 }
 
 void zxui_discard(void) {
     ui_zx_discard(&ui_zx);
+    trace_shutdown();
+    heatmap_shutdown();
 }
 
 void zxui_exec(zx_t* zx, uint32_t frame_time_us) {
     if (ui_zx_before_exec(&ui_zx)) {
+        tracez80_attach(&zx->cpu, &zx->mem);
+        heatz80_attach(&zx->cpu);
         uint64_t start = stm_now();
         zx_exec(zx, frame_time_us);
+        heatz80_detach(&zx->cpu);
+        tracez80_detach(&zx->cpu);
         exec_time = stm_ms(stm_since(start));
         ui_zx_after_exec(&ui_zx);
     }
     else {
         exec_time = 0.0;
     }
+    prof_push(PROF_EMU, (float)exec_time);
 }
 
 } /* extern "C" */
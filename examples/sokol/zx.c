@@ -3,7 +3,8 @@
     ZX Spectrum 48/128 emulator.
     - wait states when accessing contended memory are not emulated
     - video decoding works with scanline accuracy, not cycle accuracy
-    - no tape or disc emulation
+    - .tap files are loaded instantly by trapping the ROM tape loader,
+      there's no tape signal or disc emulation
 */
 #include "common.h"
 #define CHIPS_IMPL
@@ -15,6 +16,7 @@
 #include "chips/mem.h"
 #include "systems/zx.h"
 #include "zx-roms.h"
+#include "guestprofz80.h"
 
 /* imports from zx-ui.cc */
 #ifdef CHIPS_USE_UI
@@ -30,6 +32,28 @@ static const int ui_extra_height = 0;
 
 static zx_t zx;
 
+/* the ROM's LD-BYTES routine is trapped and fed from the inserted .tap file */
+#define TAPE_TRAP_ID (1)
+static struct {
+    z80_trap_t prev_cb;
+    void* prev_user_data;
+    int pos;                /* read position in the inserted tape, part of the save state */
+} tape;
+
+/* save states include the tape position */
+static bool save_state(void) {
+    tape.pos = zxtap_position();
+    return savestate_save();
+}
+
+static bool load_state(void) {
+    if (savestate_load()) {
+        zxtap_set_position(tape.pos);
+        return true;
+    }
+    return false;
+}
+
 /* sokol-app entry, configure application callbacks and window */
 static void app_init(void);
 static void app_frame(void);
@@ -53,9 +77,79 @@ sapp_desc sokol_main(int argc, char* argv[]) {
 /* audio-streaming callback */
 static void push_audio(const float* samples, int num_samples, void* user_data) {
     (void)user_data;
+    capture_audio(samples, num_samples);
     saudio_push(samples, num_samples);
 }
 
+/* memory callbacks for the tape loader */
+static uint8_t tape_rd(uint16_t addr, void* user_data) {
+    (void)user_data;
+    return mem_rd(&zx.mem, addr);
+}
+
+static void tape_wr(uint16_t addr, uint8_t data, void* user_data) {
+    (void)user_data;
+    mem_wr(&zx.mem, addr, data);
+}
+
+/* CPU trap callback, chains to a previously installed trap callback (e.g. the UI debugger) */
+static int tape_trap(uint16_t pc, uint32_t ticks, uint64_t pins, void* user_data) {
+    (void)user_data;
+    if (tape.prev_cb) {
+        int trap_id = tape.prev_cb(pc, ticks, pins, tape.prev_user_data);
+        if (trap_id) {
+            return trap_id;
+        }
+    }
+    if ((pc == ZXTAP_LD_BYTES) && zxtap_ready()) {
+        /* only if the 48K BASIC ROM is mapped (INC D; EX AF,AF'; DEC D; DI) */
+        if ((0x14 == tape_rd(pc, 0)) && (0x08 == tape_rd(pc+1, 0)) &&
+            (0x15 == tape_rd(pc+2, 0)) && (0xF3 == tape_rd(pc+3, 0)))
+        {
+            return TAPE_TRAP_ID;
+        }
+    }
+    return 0;
+}
+
+/* (re-)install the tape trap, zx_init() or the UI may have replaced it */
+static void tape_install_trap(void) {
+    if (zx.cpu.trap_cb != tape_trap) {
+        tape.prev_cb = zx.cpu.trap_cb;
+        tape.prev_user_data = zx.cpu.trap_user_data;
+        z80_trap_cb(&zx.cpu, tape_trap, 0);
+    }
+}
+
+/* load the next tape block and return from LD-BYTES if the tape trap was hit */
+static void tape_handle_trap(void) {
+    if (zx.cpu.trap_id != TAPE_TRAP_ID) {
+        return;
+    }
+    zx.cpu.trap_id = 0;
+    zxtap_regs_t regs = {
+        .a = z80_a(&zx.cpu),
+        .f = z80_f(&zx.cpu),
+        .de = z80_de(&zx.cpu),
+        .ix = z80_ix(&zx.cpu)
+    };
+    if (!zxtap_ld_bytes(&regs, tape_rd, tape_wr, 0)) {
+        return;
+    }
+    z80_set_a(&zx.cpu, regs.a);
+    z80_set_f(&zx.cpu, regs.f);
+    z80_set_de(&zx.cpu, regs.de);
+    z80_set_ix(&zx.cpu, regs.ix);
+    /* emulate a RET, the ROM leaves LD-BYTES with interrupts enabled */
+    uint16_t sp = z80_sp(&zx.cpu);
+    const uint16_t ret_addr = tape_rd(sp, 0) | (tape_rd(sp+1, 0)<<8);
+    z80_set_sp(&zx.cpu, sp + 2);
+    z80_set_pc(&zx.cpu, ret_addr);
+    z80_set_wz(&zx.cpu, ret_addr);
+    z80_set_iff1(&zx.cpu, true);
+    z80_set_iff2(&zx.cpu, true);
+}
+
 /* get zx_desc_t struct for given ZX type and joystick type */
 zx_desc_t zx_desc(zx_type_t type, zx_joystick_type_t joy_type) {
     return (zx_desc_t){
@@ -80,11 +174,28 @@ void app_init() {
         #ifdef CHIPS_USE_UI
         .draw_extra_cb = ui_draw,
         #endif
+        .fb_size = zx_max_display_size(),
         .top_offset = ui_extra_height
     });
     keybuf_init(6);
     clock_init();
     saudio_setup(&(saudio_desc){0});
+    clock_set_audio_pacing(sargs_equals("pacing", "audio"));
+    /* capture video and/or audio into Y4M and WAV files */
+    if (sargs_exists("capture_video") || sargs_exists("capture_audio")) {
+        if (!capture_init(&(capture_desc_t){
+            .video_path = sargs_exists("capture_video") ? sargs_value("capture_video") : 0,
+            .audio_path = sargs_exists("capture_audio") ? sargs_value("capture_audio") : 0,
+            .audio_sample_rate = saudio_sample_rate()
+        })) {
+            gfx_flash_error();
+        }
+    }
+    /* profile the guest code, and write the call stacks for flamegraph tools at exit */
+    guestprof_init(sargs_exists("guestprof") ? sargs_value("guestprof") : 0);
+    if (sargs_exists("guestprof")) {
+        guestprof_enable(true);
+    }
     fs_init();
     zx_type_t type = ZX_TYPE_128;
     if (sargs_exists("type")) {
@@ -109,10 +220,25 @@ void app_init() {
     #ifdef CHIPS_USE_UI
     zxui_init(&zx);
     #endif
+    /* save states, optionally in the state= file (loaded at start) */
+    savestate_init(&(savestate_desc_t){
+        .system = "zx",
+        .anchor = &zx,
+        .path = sargs_exists("state") ? sargs_value("state") : 0
+    });
+    savestate_add_region(&zx, sizeof(zx), true);
+    /* guest memory can contain any bit pattern, only the rest of the system struct is relocated */
+    reloc_exclude(zx.ram, sizeof(zx.ram));
+    reloc_exclude(zx.rom, sizeof(zx.rom));
+    savestate_add_region(&tape.pos, sizeof(tape.pos), false);
+    savestate_add_region(gfx_framebuffer(), zx_display_width(&zx) * zx_display_height(&zx) * sizeof(uint32_t), false);
+    if (sargs_exists("state")) {
+        load_state();
+    }
     bool delay_input = false;
     if (sargs_exists("file")) {
         delay_input = true;
-        if (!fs_load_file(sargs_value("file"))) {
+        if (!fs_load_file(FS_SLOT_IMAGE, sargs_value("file"))) {
             gfx_flash_error();
         }
     }
@@ -126,21 +252,33 @@ void app_init() {
 /* per frame stuff, tick the emulator, handle input, decode and draw emulator display */
 void app_frame() {
     uint32_t frame_time = clock_frame_time();
+    tape_install_trap();
+    guestprofz80_attach(&zx.cpu, &zx.mem);
     #if CHIPS_USE_UI
         zxui_exec(&zx, frame_time);
     #else
         zx_exec(&zx, frame_time);
     #endif
+    guestprofz80_detach(&zx.cpu);
+    tape_handle_trap();
+    capture_frame(gfx_framebuffer(), zx_display_width(&zx), zx_display_height(&zx));
     gfx_draw(zx_display_width(&zx), zx_display_height(&zx));
     const uint32_t load_delay_frames = 120;
-    if (fs_ptr() && clock_frame_count_60hz() > load_delay_frames) {
+    if (fs_ptr(FS_SLOT_IMAGE) && clock_frame_count_60hz() > load_delay_frames) {
         bool load_success = false;
-        if (fs_ext("txt") || fs_ext("bas")) {
+        if (fs_ext(FS_SLOT_IMAGE, "txt") || fs_ext(FS_SLOT_IMAGE, "bas")) {
             load_success = true;
-            keybuf_put((const char*)fs_ptr());
+            keybuf_put((const char*)fs_ptr(FS_SLOT_IMAGE));
+        }
+        else if (fs_ext(FS_SLOT_IMAGE, "tap")) {
+            load_success = zxtap_insert(fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
+            if (load_success) {
+                /* start the 128K menu's tape loader, or type LOAD "" */
+                keybuf_put((ZX_TYPE_128 == zx.type) ? "\n" : "J\"\"\n");
+            }
         }
         else {
-            load_success = zx_quickload(&zx, fs_ptr(), fs_size());
+            load_success = zx_quickload(&zx, fs_ptr(FS_SLOT_IMAGE), fs_size(FS_SLOT_IMAGE));
         }
         if (load_success) {
             if (clock_frame_count_60hz() > (load_delay_frames + 10)) {
@@ -153,7 +291,11 @@ void app_frame() {
         else {
             gfx_flash_error();
         }
-        fs_free();
+        fs_free(FS_SLOT_IMAGE);
+    }
+    else if (fs_failed(FS_SLOT_IMAGE)) {
+        gfx_flash_error();
+        fs_free(FS_SLOT_IMAGE);
     }
     uint8_t key_code;
     if (0 != (key_code = keybuf_get(frame_time))) {
@@ -170,6 +312,17 @@ void app_input(const sapp_event* event) {
         return;
     }
     #endif
+    /* press Page Up to save the system state, and Page Down to load it */
+    if ((event->type == SAPP_EVENTTYPE_KEY_DOWN) && ((event->key_code == SAPP_KEYCODE_PAGE_UP) || (event->key_code == SAPP_KEYCODE_PAGE_DOWN))) {
+        const bool success = (event->key_code == SAPP_KEYCODE_PAGE_UP) ? save_state() : load_state();
+        if (success) {
+            gfx_flash_success();
+        }
+        else {
+            gfx_flash_error();
+        }
+        return;
+    }
     switch (event->type) {
         int c;
         case SAPP_EVENTTYPE_CHAR:
@@ -213,9 +366,23 @@ void app_input(const sapp_event* event) {
 /* application cleanup callback */
 void app_cleanup() {
     zx_discard(&zx);
+    if (sargs_exists("guestprof")) {
+        guestprof_write();
+        guestprof_print_stats();
+    }
+    guestprof_shutdown();
+    savestate_shutdown();
+    zxtap_remove();
+    if (capture_active()) {
+        capture_shutdown();
+        capture_print_stats();
+    }
     #ifdef CHIPS_USE_UI
     zxui_discard();
     #endif
+    if (sargs_exists("pacing")) {
+        clock_print_stats();
+    }
     saudio_shutdown();
     gfx_shutdown();
     sargs_shutdown();
@@ -0,0 +1,48 @@
+//------------------------------------------------------------------------------
+//  base64-bench.c
+//  Compare SIMD and scalar base64 decoding speed on a large payload.
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#define SOKOL_IMPL
+#include "sokol_time.h"
+#define COMMON_IMPL
+#include "base64.h"
+
+#define PAYLOAD_SIZE (4*1024*1024)
+#define NUM_ITERS (20)
+
+typedef int (*decode_func_t)(const char* src, int src_len, uint8_t* dst, int dst_size);
+
+static void bench(const char* name, decode_func_t func, const char* src, int src_len, uint8_t* dst, int dst_size) {
+    uint64_t best = 0;
+    int res = 0;
+    for (int i = 0; i < NUM_ITERS; i++) {
+        const uint64_t start = stm_now();
+        res = func(src, src_len, dst, dst_size);
+        const uint64_t t = stm_since(start);
+        if ((best == 0) || (t < best)) {
+            best = t;
+        }
+    }
+    printf("== %s: %d bytes in %.1f us (%.2f GB/s)\n", name, res, stm_us(best), (src_len / stm_sec(best)) / 1e9);
+}
+
+int main() {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char* src = (char*) malloc(PAYLOAD_SIZE);
+    uint8_t* dst = (uint8_t*) malloc(BASE64_DECODED_SIZE(PAYLOAD_SIZE));
+    uint32_t x = 0x12345678;
+    for (int i = 0; i < PAYLOAD_SIZE; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        src[i] = alphabet[x & 63];
+    }
+    stm_setup();
+    bench("scalar", base64_decode_scalar, src, PAYLOAD_SIZE, dst, BASE64_DECODED_SIZE(PAYLOAD_SIZE));
+    bench("simd", base64_decode, src, PAYLOAD_SIZE, dst, BASE64_DECODED_SIZE(PAYLOAD_SIZE));
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,98 @@
+//------------------------------------------------------------------------------
+//  base64-test.c
+//  Test the SIMD base64 decoder against the scalar decoder.
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#define COMMON_IMPL
+#include "base64.h"
+#include "utest.h"
+
+#define T(b) ASSERT_TRUE(b)
+
+static const char* base64_alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint32_t xorshift32(uint32_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static int encode(const uint8_t* src, int len, char* dst) {
+    int n = 0;
+    for (int i = 0; i < len; i += 3) {
+        uint32_t v = src[i] << 16;
+        if ((i + 1) < len) v |= src[i+1] << 8;
+        if ((i + 2) < len) v |= src[i+2];
+        dst[n++] = base64_alphabet[(v >> 18) & 63];
+        dst[n++] = base64_alphabet[(v >> 12) & 63];
+        dst[n++] = ((i + 1) < len) ? base64_alphabet[(v >> 6) & 63] : '=';
+        dst[n++] = ((i + 2) < len) ? base64_alphabet[v & 63] : '=';
+    }
+    dst[n] = 0;
+    return n;
+}
+
+UTEST(base64, vectors) {
+    uint8_t buf[64];
+    T(6 == base64_decode("Zm9vYmFy", 8, buf, sizeof(buf)));
+    T(0 == memcmp(buf, "foobar", 6));
+    T(5 == base64_decode("Zm9vYmE=", 8, buf, sizeof(buf)));
+    T(0 == memcmp(buf, "fooba", 5));
+    T(4 == base64_decode("Zm9v\nYg==", 9, buf, sizeof(buf)));
+    T(0 == memcmp(buf, "foob", 4));
+    T(-1 == base64_decode("", 0, buf, sizeof(buf)));
+    T(-1 == base64_decode("Zm9vY", 5, buf, sizeof(buf)));
+    T(-1 == base64_decode("Zm9vY===", 8, buf, sizeof(buf)));
+    T(-1 == base64_decode("Zm9vYmFy", 8, buf, 5));
+}
+
+UTEST(base64, roundtrip) {
+    static uint8_t data[4096];
+    static char enc[4096*2];
+    static uint8_t dec[4096];
+    uint32_t x = 0x12345678;
+    for (int len = 1; len < (int)sizeof(data); len += 1 + (len / 8)) {
+        for (int i = 0; i < len; i++) {
+            data[i] = (uint8_t) xorshift32(&x);
+        }
+        const int enc_len = encode(data, len, enc);
+        T(len == base64_decode(enc, enc_len, dec, sizeof(dec)));
+        T(0 == memcmp(data, dec, len));
+    }
+}
+
+/* random mostly-valid input with sprinkled whitespace, padding and garbage,
+   the SIMD and scalar decoders must agree on result size and content
+*/
+UTEST(base64, fuzz) {
+    static char src[1024];
+    static uint8_t dst_simd[1024];
+    static uint8_t dst_scalar[1024];
+    uint32_t x = 0xABCDEF01;
+    for (int iter = 0; iter < 20000; iter++) {
+        const int len = xorshift32(&x) % sizeof(src);
+        const uint32_t noise = xorshift32(&x) & 255;
+        for (int i = 0; i < len; i++) {
+            const uint32_t r = xorshift32(&x);
+            if ((r & 255) < noise / 16) {
+                const char special[] = { '=', '\n', ' ', '-', '_', 0x7F, (char)0x80, (char)0xFF, 0 };
+                src[i] = special[(r >> 8) % 9];
+            }
+            else {
+                src[i] = base64_alphabet[(r >> 8) & 63];
+            }
+        }
+        const int dst_size = (int)(xorshift32(&x) % sizeof(dst_simd));
+        memset(dst_simd, 0, sizeof(dst_simd));
+        memset(dst_scalar, 0, sizeof(dst_scalar));
+        const int res_simd = base64_decode(src, len, dst_simd, dst_size);
+        const int res_scalar = base64_decode_scalar(src, len, dst_scalar, dst_size);
+        T(res_simd == res_scalar);
+        if (res_scalar > 0) {
+            T(0 == memcmp(dst_simd, dst_scalar, res_scalar));
+        }
+    }
+}
@@ -1,8 +1,19 @@
 //------------------------------------------------------------------------------
 //  c64-bench.c
 //  Unthrottled headless C64 emu for benchmarking / profiling.
+//
+//  Runs the boot sequence (memory test and BASIC init), then the idle
+//  READY prompt (the KERNAL waiting for a key) and prints the time for
+//  each phase, and a hash of the final RAM and system state as
+//  reference for changes which must not alter emulation results, and
+//  the memory footprint of the process.
 //------------------------------------------------------------------------------
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 #define SOKOL_IMPL
 #include "sokol_time.h"
 #define CHIPS_IMPL
@@ -19,13 +30,18 @@
 #include "systems/c1541.h"
 #include "systems/c64.h"
 #include "c64-roms.h"
+#define COMMON_IMPL
+#include "reloc.h"
+#include "statehash.h"
 
 static struct {
     c64_t c64;
-    uint8_t dummy_pixel_buffer[1024*1024];
+    uint32_t* dummy_pixel_buffer;
+    int dummy_pixel_buffer_size;
 } state;
 
-#define NUM_USEC (1*1000000)
+#define BOOT_USEC (3*1000000)
+#define IDLE_USEC (5*1000000)
 
 static void dummy_audio_callback(const float* samples, int num_samples, void* user_data) {
     (void)samples;
@@ -38,9 +54,11 @@ int main() {
        that the video and audio generation isn't skipped in the
        emulator
     */
+    state.dummy_pixel_buffer_size = c64_max_display_size();
+    state.dummy_pixel_buffer = (uint32_t*) malloc((size_t)state.dummy_pixel_buffer_size);
     c64_init(&state.c64, &(c64_desc_t){
         .pixel_buffer = state.dummy_pixel_buffer,
-        .pixel_buffer_size = sizeof(state.dummy_pixel_buffer),
+        .pixel_buffer_size = state.dummy_pixel_buffer_size,
         .audio_cb = dummy_audio_callback,
         .rom_char = dump_c64_char_bin,
         .rom_char_size = sizeof(dump_c64_char_bin),
@@ -50,9 +68,35 @@ int main() {
         .rom_kernal_size = sizeof(dump_c64_kernalv3_bin)
     });
     stm_setup();
-    printf("== running emulation for %.2f emulated secs\n", NUM_USEC / 1000000.0);
+    printf("== running boot sequence for %.2f emulated secs\n", BOOT_USEC / 1000000.0);
     uint64_t start = stm_now();
-    c64_exec(&state.c64, NUM_USEC);
+    c64_exec(&state.c64, BOOT_USEC);
     printf("== time: %f sec\n", stm_sec(stm_since(start)));
+    printf("== running idle prompt for %.2f emulated secs\n", IDLE_USEC / 1000000.0);
+    start = stm_now();
+    c64_exec(&state.c64, IDLE_USEC);
+    printf("== time: %f sec\n", stm_sec(stm_since(start)));
+    /* the system state up to RAM contains pointers (also to the heap-allocated pixel buffer), which must be relocated */
+    static c64_t tmp;
+    reloc_add_range(state.dummy_pixel_buffer, (size_t)state.dummy_pixel_buffer_size);
+    reloc_add_image(&state);
+    reloc_normalize(&tmp, &state.c64, sizeof(tmp));
+    printf("== ram hash: %016llx\n", (unsigned long long)statehash_xxh64(state.c64.ram, sizeof(state.c64.ram), 0));
+    printf("== state hash: %016llx\n", (unsigned long long)statehash_xxh64(&tmp, offsetof(c64_t, ram), 0));
+    printf("== footprint: c64_t %d KB, pixel buffer %d KB", (int)(sizeof(c64_t) / 1024), state.dummy_pixel_buffer_size / 1024);
+    #if defined(_WIN32)
+    printf("\n");
+    #else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #if defined(__APPLE__)
+    const long max_rss_kb = (long)(usage.ru_maxrss / 1024);
+    #else
+    const long max_rss_kb = (long)usage.ru_maxrss;
+    #endif
+    printf(", peak resident %ld KB\n", max_rss_kb);
+    #endif
+    c64_discard(&state.c64);
+    free(state.dummy_pixel_buffer);
     return 0;
 }
@@ -0,0 +1,135 @@
+//------------------------------------------------------------------------------
+//  guestprof-test.c
+//  Test the guest code profiler's cycle attribution, call stack
+//  reconstruction and collapsed stacks output.
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#define COMMON_IMPL
+#include "guestprof.h"
+#include "utest.h"
+
+#define T(b) ASSERT_TRUE(b)
+
+/* simulated Z80 program:
+
+    0100: CALL 0200     (17 cycles)
+    0103: JR 0100       (12 cycles)
+    0200: CALL 0300     (17 cycles)
+    0203: RET           (10 cycles)
+    0300: NOP           (4 cycles)
+    0301: RET           (10 cycles)
+*/
+static uint16_t sp = 0xFF00;
+static uint16_t stack[0x10000];
+
+static void step(uint16_t pc, uint32_t cycles) {
+    guestprof_step(pc, sp, stack[sp], cycles);
+}
+
+static void call(uint16_t from, uint16_t to, uint16_t len, uint32_t cycles) {
+    sp -= 2;
+    stack[sp] = from + len;
+    step(to, cycles);
+}
+
+static void ret(uint32_t cycles) {
+    const uint16_t ret_addr = stack[sp];
+    sp += 2;
+    step(ret_addr, cycles);
+}
+
+static void run_loop(void) {
+    call(0x0100, 0x0200, 3, 17);
+    call(0x0200, 0x0300, 3, 17);
+    step(0x0301, 4);
+    ret(10);
+    ret(10);
+    step(0x0100, 12);
+}
+
+UTEST(guestprof, callstack) {
+    guestprof_init(0);
+    T(guestprof_available());
+    T(0 == strcmp(guestprof_path(), GUESTPROF_DEFAULT_PATH));
+    guestprof_enable(true);
+    T(guestprof_enabled());
+    sp = 0xFF00;
+    step(0x0100, 0);
+    for (int i = 0; i < 10; i++) {
+        run_loop();
+    }
+    T(guestprof_total_cycles() == 700);
+    T(guestprof_cycles(0x0100) == 170);
+    T(guestprof_cycles(0x0103) == 120);
+    T(guestprof_cycles(0x0200) == 170);
+    T(guestprof_cycles(0x0203) == 100);
+    T(guestprof_cycles(0x0300) == 40);
+    T(guestprof_cycles(0x0301) == 100);
+    guestprof_routine_t top[8];
+    const int num = guestprof_top(top, 8);
+    T(num == 3);
+    /* root: CALL 0200 + JR */
+    T(top[0].root);
+    T(top[0].self == 290);
+    T(top[0].total == 700);
+    /* 0200: CALL 0300 + RET */
+    T(!top[1].root && (top[1].addr == 0x0200));
+    T(top[1].self == 270);
+    T(top[1].total == 410);
+    T(top[1].calls == 10);
+    /* 0300: NOP + RET */
+    T(!top[2].root && (top[2].addr == 0x0300));
+    T(top[2].self == 140);
+    T(top[2].total == 140);
+    T(top[2].calls == 10);
+    guestprof_reset();
+    T(guestprof_total_cycles() == 0);
+    T(0 == guestprof_top(top, 8));
+    guestprof_shutdown();
+    T(!guestprof_available());
+}
+
+UTEST(guestprof, push_is_no_call) {
+    guestprof_init(0);
+    guestprof_enable(true);
+    sp = 0xFF00;
+    step(0x0100, 0);
+    /* PUSH HL with HL pointing right behind the PUSH */
+    sp -= 2;
+    stack[sp] = 0x0101;
+    step(0x0101, 11);
+    /* stack reset drops all frames */
+    call(0x0101, 0x0400, 3, 17);
+    sp = 0xFF00;
+    step(0x0500, 10);
+    step(0x0501, 4);
+    guestprof_routine_t top[8];
+    const int num = guestprof_top(top, 8);
+    T(num == 2);
+    T(top[0].root && (top[0].self == 32));
+    T((top[1].addr == 0x0400) && (top[1].self == 10) && (top[1].calls == 1));
+    guestprof_shutdown();
+}
+
+UTEST(guestprof, write) {
+    const char* path = "guestprof-test.txt";
+    guestprof_init(path);
+    guestprof_enable(true);
+    sp = 0xFF00;
+    step(0x0100, 0);
+    run_loop();
+    T(guestprof_write());
+    char buf[256] = { 0 };
+    FILE* fp = fopen(path, "r");
+    T(fp);
+    fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    remove(path);
+    T(0 != strstr(buf, "root 29\n"));
+    T(0 != strstr(buf, "root;0200 27\n"));
+    T(0 != strstr(buf, "root;0200;0300 14\n"));
+    guestprof_shutdown();
+}
@@ -0,0 +1,59 @@
+//------------------------------------------------------------------------------
+//  heatmap-test.c
+//  Test the memory access heatmap counters, decay and image conversion.
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+#define COMMON_IMPL
+#include "heatmap.h"
+#include "utest.h"
+
+#define T(b) ASSERT_TRUE(b)
+
+UTEST(heatmap, enable) {
+    heatmap_init();
+    T(heatmap_available());
+    T(!heatmap_enabled());
+    T(0 == heatmap_counters());
+    heatmap_enable(true);
+    T(heatmap_enabled());
+    uint32_t* c = heatmap_counters();
+    T(0 != c);
+    c[HEATMAP_WRITE * HEATMAP_NUM_ADDRS + 0x1234] = 5;
+    T(5 == heatmap_count(HEATMAP_WRITE, 0x1234));
+    /* disabling keeps the counters, enabling again clears them */
+    heatmap_enable(false);
+    T(!heatmap_enabled());
+    T(5 == heatmap_count(HEATMAP_WRITE, 0x1234));
+    heatmap_enable(true);
+    T(0 == heatmap_count(HEATMAP_WRITE, 0x1234));
+    heatmap_shutdown();
+    T(!heatmap_available());
+    T(!heatmap_enabled());
+}
+
+UTEST(heatmap, update) {
+    heatmap_init();
+    heatmap_enable(true);
+    uint32_t* c = heatmap_counters();
+    c[HEATMAP_READ * HEATMAP_NUM_ADDRS + 0x0100] = 1;
+    c[HEATMAP_WRITE * HEATMAP_NUM_ADDRS + 0x0101] = 0x10000;
+    c[HEATMAP_EXEC * HEATMAP_NUM_ADDRS + 0xFFFF] = 100;
+    heatmap_update();
+    const uint32_t* p = heatmap_pixels();
+    T(p[0x0000] == 0xFF000000);
+    T(p[0x0100] == 0xFF001000);
+    T(p[0x0101] == 0xFF0000FF);
+    T(p[0xFFFF] == 0xFF700000);
+    /* counters decay by 1/8 per update, rounded up, down to zero */
+    T(0 == heatmap_count(HEATMAP_READ, 0x0100));
+    T(0xE000 == heatmap_count(HEATMAP_WRITE, 0x0101));
+    T(87 == heatmap_count(HEATMAP_EXEC, 0xFFFF));
+    for (int i = 0; i < 100; i++) {
+        heatmap_update();
+    }
+    T(0 == heatmap_count(HEATMAP_WRITE, 0x0101));
+    T(0 == heatmap_count(HEATMAP_EXEC, 0xFFFF));
+    T(heatmap_pixels()[0x0101] == 0xFF000000);
+    heatmap_shutdown();
+}
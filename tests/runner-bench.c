@@ -0,0 +1,121 @@
+//------------------------------------------------------------------------------
+//  runner-bench.c
+//  Compare forking emulator instances (copy-on-write, see runner_fork())
+//  with restoring a full snapshot into a new instance, with and without
+//  running the forked instance for one frame, and the per-instance
+//  resident memory of created instances vs forks of a shared base file.
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define SOKOL_IMPL
+#include "sokol_time.h"
+#include "runner.h"
+
+#define BOOT_FRAMES (180)
+#define NUM_FORKS (2000)
+#define NUM_INSTANCES (64)
+
+/* private dirty memory of this process in KB (Linux only, -1 otherwise) */
+static long private_dirty_kb(void) {
+    long kb = -1;
+    FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            if (0 == strncmp(line, "Private_Dirty:", 14)) {
+                kb = atol(line + 14);
+            }
+        }
+        fclose(fp);
+    }
+    return kb;
+}
+
+static void bench_memory(const char* name, runner_system_t sys, const char* type) {
+    static runner_t* instances[NUM_INSTANCES];
+    long start_kb = private_dirty_kb();
+    for (int i = 0; i < NUM_INSTANCES; i++) {
+        instances[i] = runner_create(&(runner_desc_t){ .system = sys, .type = type });
+        runner_exec_frames(instances[i], 1);
+    }
+    const long created_kb = private_dirty_kb() - start_kb;
+    runner_base_t* base = runner_freeze(instances[0]);
+    for (int i = 0; i < NUM_INSTANCES; i++) {
+        runner_destroy(instances[i]);
+    }
+    /* fork from a base file, like a pool of processes would */
+    const char* path = "runner-bench.base";
+    const bool saved = runner_base_save(base, path);
+    runner_base_destroy(base);
+    base = saved ? runner_base_load(path) : 0;
+    if (!base) {
+        printf("== %s: saving/loading the base file failed\n", name);
+        return;
+    }
+    start_kb = private_dirty_kb();
+    for (int i = 0; i < NUM_INSTANCES; i++) {
+        instances[i] = runner_fork(base);
+        runner_exec_frames(instances[i], 1);
+    }
+    const long forked_kb = private_dirty_kb() - start_kb;
+    for (int i = 0; i < NUM_INSTANCES; i++) {
+        runner_destroy(instances[i]);
+    }
+    runner_base_destroy(base);
+    remove(path);
+    if (start_kb < 0) {
+        printf("== %s: resident memory not available on this platform\n", name);
+    }
+    else {
+        printf("== %s: private memory per instance after 1 frame: created %ld KB, forked %ld KB\n",
+            name, created_kb / NUM_INSTANCES, forked_kb / NUM_INSTANCES);
+    }
+}
+
+static void bench(const char* name, runner_system_t sys, const char* type) {
+    runner_t* parent = runner_create(&(runner_desc_t){ .system = sys, .type = type });
+    runner_exec_frames(parent, BOOT_FRAMES);
+    runner_base_t* base = runner_freeze(parent);
+    const size_t snapshot_size = runner_snapshot_size(parent);
+    void* snapshot = malloc(snapshot_size);
+    runner_snapshot(parent, snapshot, snapshot_size);
+    for (int run_frame = 0; run_frame < 2; run_frame++) {
+        uint64_t start = stm_now();
+        for (int i = 0; i < NUM_FORKS; i++) {
+            runner_t* child = runner_fork(base);
+            if (run_frame) {
+                runner_exec_frames(child, 1);
+            }
+            runner_destroy(child);
+        }
+        const double fork_sec = stm_sec(stm_since(start));
+        start = stm_now();
+        for (int i = 0; i < NUM_FORKS; i++) {
+            runner_t* child = runner_create(&(runner_desc_t){ .system = sys, .type = type });
+            runner_restore(child, snapshot, snapshot_size);
+            if (run_frame) {
+                runner_exec_frames(child, 1);
+            }
+            runner_destroy(child);
+        }
+        const double copy_sec = stm_sec(stm_since(start));
+        printf("== %s (%d bytes)%s: fork %.0f/s, create+restore %.0f/s\n",
+            name, (int)snapshot_size, run_frame ? " + 1 frame" : "",
+            NUM_FORKS / fork_sec, NUM_FORKS / copy_sec);
+    }
+    free(snapshot);
+    runner_base_destroy(base);
+    runner_destroy(parent);
+}
+
+int main() {
+    stm_setup();
+    bench("c64", RUNNER_SYSTEM_C64, 0);
+    bench("cpc6128", RUNNER_SYSTEM_CPC, "cpc6128");
+    bench("zx128", RUNNER_SYSTEM_ZX, "zx128");
+    bench_memory("c64", RUNNER_SYSTEM_C64, 0);
+    bench_memory("cpc6128", RUNNER_SYSTEM_CPC, "cpc6128");
+    bench_memory("zx128", RUNNER_SYSTEM_ZX, "zx128");
+    return 0;
+}
@@ -0,0 +1,126 @@
+//------------------------------------------------------------------------------
+//  statehash-test.c
+//  Test the XXH64 implementation, pointer relocation and hash stream
+//  divergence detection.
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#define SOKOL_IMPL
+#include "sokol_time.h"
+#define COMMON_IMPL
+#include "reloc.h"
+#include "statehash.h"
+#include "utest.h"
+
+#define T(b) ASSERT_TRUE(b)
+
+UTEST(statehash, xxh64) {
+    uint8_t data[100];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    const char* str = "Nobody inspects the spammish repetition";
+    T(0xEF46DB3751D8E999ULL == statehash_xxh64("", 0, 0));
+    T(0x44BC2CF5AD770999ULL == statehash_xxh64("abc", 3, 0));
+    T(0xFBCEA83C8A378BF1ULL == statehash_xxh64(str, strlen(str), 0));
+    T(0x6AC1E58032166597ULL == statehash_xxh64(data, sizeof(data), 0));
+    T(0x3B97D91EBA03E785ULL == statehash_xxh64(data, sizeof(data), 0x9E3779B97F4A7C15ULL));
+}
+
+typedef struct {
+    uint32_t value;
+    uint8_t* page;
+    void (*func)(void);
+    uintptr_t number;
+    uint8_t mem[64];
+} reloc_test_t;
+
+static void reloc_test_func(void) { }
+
+UTEST(statehash, reloc) {
+    static reloc_test_t a;
+    static reloc_test_t b;
+    memset(&a, 0, sizeof(a));
+    a.value = 0x12345678;
+    a.page = &a.mem[16];
+    a.func = reloc_test_func;
+    a.number = 1234;
+    reloc_reset();
+    reloc_add_image(&a);
+
+    /* tokens don't depend on the absolute address */
+    reloc_normalize(&b, &a, sizeof(a));
+    T(b.value == a.value);
+    T(b.number == a.number);
+    T((uintptr_t)b.page != (uintptr_t)a.page);
+
+    /* ...and round-trip to the original pointers */
+    reloc_denormalize(&b, sizeof(b));
+    T(0 == memcmp(&a, &b, sizeof(a)));
+
+    /* an explicit range takes pointers out of the image window */
+    uint8_t heap[32];
+    reloc_reset();
+    reloc_add_range(heap, sizeof(heap));
+    a.page = &heap[8];
+    reloc_normalize(&b, &a, sizeof(a));
+    T((uintptr_t)b.page != (uintptr_t)a.page);
+    T(b.func == a.func);
+    reloc_denormalize(&b, sizeof(b));
+    T(b.page == &heap[8]);
+
+    /* words in excluded ranges are never changed, even if they look like pointers or tokens */
+    reloc_reset();
+    reloc_add_image(&a);
+    reloc_exclude(a.mem, sizeof(a.mem));
+    a.page = &a.mem[32];
+    const uintptr_t fake_ptr = (uintptr_t)&a.mem[8];
+    const uintptr_t fake_token = RELOC_TAG | 123;
+    memcpy(&a.mem[0], &fake_ptr, sizeof(fake_ptr));
+    memcpy(&a.mem[16], &fake_token, sizeof(fake_token));
+    memcpy(&b, &a, sizeof(a));
+    reloc_normalize(&a, &a, sizeof(a));
+    T((uintptr_t)a.page != (uintptr_t)b.page);
+    T(0 == memcmp(a.mem, b.mem, sizeof(a.mem)));
+    reloc_denormalize(&a, sizeof(a));
+    T(0 == memcmp(&a, &b, sizeof(a)));
+    reloc_reset();
+}
+
+static int run_frames(const char* record_path, const char* compare_path, int diverge_frame) {
+    static uint8_t ram[1024];
+    static uint8_t fb[256];
+    memset(ram, 0, sizeof(ram));
+    memset(fb, 0, sizeof(fb));
+    if (!statehash_init(&(statehash_desc_t){ .record_path = record_path, .compare_path = compare_path })) {
+        return -1;
+    }
+    statehash_add_region("ram", ram, sizeof(ram), false);
+    statehash_add_region("fb", fb, sizeof(fb), false);
+    int first = -1;
+    for (int frame = 0; frame < 16; frame++) {
+        ram[frame] = (uint8_t)frame;
+        fb[frame] = (uint8_t)(frame * 3);
+        if (frame == diverge_frame) {
+            fb[200] = 0xFF;
+        }
+        statehash_frame();
+        if ((first < 0) && statehash_diverged()) {
+            first = frame;
+        }
+    }
+    statehash_shutdown();
+    return first;
+}
+
+UTEST(statehash, compare) {
+    const char* path = "statehash-test.bin";
+    stm_setup();
+    T(-1 == run_frames(path, 0, -1));
+    T(-1 == run_frames(0, path, -1));
+    T(5 == run_frames(0, path, 5));
+    T(!statehash_enabled());
+    remove(path);
+}
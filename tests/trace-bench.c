@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+//  trace-bench.c
+//  Unthrottled headless ZX Spectrum 48K, measures the overhead of
+//  recording the execution history into the debugger's trace ring.
+//
+//  Runs the boot sequence and idle BASIC prompt once without and once
+//  with the trace trap installed (in 20ms frames like the UI frontends),
+//  and prints the effective emulated CPU speed of both runs.
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#define SOKOL_IMPL
+#include "sokol_time.h"
+#define CHIPS_IMPL
+#include "chips/z80.h"
+#include "chips/beeper.h"
+#include "chips/ay38910.h"
+#include "chips/kbd.h"
+#include "chips/clk.h"
+#include "chips/mem.h"
+#include "systems/zx.h"
+#include "zx-roms.h"
+#define COMMON_IMPL
+#include "tracez80.h"
+
+#define FRAME_USEC (20000)
+#define NUM_FRAMES (500)
+#define CPU_FREQ_MHZ (3.5)
+
+static zx_t zx;
+
+static void dummy_audio_callback(const float* samples, int num_samples, void* user_data) {
+    (void)samples;
+    (void)num_samples;
+    (void)user_data;
+};
+
+/* run the emulator from a cold boot and return the effective CPU speed in MHz */
+static double run(bool traced) {
+    static uint32_t pixel_buffer[320*256];
+    zx_init(&zx, &(zx_desc_t){
+        .type = ZX_TYPE_48K,
+        .pixel_buffer = pixel_buffer,
+        .pixel_buffer_size = sizeof(pixel_buffer),
+        .audio_cb = dummy_audio_callback,
+        .rom_zx48k = dump_amstrad_zx48k_bin,
+        .rom_zx48k_size = sizeof(dump_amstrad_zx48k_bin),
+    });
+    uint64_t start = stm_now();
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        if (traced) {
+            tracez80_attach(&zx.cpu, &zx.mem);
+        }
+        zx_exec(&zx, FRAME_USEC);
+        if (traced) {
+            tracez80_detach(&zx.cpu);
+        }
+    }
+    const double secs = stm_sec(stm_since(start));
+    const double emu_secs = (NUM_FRAMES * FRAME_USEC) / 1000000.0;
+    zx_discard(&zx);
+    return (CPU_FREQ_MHZ * emu_secs) / secs;
+}
+
+int main() {
+    stm_setup();
+    printf("== running %d frames without trace\n", NUM_FRAMES);
+    const double plain_mhz = run(false);
+    printf("== %.1f MHz\n", plain_mhz);
+    trace_init(&tracez80_desc);
+    printf("== running %d frames with trace (%d entries, %d KB)\n", NUM_FRAMES,
+        TRACE_DEFAULT_ENTRIES, (int)((TRACE_DEFAULT_ENTRIES * sizeof(trace_entry_t)) / 1024));
+    const double traced_mhz = run(true);
+    printf("== %.1f MHz, %d instructions in ring\n", traced_mhz, trace_count());
+    printf("== overhead: %.1f%%\n", ((plain_mhz / traced_mhz) - 1.0) * 100.0);
+    trace_shutdown();
+    return 0;
+}
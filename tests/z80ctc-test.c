@@ -119,6 +119,43 @@ UTEST(z80ctc, counter) {
     }
 }
 
+/* number of ticks between zero-count events of a free-running timer,
+   this is what a lazily updated timer needs to predict */
+static int timer_period(uint8_t ctrl, uint8_t constant) {
+    const int prescaler = (ctrl & Z80CTC_CTRL_PRESCALER_256) ? 256 : 16;
+    return prescaler * (constant ? constant : 256);
+}
+
+UTEST(z80ctc, timer_period) {
+    const uint8_t prescalers[2] = { Z80CTC_CTRL_PRESCALER_16, Z80CTC_CTRL_PRESCALER_256 };
+    const uint8_t constants[4] = { 1, 10, 255, 0 };
+    for (int pi = 0; pi < 2; pi++) {
+        for (int ci = 0; ci < 4; ci++) {
+            z80ctc_t ctc;
+            z80ctc_init(&ctc);
+            uint64_t pins = 0;
+            const uint8_t ctrl = Z80CTC_CTRL_EI|Z80CTC_CTRL_MODE_TIMER|
+                prescalers[pi]|Z80CTC_CTRL_TRIGGER_AUTO|
+                Z80CTC_CTRL_CONST_FOLLOWS|Z80CTC_CTRL_CONTROL;
+            pins = _z80ctc_write(&ctc, pins, 2, ctrl);
+            pins = _z80ctc_write(&ctc, pins, 2, constants[ci]);
+            /* the per-tick implementation must hit the predicted ticks exactly */
+            const int period = timer_period(ctrl, constants[ci]);
+            int next = period;
+            for (int i = 1; i <= 3 * period; i++) {
+                pins = z80ctc_tick(&ctc, pins);
+                if (i == next) {
+                    T(pins & Z80CTC_ZCTO2);
+                    next += period;
+                }
+                else {
+                    T(0 == (pins & Z80CTC_ZCTO2));
+                }
+            }
+        }
+    }
+}
+
 /* a complete, integrated interrupt handling test */
 static z80_t cpu;
 static z80ctc_t ctc;
@@ -0,0 +1,249 @@
+//------------------------------------------------------------------------------
+//  zxtap-test.c
+//  Compare the ZX Spectrum tape trap loader against the ROM's LD-BYTES
+//  routine loading the same blocks from an emulated tape signal.
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chips/z80.h"
+#define COMMON_IMPL
+#include "zxtap.h"
+#include "zx-roms.h"
+#include "utest.h"
+
+#define T(b) ASSERT_TRUE(b)
+
+/* standard ROM loader timings in Z80 ticks */
+#define PILOT_PULSE (2168)
+#define PILOT_HEADER (8063)
+#define PILOT_DATA (3223)
+#define SYNC1_PULSE (667)
+#define SYNC2_PULSE (735)
+#define BIT0_PULSE (855)
+#define BIT1_PULSE (1710)
+#define PAUSE_TICKS (3500000)
+
+/* where LD-BYTES returns to, and where the trap loader stops */
+#define RET_ADDR (0xFF00)
+#define STACK_ADDR (0xFFF0)
+
+#define MAX_EDGES (1<<16)
+static uint64_t edges[MAX_EDGES];
+static int num_edges;
+static int edge_index;
+static uint64_t ticks;
+
+static z80_t cpu;
+static uint8_t rom_mem[1<<16];
+static uint8_t trap_mem[1<<16];
+
+static void pulse(uint64_t* t, uint32_t len) {
+    *t += len;
+    if (num_edges < MAX_EDGES) {
+        edges[num_edges++] = *t;
+    }
+}
+
+/* convert a .tap file into signal edges */
+static void tape_signal(const uint8_t* tap, int size) {
+    num_edges = 0;
+    edge_index = 0;
+    ticks = 0;
+    uint64_t t = 10000;
+    int pos = 0;
+    while (pos < size) {
+        const int len = tap[pos] | (tap[pos+1]<<8);
+        const uint8_t* block = &tap[pos + 2];
+        const int num_pilot = (block[0] & 0x80) ? PILOT_DATA : PILOT_HEADER;
+        for (int i = 0; i < num_pilot; i++) {
+            pulse(&t, PILOT_PULSE);
+        }
+        pulse(&t, SYNC1_PULSE);
+        pulse(&t, SYNC2_PULSE);
+        for (int i = 0; i < len; i++) {
+            for (int bit = 7; bit >= 0; bit--) {
+                const uint32_t l = (block[i] & (1<<bit)) ? BIT1_PULSE : BIT0_PULSE;
+                pulse(&t, l);
+                pulse(&t, l);
+            }
+        }
+        t += PAUSE_TICKS;
+        pos += 2 + len;
+    }
+}
+
+static uint64_t tick(int num, uint64_t pins, void* user_data) {
+    (void)user_data;
+    if (pins & Z80_MREQ) {
+        const uint16_t addr = Z80_GET_ADDR(pins);
+        if (pins & Z80_RD) {
+            Z80_SET_DATA(pins, rom_mem[addr]);
+        }
+        else if ((pins & Z80_WR) && (addr >= 0x4000)) {
+            rom_mem[addr] = Z80_GET_DATA(pins);
+        }
+    }
+    else if ((pins & Z80_IORQ) && (pins & Z80_RD)) {
+        if (0 == (Z80_GET_ADDR(pins) & 1)) {
+            /* ULA port: EAR in bit 6, no keys pressed */
+            while ((edge_index < num_edges) && (edges[edge_index] <= ticks)) {
+                edge_index++;
+            }
+            Z80_SET_DATA(pins, (edge_index & 1) ? 0xFF : 0xBF);
+        }
+        else {
+            Z80_SET_DATA(pins, 0xFF);
+        }
+    }
+    ticks += num;
+    return pins;
+}
+
+static int trap(uint16_t pc, uint32_t num_ticks, uint64_t pins, void* user_data) {
+    (void)num_ticks; (void)pins; (void)user_data;
+    return (pc == RET_ADDR) ? 1 : 0;
+}
+
+static uint8_t trap_rd(uint16_t addr, void* user_data) {
+    (void)user_data;
+    return trap_mem[addr];
+}
+
+static void trap_wr(uint16_t addr, uint8_t data, void* user_data) {
+    (void)user_data;
+    if (addr >= 0x4000) {
+        trap_mem[addr] = data;
+    }
+}
+
+static void init(const uint8_t* tap, int size) {
+    uint32_t x = 0x12345678;
+    for (int i = 0; i < (1<<16); i++) {
+        x ^= x<<13; x ^= x>>17; x ^= x<<5;
+        rom_mem[i] = (uint8_t) x;
+    }
+    memcpy(rom_mem, dump_amstrad_zx48k_bin, sizeof(dump_amstrad_zx48k_bin));
+    rom_mem[RET_ADDR] = 0x00;
+    rom_mem[STACK_ADDR] = RET_ADDR & 0xFF;
+    rom_mem[STACK_ADDR + 1] = RET_ADDR >> 8;
+    memcpy(trap_mem, rom_mem, sizeof(trap_mem));
+    z80_init(&cpu, &(z80_desc_t){ .tick_cb = tick });
+    z80_trap_cb(&cpu, trap, 0);
+    tape_signal(tap, size);
+    zxtap_insert(tap, size);
+}
+
+/* run the ROM's LD-BYTES routine on the tape signal */
+static zxtap_regs_t rom_ld_bytes(zxtap_regs_t in) {
+    z80_set_a(&cpu, in.a);
+    z80_set_f(&cpu, in.f);
+    z80_set_de(&cpu, in.de);
+    z80_set_ix(&cpu, in.ix);
+    z80_set_sp(&cpu, STACK_ADDR);
+    z80_set_pc(&cpu, ZXTAP_LD_BYTES);
+    const uint64_t max_ticks = ticks + 100000000;
+    while ((z80_pc(&cpu) != RET_ADDR) && (ticks < max_ticks)) {
+        z80_exec(&cpu, 1000000);
+    }
+    return (zxtap_regs_t) { .a = z80_a(&cpu), .f = z80_f(&cpu), .de = z80_de(&cpu), .ix = z80_ix(&cpu) };
+}
+
+/* run the trap loader */
+static zxtap_regs_t trap_ld_bytes(zxtap_regs_t in) {
+    zxtap_ld_bytes(&in, trap_rd, trap_wr, 0);
+    return in;
+}
+
+static bool same(zxtap_regs_t in) {
+    const zxtap_regs_t r0 = rom_ld_bytes(in);
+    const zxtap_regs_t r1 = trap_ld_bytes(in);
+    return (z80_pc(&cpu) == RET_ADDR) &&
+           (r0.a == r1.a) && (r0.f == r1.f) && (r0.de == r1.de) && (r0.ix == r1.ix) &&
+           (0 == memcmp(&rom_mem[0x4000], &trap_mem[0x4000], RET_ADDR - 0x4000));
+}
+
+/* append a block to a .tap file, returns new size */
+static int add_block(uint8_t* tap, int pos, uint8_t flag, const uint8_t* data, int len, uint8_t checksum_xor) {
+    tap[pos++] = (uint8_t)(len + 2);
+    tap[pos++] = (uint8_t)((len + 2)>>8);
+    tap[pos++] = flag;
+    uint8_t checksum = flag;
+    for (int i = 0; i < len; i++) {
+        tap[pos++] = data[i];
+        checksum ^= data[i];
+    }
+    tap[pos++] = checksum ^ checksum_xor;
+    return pos;
+}
+
+static const uint8_t header[17] = {
+    3, 'z', 'x', 't', 'a', 'p', ' ', 't', 'e', 's', 't', 0x80, 0x00, 0x00, 0x80, 0x00, 0x80
+};
+
+static int test_tap(uint8_t* tap, uint8_t checksum_xor) {
+    uint8_t data[128];
+    for (int i = 0; i < (int)sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7);
+    }
+    int size = add_block(tap, 0, 0x00, header, sizeof(header), 0);
+    return add_block(tap, size, 0xFF, data, sizeof(data), checksum_xor);
+}
+
+#define LOAD (1)
+#define VERIFY (0)
+
+UTEST(zxtap, load) {
+    uint8_t tap[256];
+    init(tap, test_tap(tap, 0));
+    T(same((zxtap_regs_t){ .a = 0x00, .f = LOAD, .de = 17, .ix = 0x9000 }));
+    T(0x93 == z80_f(&cpu));
+    T(same((zxtap_regs_t){ .a = 0xFF, .f = LOAD, .de = 128, .ix = 0x8000 }));
+    T(0x93 == z80_f(&cpu));
+    T(!zxtap_ready());
+}
+
+UTEST(zxtap, checksum_error) {
+    uint8_t tap[256];
+    init(tap, test_tap(tap, 0x55));
+    T(same((zxtap_regs_t){ .a = 0x00, .f = LOAD, .de = 17, .ix = 0x9000 }));
+    T(same((zxtap_regs_t){ .a = 0xFF, .f = LOAD, .de = 128, .ix = 0x8000 }));
+    T(0 == (z80_f(&cpu) & 1));
+}
+
+UTEST(zxtap, flag_mismatch) {
+    uint8_t tap[256];
+    init(tap, test_tap(tap, 0));
+    T(same((zxtap_regs_t){ .a = 0xFF, .f = LOAD, .de = 128, .ix = 0x8000 }));
+    T(0 == (z80_f(&cpu) & 1));
+}
+
+UTEST(zxtap, short_block) {
+    uint8_t tap[256];
+    init(tap, test_tap(tap, 0));
+    T(same((zxtap_regs_t){ .a = 0x00, .f = LOAD, .de = 32, .ix = 0x9000 }));
+    T(0 == (z80_f(&cpu) & 1));
+}
+
+UTEST(zxtap, verify) {
+    uint8_t tap[256];
+    init(tap, test_tap(tap, 0));
+    memcpy(&rom_mem[0x9000], header, sizeof(header));
+    memcpy(&trap_mem[0x9000], header, sizeof(header));
+    rom_mem[0x9008] = trap_mem[0x9008] = 'X';
+    T(same((zxtap_regs_t){ .a = 0x00, .f = VERIFY, .de = 17, .ix = 0x9000 }));
+    T(0 == (z80_f(&cpu) & 1));
+    T(0x9008 == z80_ix(&cpu));
+}
+
+UTEST(zxtap, insert) {
+    const uint8_t bad[] = { 0x05, 0x00, 0xFF, 0x01 };
+    const uint8_t empty_block[] = { 0x00, 0x00 };
+    T(!zxtap_insert(bad, sizeof(bad)));
+    T(!zxtap_insert(empty_block, sizeof(empty_block)));
+    T(!zxtap_insert(bad, 0));
+    zxtap_remove();
+    T(!zxtap_ready());
+    zxtap_regs_t regs = { .a = 0xFF, .f = LOAD, .de = 1, .ix = 0x8000 };
+    T(!zxtap_ld_bytes(&regs, trap_rd, trap_wr, 0));
+}